@@ -0,0 +1,412 @@
+/* vi: set et sw=4 ts=4 cino=t0,(0: */
+/*
+ * Copyright (C) 2020 Alberto Mardegan <mardy@users.sourceforge.net>
+ *
+ * This file is part of Mappero.
+ *
+ * Mappero is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Mappero is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Mappero.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "binary-track.h"
+#include "debug.h"
+#include "projection.h"
+
+#include <QDataStream>
+#include <QIODevice>
+#include <QtEndian>
+#include <string.h>
+
+using namespace Mappero;
+
+/*
+ * File layout; all numbers are little endian.
+ *
+ * Header (96 bytes):
+ *    0  magic "MPRTRACK"
+ *    8  quint16 version
+ *   10  quint16 flags
+ *   12  quint32 number of points
+ *   16  quint32 number of segments
+ *   20  quint32 number of waypoints
+ *   24  char[16] name of the projection used for the zoom levels
+ *   40  double length, latMin, latMax, lonMin, lonMax
+ *   80  quint32 sizes of the coordinates, times, altitudes and metadata
+ *
+ * Then, in this order:
+ *   - the zoom level of each point, as qint8, padded to 4 bytes
+ *   - the start index of each segment, as quint32
+ *   - the distance of each point, as float (if HasDistance)
+ *   - latitudes and longitudes, in 1e-7 degrees: zig-zag encoded deltas
+ *     from the previous point, in varint format (LEB128), interleaved
+ *   - times, as zig-zag varint deltas (if HasTime)
+ *   - altitudes, as zig-zag varint deltas (if HasAltitude)
+ *   - metadata, in QDataStream format: the source, and the waypoints as a
+ *     count followed by (point index, data) pairs
+ */
+
+static const char magic[] = "MPRTRACK";
+static const int magicSize = 8;
+static const quint16 currentVersion = 1;
+static const int headerSize = 96;
+static const int projectionNameSize = 16;
+static const double coordinateScale = 1e7;
+
+enum Flag {
+    HasTime = 1 << 0,
+    HasAltitude = 1 << 1,
+    HasDistance = 1 << 2,
+};
+
+static inline qint64 padded(qint64 size)
+{
+    return (size + 3) & ~qint64(3);
+}
+
+static inline quint64 zigZag(qint64 value)
+{
+    return (quint64(value) << 1) ^ quint64(value >> 63);
+}
+
+static inline qint64 unZigZag(quint64 value)
+{
+    return qint64(value >> 1) ^ -qint64(value & 1);
+}
+
+static inline void appendVarint(QByteArray &out, qint64 value)
+{
+    quint64 v = zigZag(value);
+    char buffer[10];
+    int length = 0;
+    while (v >= 0x80) {
+        buffer[length++] = char(v | 0x80);
+        v >>= 7;
+    }
+    buffer[length++] = char(v);
+    out.append(buffer, length);
+}
+
+static inline bool readVarint(const uchar *&p, const uchar *end,
+                              qint64 &value)
+{
+    quint64 v = 0;
+    for (int shift = 0; shift < 64 && p < end; shift += 7) {
+        uchar byte = *p++;
+        v |= quint64(byte & 0x7f) << shift;
+        if (!(byte & 0x80)) {
+            value = unZigZag(v);
+            return true;
+        }
+    }
+    return false;
+}
+
+static inline void putDouble(double value, char *dest)
+{
+    quint64 bits;
+    memcpy(&bits, &value, sizeof(bits));
+    qToLittleEndian(bits, dest);
+}
+
+static inline double getDouble(const uchar *src)
+{
+    quint64 bits = qFromLittleEndian<quint64>(src);
+    double value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+static inline void putFloat(float value, char *dest)
+{
+    quint32 bits;
+    memcpy(&bits, &value, sizeof(bits));
+    qToLittleEndian(bits, dest);
+}
+
+static inline float getFloat(const uchar *src)
+{
+    quint32 bits = qFromLittleEndian<quint32>(src);
+    float value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+static inline qint32 toFixed(Geo degrees)
+{
+    return qint32(qRound64(degrees * coordinateScale));
+}
+
+static QByteArray projectionName(const Projection *projection)
+{
+    QByteArray name(projection->name);
+    name.resize(projectionNameSize);
+    return name;
+}
+
+bool BinaryTrack::hasSuffix(const QString &fileName)
+{
+    return fileName.endsWith(QLatin1Char('.') + QLatin1String(suffix()),
+                             Qt::CaseInsensitive);
+}
+
+bool BinaryTrack::isBinaryTrack(const QByteArray &header)
+{
+    return header.startsWith(QByteArray::fromRawData(magic, magicSize));
+}
+
+bool BinaryTrack::read(const uchar *data, qint64 size,
+                       const Projection *projection, PathData &pathData)
+{
+    if (size < headerSize ||
+        memcmp(data, magic, magicSize) != 0) return false;
+
+    quint16 version = qFromLittleEndian<quint16>(data + 8);
+    if (version > currentVersion) {
+        qWarning() << "Unsupported track version" << version;
+        return false;
+    }
+    if (!pathData.points.isEmpty()) {
+        qWarning() << "Binary tracks can only be loaded into empty paths";
+        return false;
+    }
+
+    quint16 flags = qFromLittleEndian<quint16>(data + 10);
+    qint64 pointCount = qFromLittleEndian<quint32>(data + 12);
+    qint64 segmentCount = qFromLittleEndian<quint32>(data + 16);
+    qint64 wayPointCount = qFromLittleEndian<quint32>(data + 20);
+    bool sameProjection =
+        memcmp(data + 24, projectionName(projection).constData(),
+               projectionNameSize) == 0;
+    qint64 coordinatesSize = qFromLittleEndian<quint32>(data + 80);
+    qint64 timesSize = qFromLittleEndian<quint32>(data + 84);
+    qint64 altitudesSize = qFromLittleEndian<quint32>(data + 88);
+    qint64 metadataSize = qFromLittleEndian<quint32>(data + 92);
+
+    qint64 segmentsOffset = headerSize + padded(pointCount);
+    qint64 distancesOffset = segmentsOffset + segmentCount * 4;
+    qint64 coordinatesOffset = distancesOffset +
+        ((flags & HasDistance) ? pointCount * 4 : 0);
+    qint64 timesOffset = coordinatesOffset + coordinatesSize;
+    qint64 altitudesOffset = timesOffset + timesSize;
+    qint64 metadataOffset = altitudesOffset + altitudesSize;
+    /* Each point takes at least one byte per coordinate: this also keeps
+     * a forged point count from making us allocate gigabytes */
+    if (pointCount > INT_MAX || segmentCount < 1 ||
+        pointCount * 2 > coordinatesSize ||
+        metadataOffset + metadataSize > size) {
+        qWarning() << "Truncated or corrupted track";
+        return false;
+    }
+
+    const uchar *zooms = data + headerSize;
+    const uchar *segments = data + segmentsOffset;
+    const uchar *distances = data + distancesOffset;
+    const uchar *coordinates = data + coordinatesOffset;
+    const uchar *times = data + timesOffset;
+    const uchar *altitudes = data + altitudesOffset;
+    const uchar *metadata = data + metadataOffset;
+
+    QVector<PathPoint> &points = pathData.points;
+    points.resize(int(pointCount));
+    PathPoint *p = points.data();
+
+    /* The only loop which has some work to do */
+    const uchar *end = times;
+    qint64 lat = 0, lon = 0;
+    int decoded = 0;
+    for (; decoded < pointCount; decoded++) {
+        PathPoint &point = p[decoded];
+        qint64 dLat, dLon;
+        if (!readVarint(coordinates, end, dLat) ||
+            !readVarint(coordinates, end, dLon)) break;
+        lat += dLat;
+        lon += dLon;
+        point.geo = GeoPoint(lat / coordinateScale, lon / coordinateScale);
+        point.unit = projection->geoToUnit(point.geo);
+        point.zoom = qint8(zooms[decoded]);
+    }
+
+    bool ok = decoded == pointCount && coordinates == end;
+    if (ok && (flags & HasTime)) {
+        end = altitudes;
+        qint64 time = 0;
+        for (int i = 0; ok && i < pointCount; i++) {
+            qint64 delta;
+            ok = readVarint(times, end, delta);
+            time += delta;
+            p[i].time = time_t(time);
+        }
+    }
+    if (ok && (flags & HasAltitude)) {
+        end = metadata;
+        qint64 altitude = 0;
+        for (int i = 0; ok && i < pointCount; i++) {
+            qint64 delta;
+            ok = readVarint(altitudes, end, delta);
+            altitude += delta;
+            p[i].altitude = qint16(altitude);
+        }
+    }
+    if (!ok) {
+        qWarning() << "Corrupted track data";
+        points.clear();
+        return false;
+    }
+
+    if (flags & HasDistance) {
+        for (int i = 0; i < pointCount; i++) {
+            p[i].distance = getFloat(distances + i * 4);
+        }
+    }
+
+    pathData.segments.clear();
+    for (int i = 0; i < segmentCount; i++) {
+        qint64 startIndex = qFromLittleEndian<quint32>(segments + i * 4);
+        pathData.segments.append(PathSegment(int(qMin(startIndex,
+                                                      pointCount))));
+    }
+
+    QByteArray metadataBytes =
+        QByteArray::fromRawData(reinterpret_cast<const char *>(metadata),
+                                int(metadataSize));
+    QDataStream stream(metadataBytes);
+    stream.setVersion(QDataStream::Qt_5_6);
+    QString source;
+    qint32 storedWayPoints = 0;
+    stream >> source >> storedWayPoints;
+    pathData.setSource(source);
+    pathData.wayPoints.reserve(int(wayPointCount));
+    for (int i = 0; i < storedWayPoints && stream.status() == QDataStream::Ok;
+         i++) {
+        qint32 pointIndex;
+        QVariantMap wayPointData;
+        stream >> pointIndex >> wayPointData;
+        if (pointIndex < 0 || pointIndex >= pointCount) continue;
+        pathData.makeWayPoint(wayPointData, pointIndex);
+    }
+
+    pathData.m_length = getDouble(data + 40);
+    pathData.latMin = getDouble(data + 48);
+    pathData.latMax = getDouble(data + 56);
+    pathData.lonMin = getDouble(data + 64);
+    pathData.lonMax = getDouble(data + 72);
+
+    /* The zoom levels depend on the projection */
+    if (!sameProjection) {
+        pathData.pointsOptimized = 0;
+        pathData.optimize();
+    }
+    pathData.markOptimized();
+    return true;
+}
+
+bool BinaryTrack::write(QIODevice *device, const Projection *projection,
+                        const PathData &pathData)
+{
+    const QVector<PathPoint> &points = pathData.points;
+    int pointCount = points.count();
+
+    quint16 flags = 0;
+    Q_FOREACH(const PathPoint &p, points) {
+        if (p.time != 0) flags |= HasTime;
+        if (p.altitude != 0) flags |= HasAltitude;
+        if (p.distance != 0) flags |= HasDistance;
+    }
+
+    QByteArray columns;
+    columns.reserve(int(padded(pointCount)) + pointCount * 4);
+    Q_FOREACH(const PathPoint &p, points) {
+        columns.append(char(p.zoom));
+    }
+    columns.resize(int(padded(pointCount)));
+
+    int segmentsStart = columns.size();
+    columns.resize(segmentsStart + pathData.segments.count() * 4);
+    for (int i = 0; i < pathData.segments.count(); i++) {
+        qToLittleEndian(quint32(pathData.segments[i].startIndex),
+                        columns.data() + segmentsStart + i * 4);
+    }
+
+    if (flags & HasDistance) {
+        int distancesStart = columns.size();
+        columns.resize(distancesStart + pointCount * 4);
+        for (int i = 0; i < pointCount; i++) {
+            putFloat(points[i].distance,
+                     columns.data() + distancesStart + i * 4);
+        }
+    }
+
+    /* Most deltas take one or two bytes each */
+    QByteArray coordinates, times, altitudes;
+    coordinates.reserve(pointCount * 4);
+    qint32 lat = 0, lon = 0;
+    Q_FOREACH(const PathPoint &p, points) {
+        qint32 pointLat = toFixed(p.geo.lat);
+        qint32 pointLon = toFixed(p.geo.lon);
+        appendVarint(coordinates, qint64(pointLat) - lat);
+        appendVarint(coordinates, qint64(pointLon) - lon);
+        lat = pointLat;
+        lon = pointLon;
+    }
+    if (flags & HasTime) {
+        times.reserve(pointCount);
+        qint64 time = 0;
+        Q_FOREACH(const PathPoint &p, points) {
+            appendVarint(times, qint64(p.time) - time);
+            time = p.time;
+        }
+    }
+    if (flags & HasAltitude) {
+        altitudes.reserve(pointCount);
+        qint64 altitude = 0;
+        Q_FOREACH(const PathPoint &p, points) {
+            appendVarint(altitudes, p.altitude - altitude);
+            altitude = p.altitude;
+        }
+    }
+
+    QByteArray metadata;
+    QDataStream stream(&metadata, QIODevice::WriteOnly);
+    stream.setVersion(QDataStream::Qt_5_6);
+    stream << pathData.source() << qint32(pathData.wayPoints.count());
+    Q_FOREACH(const PathWayPoint &wayPoint, pathData.wayPoints) {
+        stream << qint32(wayPoint.pointIndex) << wayPoint.data;
+    }
+
+    QByteArray header(headerSize, '\0');
+    char *h = header.data();
+    memcpy(h, magic, magicSize);
+    qToLittleEndian(currentVersion, h + 8);
+    qToLittleEndian(flags, h + 10);
+    qToLittleEndian(quint32(pointCount), h + 12);
+    qToLittleEndian(quint32(pathData.segments.count()), h + 16);
+    qToLittleEndian(quint32(pathData.wayPoints.count()), h + 20);
+    memcpy(h + 24, projectionName(projection).constData(),
+           projectionNameSize);
+    putDouble(pathData.m_length, h + 40);
+    putDouble(pathData.latMin, h + 48);
+    putDouble(pathData.latMax, h + 56);
+    putDouble(pathData.lonMin, h + 64);
+    putDouble(pathData.lonMax, h + 72);
+    qToLittleEndian(quint32(coordinates.size()), h + 80);
+    qToLittleEndian(quint32(times.size()), h + 84);
+    qToLittleEndian(quint32(altitudes.size()), h + 88);
+    qToLittleEndian(quint32(metadata.size()), h + 92);
+
+    return device->write(header) == header.size() &&
+        device->write(columns) == columns.size() &&
+        device->write(coordinates) == coordinates.size() &&
+        device->write(times) == times.size() &&
+        device->write(altitudes) == altitudes.size() &&
+        device->write(metadata) == metadata.size();
+}
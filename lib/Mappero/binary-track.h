@@ -0,0 +1,49 @@
+/* vi: set et sw=4 ts=4 cino=t0,(0: */
+/*
+ * Copyright (C) 2020 Alberto Mardegan <mardy@users.sourceforge.net>
+ *
+ * This file is part of Mappero.
+ *
+ * Mappero is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Mappero is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Mappero.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef MAPPERO_BINARY_TRACK_H
+#define MAPPERO_BINARY_TRACK_H
+
+#include "path.h"
+
+#include <QByteArray>
+
+namespace Mappero {
+
+/* Mappero's own track format: coordinates, times and altitudes are stored
+ * as variable length deltas; zoom levels, segments, distances, bounds and
+ * length are stored as they are in memory, so that loading a track needs
+ * no computation besides the projection of its points. */
+class MAPPERO_EXPORT BinaryTrack
+{
+public:
+    static const char *suffix() { return "mtrk"; }
+    static bool hasSuffix(const QString &fileName);
+    static bool isBinaryTrack(const QByteArray &header);
+
+    static bool read(const uchar *data, qint64 size,
+                     const Projection *projection, PathData &pathData);
+    static bool write(QIODevice *device, const Projection *projection,
+                      const PathData &pathData);
+};
+
+}; // namespace
+
+#endif /* MAPPERO_BINARY_TRACK_H */
@@ -22,6 +22,7 @@
 #include "gpx.h"
 
 #include <QDateTime>
+#include <QIODevice>
 #include <QXmlStreamReader>
 
 using namespace Mappero;
@@ -35,37 +36,158 @@ Gpx::~Gpx()
 {
 }
 
+static inline int parseDigits(const QChar *p, int count)
+{
+    int value = 0;
+    for (int i = 0; i < count; i++) {
+        ushort c = p[i].unicode();
+        if (c < '0' || c > '9') return -1;
+        value = value * 10 + (c - '0');
+    }
+    return value;
+}
+
+/* Days since 1970-01-01 of a date in the proleptic Gregorian calendar */
+static qint64 daysFromCivil(int year, int month, int day)
+{
+    year -= month <= 2;
+    int era = (year >= 0 ? year : year - 399) / 400;
+    int yearOfEra = year - era * 400;
+    int dayOfYear = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+    int dayOfEra = yearOfEra * 365 + yearOfEra / 4 - yearOfEra / 100 +
+        dayOfYear;
+    return qint64(era) * 146097 + dayOfEra - 719468;
+}
+
+/* Parses the "YYYY-MM-DDThh:mm:ss[.sss](Z|+hh:mm)" timestamps written by
+ * GPS devices, without going through QDateTime. Times without a zone are
+ * local times, and are left to QDateTime like anything else unusual. */
+static time_t parseTime(const QStringRef &text)
+{
+    const QChar *p = text.unicode();
+    int length = text.size();
+    while (length > 0 && p->isSpace()) { p++; length--; }
+    while (length > 0 && p[length - 1].isSpace()) length--;
+
+    if (length >= 20 &&
+        p[4] == QLatin1Char('-') && p[7] == QLatin1Char('-') &&
+        p[10] == QLatin1Char('T') &&
+        p[13] == QLatin1Char(':') && p[16] == QLatin1Char(':')) {
+        int year = parseDigits(p, 4);
+        int month = parseDigits(p + 5, 2);
+        int day = parseDigits(p + 8, 2);
+        int hour = parseDigits(p + 11, 2);
+        int minute = parseDigits(p + 14, 2);
+        int second = parseDigits(p + 17, 2);
+
+        /* Fractions of a second are dropped, as QDateTime::toTime_t()
+         * does */
+        int i = 19;
+        if (p[i] == QLatin1Char('.')) {
+            for (i++; i < length && p[i].isDigit(); i++) {}
+        }
+
+        int offset = -1;
+        if (i == length - 1 && p[i] == QLatin1Char('Z')) {
+            offset = 0;
+        } else if (i < length &&
+                   (p[i] == QLatin1Char('+') || p[i] == QLatin1Char('-'))) {
+            int sign = p[i] == QLatin1Char('-') ? -1 : 1;
+            const QChar *zone = p + i + 1;
+            int zoneLength = length - i - 1;
+            int hours = -1, minutes = -1;
+            if (zoneLength == 5 && zone[2] == QLatin1Char(':')) {
+                hours = parseDigits(zone, 2);
+                minutes = parseDigits(zone + 3, 2);
+            } else if (zoneLength == 4) {
+                hours = parseDigits(zone, 2);
+                minutes = parseDigits(zone + 2, 2);
+            } else if (zoneLength == 2) {
+                hours = parseDigits(zone, 2);
+                minutes = 0;
+            }
+            if (hours >= 0 && minutes >= 0) {
+                offset = sign * (hours * 3600 + minutes * 60);
+            }
+        }
+
+        if (year >= 0 && month >= 1 && month <= 12 && day >= 1 &&
+            day <= 31 && hour >= 0 && hour < 24 && minute >= 0 &&
+            minute < 60 && second >= 0 && second < 61 && offset != -1) {
+            qint64 seconds = daysFromCivil(year, month, day) * 86400 +
+                hour * 3600 + minute * 60 + second - offset;
+            return time_t(seconds);
+        }
+    }
+
+    return QDateTime::fromString(text.toString(), Qt::ISODate).toTime_t();
+}
+
+/* Moves the reader to the text of the current element, which can then be
+ * parsed in place with xml.text(); unlike readElementText(), nothing is
+ * copied. Returns false if the element has no text, in which case the
+ * reader is already on the end element. */
+static bool readToText(QXmlStreamReader &xml)
+{
+    while (!xml.atEnd()) {
+        xml.readNext();
+        if (xml.isEndElement()) return false;
+        if (xml.isCharacters() && !xml.isWhitespace()) return true;
+        if (xml.isStartElement()) xml.skipCurrentElement();
+    }
+    return false;
+}
+
+/* Skips the rest of the current element */
+static void finishElement(QXmlStreamReader &xml)
+{
+    while (!xml.atEnd()) {
+        xml.readNext();
+        if (xml.isEndElement()) return;
+        if (xml.isStartElement()) xml.skipCurrentElement();
+    }
+}
+
 void Gpx::parseTrkseg(QXmlStreamReader &xml, PathData &pathData)
 {
     QVector<PathPoint> &points = pathData.points;
+    bool reportedUnknown = false;
 
     while (xml.readNextStartElement()) {
-        if (xml.name() == "trkpt") {
+        if (xml.name() == QLatin1String("trkpt")) {
             QXmlStreamAttributes attributes = xml.attributes();
-            QStringRef lat = attributes.value("lat");
-            QStringRef lon = attributes.value("lon");
+            QStringRef lat = attributes.value(QLatin1String("lat"));
+            QStringRef lon = attributes.value(QLatin1String("lon"));
             if (lat.isEmpty() || lon.isEmpty()) continue;
 
-            PathPoint p(GeoPoint(lat.toString().toDouble(),
-                                 lon.toString().toDouble()));
+            PathPoint p(GeoPoint(parseDouble(lat), parseDouble(lon)));
+            p.distance = -1;
             QString desc;
 
             while (xml.readNextStartElement()) {
-                if (xml.name() == "ele") {
-                    p.altitude = xml.readElementText().toFloat();
-                } else if (xml.name() == "time") {
-                    QDateTime time =
-                        QDateTime::fromString(xml.readElementText(),
-                                              Qt::ISODate);
-                    p.time = time.toTime_t();
-                } else if (xml.name() == "cmt") {
+                QStringRef name = xml.name();
+                if (name == QLatin1String("ele")) {
+                    if (readToText(xml)) {
+                        p.altitude = qint16(parseDouble(xml.text()));
+                        finishElement(xml);
+                    }
+                } else if (name == QLatin1String("time")) {
+                    if (readToText(xml)) {
+                        p.time = parseTime(xml.text());
+                        finishElement(xml);
+                    }
+                } else if (name == QLatin1String("cmt")) {
                     desc = xml.readElementText();
                 } else {
-                    DEBUG() << "Unrecognized element:" << xml.name();
+                    /* Usually the same elements are found in every point */
+                    if (!reportedUnknown) {
+                        DEBUG() << "Unrecognized element:" << name;
+                        reportedUnknown = true;
+                    }
                     xml.skipCurrentElement();
                 }
             }
-            pathData.addPoint(p);
+            pathData.appendPoint(p);
 
             /* is it a waypoint? */
             if (!desc.isEmpty()) {
@@ -79,6 +201,19 @@ void Gpx::parseTrkseg(QXmlStreamReader &xml, PathData &pathData)
 
 bool Gpx::read(QXmlStreamReader &xml, PathData &pathData)
 {
+    /* A track point with elevation and time takes at least this many bytes:
+     * reserving for the whole file saves many reallocations of big tracks */
+    static const int minBytesPerPoint = 96;
+    static const qint64 maxReservedPoints = 16 * 1024 * 1024;
+
+    QVector<PathPoint> &points = pathData.points;
+    QIODevice *device = xml.device();
+    if (device && !device->isSequential()) {
+        qint64 expected = (device->size() - device->pos()) / minBytesPerPoint;
+        points.reserve(points.count() + int(qMin(expected,
+                                                  maxReservedPoints)));
+    }
+
     while (xml.readNextStartElement()) {
         if (xml.name() == "trk") {
             while (xml.readNextStartElement()) {
@@ -95,6 +230,11 @@ bool Gpx::read(QXmlStreamReader &xml, PathData &pathData)
             xml.skipCurrentElement();
         }
     }
+
+    /* Points with extensions take many more bytes */
+    if (points.capacity() > points.count() + points.count() / 4) {
+        points.squeeze();
+    }
     return true;
 }
 
@@ -22,8 +22,10 @@
 #include "kml.h"
 
 #include <QDateTime>
-#include <QStringList>
+#include <QHash>
+#include <QPair>
 #include <QXmlStreamReader>
+#include <algorithm>
 
 using namespace Mappero;
 
@@ -35,20 +37,47 @@ struct KmlWayPoint {
     QString desc;
 };
 
+typedef QPair<Geo,Geo> Coordinates;
+typedef QHash<Coordinates,QVector<int> > PointIndexes;
+
+static inline Coordinates coordinates(const GeoPoint &geo)
+{
+    return qMakePair(geo.lat, geo.lon);
+}
+
 static void
 makeWayPoints(PathData &pathData,
               const QList<KmlWayPoint> &wayPoints)
 {
+    if (wayPoints.isEmpty()) return;
+
+    /* In one pass over the path, collect the indexes of the points lying
+     * on any of the waypoints */
+    PointIndexes indexes;
+    foreach (const KmlWayPoint &wp, wayPoints) {
+        indexes.insert(coordinates(wp.p.geo), QVector<int>());
+    }
+    const QVector<PathPoint> &points = pathData.points;
+    for (int i = 0; i < points.count(); i++) {
+        PointIndexes::iterator it = indexes.find(coordinates(points[i].geo));
+        if (it != indexes.end()) it->append(i);
+    }
+
+    /* Each waypoint goes to the first matching point after the previous
+     * waypoint */
     int index = 0;
     foreach (const KmlWayPoint &wp, wayPoints) {
-        int wpIndex = pathData.points.indexOf(wp.p, index);
-        if (wpIndex < 0) {
+        const QVector<int> &candidates =
+            indexes.constFind(coordinates(wp.p.geo)).value();
+        QVector<int>::const_iterator i =
+            std::lower_bound(candidates.begin(), candidates.end(), index);
+        if (i == candidates.end()) {
             qWarning() << "Waypoint not found:" << wp.desc;
             continue;
         }
 
-        pathData.makeWayPoint(wp.desc, wpIndex);
-        index = wpIndex + 1;
+        pathData.makeWayPoint(wp.desc, *i);
+        index = *i + 1;
     }
 }
 
@@ -63,19 +92,43 @@ Kml::~Kml()
 
 void Kml::parseCoordinates(QXmlStreamReader &xml)
 {
-    QStringList pts = xml.readElementText().split(" ");
-    foreach (const QString &point, pts) {
-        if (point.isEmpty()) continue;
-        QStringList coords = point.split(",");
-        if (coords.count() < 2) {
-            DEBUG() << "Incomplete coordinates" << point;
+    /* Tuples of "lon,lat[,altitude]" separated by whitespace: the fields
+     * are parsed where they lie in the text, in a single pass */
+    QString text = xml.readElementText();
+    const QChar *data = text.unicode();
+    int length = text.length();
+    int i = 0;
+    while (true) {
+        while (i < length && data[i].isSpace()) i++;
+        if (i >= length) break;
+
+        int tupleStart = i;
+        int fieldStart = i;
+        int fieldCount = 0;
+        QStringRef fields[3];
+        for (; i < length && !data[i].isSpace(); i++) {
+            if (data[i] != QLatin1Char(',')) continue;
+            if (fieldCount < 3) {
+                fields[fieldCount++] =
+                    QStringRef(&text, fieldStart, i - fieldStart);
+            }
+            fieldStart = i + 1;
+        }
+        if (fieldCount < 3) {
+            fields[fieldCount++] = QStringRef(&text, fieldStart,
+                                              i - fieldStart);
+        }
+
+        if (fieldCount < 2) {
+            DEBUG() << "Incomplete coordinates" <<
+                QStringRef(&text, tupleStart, i - tupleStart);
             continue;
         }
 
-        PathPoint p(GeoPoint(coords[1].toDouble(),
-                             coords[0].toDouble()));
-        if (coords.count() > 2) {
-            p.altitude = coords[2].toInt();
+        PathPoint p(GeoPoint(parseDouble(fields[1]), parseDouble(fields[0])));
+        p.distance = -1;
+        if (fieldCount > 2) {
+            p.altitude = qint16(parseDouble(fields[2]));
         }
 
         points.append(p);
@@ -146,7 +199,7 @@ bool Kml::read(QXmlStreamReader &xml, PathData &pathData)
                 waypoints.append(KmlWayPoint(points[0], desc));
             } else {
                 foreach (const PathPoint &p, points) {
-                    pathData.addPoint(p);
+                    pathData.appendPoint(p);
                 }
             }
         } else {
@@ -93,3 +93,12 @@ void PathBuilder::addPoint(const QVariantMap &pointData)
         Q_EMIT pathChanged();
     }
 }
+
+void PathBuilder::addPoints(const QVariantList &points)
+{
+    Q_D(PathBuilder);
+
+    if (d->path.addPoints(points) > 0) {
+        Q_EMIT pathChanged();
+    }
+}
@@ -47,6 +47,8 @@ public:
 
     Q_INVOKABLE void clear();
     Q_INVOKABLE void addPoint(const QVariantMap &pointData);
+    /* Faster than calling addPoint() for each point */
+    Q_INVOKABLE void addPoints(const QVariantList &points);
 
 Q_SIGNALS:
     void pathChanged();
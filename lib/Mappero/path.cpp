@@ -18,22 +18,28 @@
  * along with Mappero.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include "binary-track.h"
 #include "debug.h"
 #include "gpx.h"
 #include "kml.h"
 #include "path.h"
 #include "projection.h"
 
+#include <QAtomicPointer>
 #include <QDateTime>
 #include <QFile>
 #include <QIODevice>
 #include <QStringList>
 #include <QXmlStreamReader>
 #include <QXmlStreamWriter>
+#include <algorithm>
 
 using namespace Mappero;
 
-static const Projection *global_projection = 0;
+/* Tracks can be loaded in several threads at once (see TrackImporter): the
+ * projection is set up atomically on first use, and must not be changed
+ * while they run */
+static QAtomicPointer<const Projection> global_projection;
 static const QString keyLat = QStringLiteral(PATH_POINT_KEY_LATITUDE);
 static const QString keyLon = QStringLiteral(PATH_POINT_KEY_LONGITUDE);
 static const QString keyAltitude = QStringLiteral(PATH_POINT_KEY_ALTITUDE);
@@ -41,11 +47,15 @@ static const QString keyDistance = QStringLiteral(PATH_POINT_KEY_DISTANCE);
 static const QString keyTime = QStringLiteral(PATH_POINT_KEY_TIME);
 static const QString keyText = QStringLiteral(PATH_POINT_KEY_TEXT);
 
-static inline void ensure_projection()
+static inline const Projection *ensure_projection()
 {
-    if (global_projection == 0) {
-        global_projection = Projection::get(Projection::GOOGLE);
+    const Projection *projection = global_projection.loadAcquire();
+    if (projection == 0) {
+        const Projection *google = Projection::get(Projection::GOOGLE);
+        global_projection.testAndSetOrdered(0, google);
+        projection = global_projection.loadAcquire();
     }
+    return projection;
 }
 
 inline GeoPoint operator-(const GeoPoint &p1, const GeoPoint &p2)
@@ -97,8 +107,7 @@ PathPoint::PathPoint(const GeoPoint &p, int altitude):
     altitude(altitude),
     distance(0.0)
 {
-    ensure_projection();
-    unit = global_projection->geoToUnit(p);
+    unit = ensure_projection()->geoToUnit(p);
 }
 
 PathWayPoint::PathWayPoint():
@@ -131,6 +140,23 @@ bool Path::load(const QString &fileName)
 
 bool Path::load(QIODevice *device)
 {
+    if (BinaryTrack::isBinaryTrack(device->peek(16))) {
+        const Projection *projection = ensure_projection();
+        /* Files are read in place, without copying them */
+        QFile *file = qobject_cast<QFile*>(device);
+        qint64 size = file ? file->size() - file->pos() : 0;
+        uchar *data = size > 0 ? file->map(file->pos(), size) : 0;
+        if (data) {
+            bool ok = BinaryTrack::read(data, size, projection, *d);
+            file->unmap(data);
+            return ok;
+        }
+        QByteArray contents = device->readAll();
+        return BinaryTrack::read(
+            reinterpret_cast<const uchar *>(contents.constData()),
+            contents.size(), projection, *d);
+    }
+
     QXmlStreamReader xml(device);
 
     while (xml.readNextStartElement()) {
@@ -150,6 +176,9 @@ bool Path::save(const QString &fileName) const
     QFile file(fileName);
     if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate))
         return false;
+    if (BinaryTrack::hasSuffix(fileName)) {
+        return BinaryTrack::write(&file, ensure_projection(), *d);
+    }
     return save(&file);
 }
 
@@ -202,6 +231,11 @@ PathPoint Path::positionAt(time_t time) const
     return d->positionAt(time);
 }
 
+QVector<PathPoint> Path::positionsAt(const QVector<time_t> &times) const
+{
+    return d->positionsAt(times);
+}
+
 QRectF Path::boundingRect() const
 {
     return d->boundingRect();
@@ -238,14 +272,14 @@ void Path::addPoint(const GeoPoint &geo, int altitude, time_t time,
     d->addPoint(p);
 }
 
-bool Path::addPoint(const QVariantMap &pointData)
+static bool parsePointData(const QVariantMap &pointData, PathPoint &point,
+                           QVariantMap &wayPointData)
 {
-    QVariantMap wayPointData;
     bool hasLat = false;
     bool hasLon = false;
     qreal lat = 0.0, lon = 0.0;
     bool hasDistance = false;
-    qreal distance;
+    qreal distance = 0.0;
     time_t time = 0;
     int altitude = 0;
 
@@ -278,7 +312,20 @@ bool Path::addPoint(const QVariantMap &pointData)
 
     if (!hasLat || !hasLon) return false;
 
-    addPoint(GeoPoint(lat, lon), altitude, time, hasDistance ? distance : -1);
+    point = PathPoint(GeoPoint(lat, lon));
+    point.altitude = altitude;
+    point.time = time;
+    point.distance = hasDistance ? distance : -1;
+    return true;
+}
+
+bool Path::addPoint(const QVariantMap &pointData)
+{
+    PathPoint point;
+    QVariantMap wayPointData;
+    if (!parsePointData(pointData, point, wayPointData)) return false;
+
+    d->addPoint(point);
     if (!wayPointData.isEmpty()) {
         d->makeWayPoint(wayPointData, d->points.count() - 1);
     }
@@ -286,6 +333,25 @@ bool Path::addPoint(const QVariantMap &pointData)
     return true;
 }
 
+int Path::addPoints(const QVariantList &points)
+{
+    int count = 0;
+    d->points.reserve(d->points.count() + points.count());
+    Q_FOREACH(const QVariant &pointData, points) {
+        PathPoint point;
+        QVariantMap wayPointData;
+        if (!parsePointData(pointData.toMap(), point, wayPointData)) continue;
+
+        d->appendPoint(point);
+        if (!wayPointData.isEmpty()) {
+            d->makeWayPoint(wayPointData, d->points.count() - 1);
+        }
+        count++;
+    }
+    d->completePoints();
+    return count;
+}
+
 void Path::appendBreak()
 {
     d->appendBreak();
@@ -328,9 +394,52 @@ QPainterPath Path::toPainterPath(int zoomLevel) const
     return pp;
 }
 
+QPainterPath Path::toPainterPath(int zoomLevel, const QRect &area) const
+{
+    QPainterPath pp;
+    const QVector<PathChunk> &chunks = d->chunks;
+    int count = chunks.count();
+    int c = 0;
+    while (c < count) {
+        if (!chunks[c].bounds.intersects(area)) {
+            c++;
+            continue;
+        }
+
+        /* Consecutive visible chunks are drawn as one */
+        int first = chunks[c].first;
+        while (c < count && chunks[c].bounds.intersects(area)) c++;
+        int last = c < count ? chunks[c].first : d->points.count();
+        d->appendToPainterPath(pp, zoomLevel, first, last);
+    }
+    return pp;
+}
+
+QVector<QPolygon> Path::toUnitPolylines() const
+{
+    QVector<QPolygon> polylines;
+    QList<PathSegment>::const_iterator curr, next;
+    for (curr = d->segments.constBegin();
+         curr != d->segments.constEnd();
+         curr++) {
+        next = curr + 1;
+        int lastIndex = (next == d->segments.constEnd()) ?
+            d->points.count() : next->startIndex;
+        if (curr->startIndex == lastIndex) continue;
+
+        QPolygon polyline;
+        polyline.reserve(lastIndex - curr->startIndex);
+        for (int i = curr->startIndex; i < lastIndex; i++) {
+            polyline.append(d->points.at(i).unit);
+        }
+        polylines.append(polyline);
+    }
+    return polylines;
+}
+
 void Path::setProjection(const Projection *projection)
 {
-    global_projection = projection;
+    global_projection.storeRelease(projection);
     // maybe TODO: keep track of the existing paths, and update all of them
 }
 
@@ -342,8 +451,61 @@ PathStream::~PathStream()
 {
 }
 
+/* Upper bound to the number of significant digits which can be converted
+ * exactly: below 2^53, every integer is representable in a double */
+static const int maxExactDigits = 15;
+
+static const double powersOfTen[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+};
+
+/* When there are at most 15 significant digits, which is always the case
+ * for coordinates and elevations, dividing them by a power of ten gives the
+ * correctly rounded result, same as QString::toDouble(); anything else is
+ * left to Qt. */
+double PathStream::parseDouble(const QStringRef &text)
+{
+    const QChar *p = text.unicode();
+    const QChar *end = p + text.size();
+    while (p < end && p->isSpace()) p++;
+    while (end > p && (end - 1)->isSpace()) end--;
+
+    bool negative = false;
+    if (p < end && (*p == QLatin1Char('-') || *p == QLatin1Char('+'))) {
+        negative = *p == QLatin1Char('-');
+        p++;
+    }
+
+    qint64 mantissa = 0;
+    int digits = 0;
+    int decimals = 0;
+    bool hasDigits = false;
+    bool hasDot = false;
+    for (; p < end; p++) {
+        ushort c = p->unicode();
+        if (c >= '0' && c <= '9') {
+            mantissa = mantissa * 10 + (c - '0');
+            if (mantissa != 0 && ++digits > maxExactDigits) {
+                return text.toDouble();
+            }
+            if (hasDot) decimals++;
+            hasDigits = true;
+        } else if (c == '.' && !hasDot) {
+            hasDot = true;
+        } else {
+            break;
+        }
+    }
+    if (p != end || !hasDigits || decimals > 22) return text.toDouble();
+
+    double value = mantissa / powersOfTen[decimals];
+    return negative ? -value : value;
+}
+
 PathData::PathData():
     pointsOptimized(0),
+    lodStart(0),
     latMin(100), latMax(-100),
     lonMin(200), lonMax(-200),
     m_length(0)
@@ -354,38 +516,78 @@ PathData::PathData():
 bool PathData::load(QXmlStreamReader &xml, PathStream *stream)
 {
     if (!stream->read(xml, *this)) return false;
-    optimize();
+    completePoints();
     return true;
 }
 
 void PathData::addPoint(const PathPoint &p)
 {
-    int distance = p.distance;
-    if (distance < 0 && !points.isEmpty()) {
-        distance = p.geo.distanceTo(points.last().geo);
-    }
-    points.append(p);
+    appendPoint(p);
+    completePoints();
+}
+
+void PathData::completePoints()
+{
+    int count = points.count();
+    PathPoint *p = points.data();
+    /* The first segment which might start among the new points: nothing
+     * joins a segment to the previous one, so there's no distance to
+     * measure there */
+    int segment = segments.count();
+    while (segment > 0 && segments[segment - 1].startIndex >= pointsOptimized)
+        segment--;
+    for (int i = pointsOptimized; i < count; i++) {
+        PathPoint &point = p[i];
+        bool segmentStart = i == 0;
+        while (segment < segments.count() &&
+               segments[segment].startIndex <= i) {
+            segmentStart = true;
+            segment++;
+        }
+        int distance = point.distance;
+        if (distance < 0) {
+            distance = segmentStart ? 0 : point.geo.distanceTo(p[i - 1].geo);
+        }
+        if (distance >= 0) {
+            point.distance = distance;
+            m_length += distance;
+        }
 
-    if (distance >= 0) {
-        PathPoint &addedPoint = points.last();
-        addedPoint.distance = distance;
-        m_length += distance;
+        latMin = qMin(latMin, point.geo.lat);
+        latMax = qMax(latMax, point.geo.lat);
+        lonMin = qMin(lonMin, point.geo.lon);
+        lonMax = qMax(lonMax, point.geo.lon);
     }
 
-    /* update bounding rect */
-    if (p.geo.lat < latMin) {
-        latMin = p.geo.lat;
-    } else if (p.geo.lat > latMax) {
-        latMax = p.geo.lat;
-    }
+    updateChunks();
+    optimize();
+}
 
-    if (p.geo.lon < lonMin) {
-        lonMin = p.geo.lon;
-    } else if (p.geo.lon > lonMax) {
-        lonMax = p.geo.lon;
-    }
+void PathData::updateChunks()
+{
+    /* Small enough to skip most of what's off screen, big enough that there
+     * are not too many of them */
+    int chunkSize = 256;
 
-    optimize();
+    int count = points.count();
+    int i = chunks.isEmpty() ? 0 : chunks.last().first + chunks.last().count;
+    for (; i < count; i++) {
+        const Point &unit = points[i].unit;
+        if (chunks.isEmpty() || chunks.last().count == chunkSize) {
+            PathChunk chunk(i);
+            const Point &start = i > 0 ? points[i - 1].unit : unit;
+            chunk.bounds.setCoords(start.x(), start.y(), start.x(), start.y());
+            chunks.append(chunk);
+        }
+
+        PathChunk &chunk = chunks.last();
+        QRect &bounds = chunk.bounds;
+        if (unit.x() < bounds.left()) bounds.setLeft(unit.x());
+        else if (unit.x() > bounds.right()) bounds.setRight(unit.x());
+        if (unit.y() < bounds.top()) bounds.setTop(unit.y());
+        else if (unit.y() > bounds.bottom()) bounds.setBottom(unit.y());
+        chunk.count++;
+    }
 }
 
 void PathData::makeWayPoint(const QString &desc, int pointIndex)
@@ -413,20 +615,17 @@ bool PathData::appendBreak()
     return true;
 }
 
-PathPoint PathData::positionAt(time_t time) const
+static bool timeIsBefore(time_t time, const PathPoint &point)
 {
-    if (points.isEmpty() ||
-        time < points.first().time ||
-        time > points.last().time) {
-        return PathPoint();
-    }
-
-    /* Find the two closest elements in the path. */
-    QVector<PathPoint>::const_iterator a, b;
-    for (b = points.begin(); b != points.end(); b++)
-        if (b->time > time) break;
+    return time < point.time;
+}
 
-    a = b - 1;
+/* "b" is the first point later than "time", and not the first point */
+static PathPoint interpolate(const QVector<PathPoint> &points,
+                             QVector<PathPoint>::const_iterator b,
+                             time_t time)
+{
+    QVector<PathPoint>::const_iterator a = b - 1;
     /* if an element was not found or if times are the same, then we can return
      * the last one */
     if (b == points.end() || a->time == b->time) return *a;
@@ -436,67 +635,203 @@ PathPoint PathData::positionAt(time_t time) const
     return *a + (*b - *a) * t;
 }
 
-QRectF PathData::boundingRect() const
+PathPoint PathData::positionAt(time_t time) const
 {
-    return QRectF(QPointF(latMin, lonMin), QPointF(latMax, lonMax));
+    if (points.isEmpty() ||
+        time < points.first().time ||
+        time > points.last().time) {
+        return PathPoint();
+    }
+
+    /* The points are ordered by time: find the two closest elements in the
+     * path with a binary search */
+    QVector<PathPoint>::const_iterator b =
+        std::upper_bound(points.begin(), points.end(), time, timeIsBefore);
+    return interpolate(points, b, time);
 }
 
-void PathData::optimize()
+QVector<PathPoint> PathData::positionsAt(const QVector<time_t> &times) const
 {
-    int tolerance = 8;
-
-    /* for every point, set the zoom level at which the point must be rendered
-     */
+    QVector<PathPoint> positions;
+    positions.reserve(times.count());
+    if (points.isEmpty()) {
+        positions.fill(PathPoint(), times.count());
+        return positions;
+    }
 
-    if (points.isEmpty()) return;
+    time_t firstTime = points.first().time;
+    time_t lastTime = points.last().time;
+    time_t previous = firstTime;
+    QVector<PathPoint>::const_iterator b = points.begin();
+    Q_FOREACH(time_t time, times) {
+        if (time < firstTime || time > lastTime) {
+            positions.append(PathPoint());
+            continue;
+        }
 
-    QVector<PathPoint>::iterator curr = points.begin() + pointsOptimized;
-    if (pointsOptimized == 0)
-    {
-        curr->zoom = SCHAR_MAX;
-        pointsOptimized = 1;
-        curr++;
+        if (Q_UNLIKELY(time < previous)) {
+            /* Not sorted: look it up from scratch */
+            b = std::upper_bound(points.begin(), points.end(), time,
+                                 timeIsBefore);
+        } else {
+            while (b != points.end() && b->time <= time) b++;
+        }
+        previous = time;
+        positions.append(interpolate(points, b, time));
     }
+    return positions;
+}
 
-    QVector<PathPoint>::iterator prev;
+QRectF PathData::boundingRect() const
+{
+    return QRectF(QPointF(latMin, lonMin), QPointF(latMax, lonMax));
+}
 
-    for (; curr != points.end(); curr++)
-    {
-        int dx, dy, dmax, zoom;
+void PathData::markOptimized()
+{
+    pointsOptimized = points.count();
+    lodStart = qMax(pointsOptimized - 1, 0);
+    updateChunks();
+}
 
-        prev = curr - 1;
+void PathData::appendToPainterPath(QPainterPath &pp, int zoomLevel,
+                                   int first, int last) const
+{
+    int segment = 0;
+    while (segment + 1 < segments.count() &&
+           segments[segment + 1].startIndex <= first) {
+        segment++;
+    }
 
-        dx = curr->unit.x() - prev->unit.x();
-        dy = curr->unit.y() - prev->unit.y();
-        dmax = qMax(qAbs(dx), qAbs(dy));
+    /* The lines crossing the ends of the range must be complete: start from
+     * the last point drawn before it, and end at the first one after it */
+    int start = first;
+    while (start > segments[segment].startIndex &&
+           points[start].zoom <= zoomLevel) {
+        start--;
+    }
+
+    int nextSegment = segment + 1 < segments.count() ?
+        segments[segment + 1].startIndex : INT_MAX;
+    pp.moveTo(points[start].unit.toPixel(zoomLevel));
+    for (int i = start + 1; i < points.count(); i++) {
+        const PathPoint &point = points[i];
+        if (i == nextSegment) {
+            if (i >= last) break;
+            pp.moveTo(point.unit.toPixel(zoomLevel));
+            segment++;
+            nextSegment = segment + 1 < segments.count() ?
+                segments[segment + 1].startIndex : INT_MAX;
+            continue;
+        }
+        if (point.zoom <= zoomLevel) continue;
 
-        for (zoom = 0; dmax > tolerance << zoom; zoom++) {}
+        pp.lineTo(point.unit.toPixel(zoomLevel));
+        if (i >= last - 1) break;
+    }
+}
 
-        /* We got the zoom level for this point, supposing that the previous
-         * one is always drawn.
-         * But we need go back in the path to find the last point which is
-         * _surely_ drawn when this point is; that is, we look for the last
-         * point having a zoom value bigger than that of the current point. */
+/* Douglas-Peucker simplification of the points from first to last: each
+ * point gets the zoom level from which it can be dropped, keeping the
+ * simplified line within the tolerance (in pixels) of the original one.
+ * The zoom of a point is never higher than that of the point which split
+ * its range, so that at every zoom level the visible points are exactly
+ * those that the algorithm would keep for that level's tolerance. */
+static void simplify(PathPoint *points, int first, int last, int tolerance)
+{
+    struct Range {
+        Range(int first = 0, int last = 0, int maxZoom = 0):
+            first(first), last(last), maxZoom(maxZoom) {}
+        int first;
+        int last;
+        int maxZoom;
+    };
+
+    points[first].zoom = SCHAR_MAX;
+    points[last].zoom = SCHAR_MAX;
+
+    /* Tracks can have millions of points: no recursion */
+    QVector<Range> stack;
+    stack.append(Range(first, last, SCHAR_MAX));
+    while (!stack.isEmpty()) {
+        Range range = stack.takeLast();
+        if (range.last - range.first < 2) continue;
+
+        const Point &a = points[range.first].unit;
+        const Point &b = points[range.last].unit;
+        double abx = double(b.x()) - a.x();
+        double aby = double(b.y()) - a.y();
+        double ab2 = abx * abx + aby * aby;
+
+        /* Squared distance from the segment ab */
+        double maxDistance = -1;
+        int farthest = range.first + 1;
+        for (int i = range.first + 1; i < range.last; i++) {
+            const Point &p = points[i].unit;
+            double apx = double(p.x()) - a.x();
+            double apy = double(p.y()) - a.y();
+            double t = ab2 > 0 ? qBound(0.0, (apx * abx + apy * aby) / ab2,
+                                        1.0) : 0.0;
+            double dx = apx - t * abx;
+            double dy = apy - t * aby;
+            double distance = dx * dx + dy * dy;
+            if (distance > maxDistance) {
+                maxDistance = distance;
+                farthest = i;
+            }
+        }
 
-        while (zoom >= prev->zoom)
-        {
-            QVector<PathPoint>::iterator prevBefore;
-            /* going back is safe (we don't risk going past the head) because
-             * the first point will always have zoom set to 127 */
-            for (prevBefore = prev; prev->zoom <= zoom; prev--) {}
+        /* At zoom level z a pixel is 2^z units */
+        int zoom = 0;
+        double limit = tolerance;
+        while (zoom < range.maxZoom && maxDistance > limit * limit) {
+            zoom++;
+            limit *= 2;
+        }
+        /* Children are capped by this zoom: when it's 0, all of them get it.
+         * Don't split any further, or runs of identical or collinear points
+         * (where the farthest one is always the first) would take O(n²) */
+        if (zoom == 0) {
+            for (int i = range.first + 1; i < range.last; i++) {
+                points[i].zoom = 0;
+            }
+            continue;
+        }
+        points[farthest].zoom = zoom;
 
-            if (prev == prevBefore) break;
+        stack.append(Range(range.first, farthest, zoom));
+        stack.append(Range(farthest, range.last, zoom));
+    }
+}
 
-            /* now, find the distance between these two points */
-            dx = curr->unit.x() - prev->unit.x();
-            dy = curr->unit.y() - prev->unit.y();
-            dmax = qMax(qAbs(dx), qAbs(dy));
+void PathData::optimize()
+{
+    /* Maximum error of the simplified path, in pixels */
+    int tolerance = 2;
+    /* Points still being refined: beyond these, they are frozen. Every
+     * point added by the tracker simplifies them all again, so this bounds
+     * the work done for each GPS fix. */
+    int maxOpenPoints = 1024;
 
-            for (; dmax > tolerance << zoom; zoom++) {}
-        }
+    if (points.isEmpty()) return;
 
-        curr->zoom = zoom;
+    /* The simplification is global, so the points which have just been
+     * added are simplified together with the previous ones, back to the
+     * last frozen point; each segment is simplified on its own. */
+    int count = points.count();
+    PathPoint *p = points.data();
+    int first = lodStart;
+    Q_FOREACH(const PathSegment &segment, segments) {
+        if (segment.startIndex <= first) continue;
+        if (segment.startIndex >= count) break;
+        simplify(p, first, segment.startIndex - 1, tolerance);
+        first = segment.startIndex;
     }
+    simplify(p, first, count - 1, tolerance);
 
-    pointsOptimized = points.count();
+    if (count - first > maxOpenPoints) {
+        first = count - 1;
+    }
+    lodStart = first;
+    pointsOptimized = count;
 }
@@ -25,6 +25,7 @@
 #include "types.h"
 
 #include <QPainterPath>
+#include <QPolygon>
 #include <QSharedDataPointer>
 #include <QVector>
 
@@ -89,21 +90,39 @@ struct PathSegment
     int startIndex;
 };
 
+/* A run of consecutive points, with the bounding box (in map units) of the
+ * lines joining them, including the one coming from the previous point */
+struct PathChunk
+{
+    PathChunk(int first = 0): first(first), count(0) {}
+    int first;
+    int count;
+    QRect bounds;
+};
+
+class BinaryTrack;
 class Kml;
 class PathTest;
 class PathStream;
 
-class PathData: public QSharedData
+class MAPPERO_EXPORT PathData: public QSharedData
 {
 public:
     PathData();
     ~PathData() {}
 
     void addPoint(const PathPoint &point);
+    /* For building paths out of many points: appended points only get
+     * their distance (if negative), the bounding rectangle and the zoom
+     * level updated on the next call to completePoints(), all at once. */
+    void appendPoint(const PathPoint &point) { points.append(point); }
+    void completePoints();
     void makeWayPoint(const QString &desc, int pointIndex);
     void makeWayPoint(const QVariantMap &data, int pointIndex);
     bool appendBreak();
     PathPoint positionAt(time_t time) const;
+    /* The times should be sorted, for the lookup to be done in one pass */
+    QVector<PathPoint> positionsAt(const QVector<time_t> &times) const;
     QRectF boundingRect() const;
     Geo length() const { return m_length; }
 
@@ -111,17 +130,26 @@ public:
     QString source() const { return m_source; }
 
 private:
+    friend class BinaryTrack;
     friend class Path;
     bool load(QXmlStreamReader &xml, PathStream *stream);
 
     void optimize();
+    /* When the zoom levels of all points are already known */
+    void markOptimized();
+    void updateChunks();
+    void appendToPainterPath(QPainterPath &pp, int zoomLevel,
+                             int first, int last) const;
 
 public:
     QVector<PathPoint> points;
     QVector<PathWayPoint> wayPoints;
     QList<PathSegment> segments;
+    QVector<PathChunk> chunks;
     QString m_source;
     int pointsOptimized;
+    /* Start of the points whose zoom levels are still being refined */
+    int lodStart;
     Geo latMin, latMax, lonMin, lonMax;
     Geo m_length;
 };
@@ -148,6 +176,7 @@ public:
     QVariantMap wayPointData(int index) const;
 
     PathPoint positionAt(time_t time) const;
+    QVector<PathPoint> positionsAt(const QVector<time_t> &times) const;
     QRectF boundingRect() const;
     Geo length() const;
     int totalTime() const;
@@ -157,13 +186,22 @@ public:
     void addPoint(const GeoPoint &geo, int altitude, time_t time = 0,
                   Geo distance = 0);
     bool addPoint(const QVariantMap &pointData);
+    /* Much faster than adding the points one by one; returns the number of
+     * valid points */
+    int addPoints(const QVariantList &points);
     void appendBreak();
 
     void setSource(const QString &source);
     QString source() const;
 
     QPainterPath toPainterPath(int zoomLevel) const;
+    /* Only the parts of the path crossing the given area, in map units */
+    QPainterPath toPainterPath(int zoomLevel, const QRect &area) const;
+    /* One polyline per segment, with all the points, in map units */
+    QVector<QPolygon> toUnitPolylines() const;
 
+    /* Must not be called while paths are being built or loaded in other
+     * threads, such as during a TrackImporter import */
     static void setProjection(const Projection *projection);
 
 private:
@@ -181,6 +219,10 @@ public:
 
     virtual bool read(QXmlStreamReader &xml, PathData &pathData) = 0;
     virtual bool write(QXmlStreamWriter &xml, const PathData &pathData) = 0;
+
+protected:
+    /* Parses a decimal number without allocating memory */
+    static double parseDouble(const QStringRef &text);
 };
 
 }; // namespace
@@ -0,0 +1,251 @@
+/* vi: set et sw=4 ts=4 cino=t0,(0: */
+/*
+ * Copyright (C) 2020 Alberto Mardegan <mardy@users.sourceforge.net>
+ *
+ * This file is part of Mappero.
+ *
+ * Mappero is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Mappero is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Mappero.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "debug.h"
+#include "track-index.h"
+
+#include <QMap>
+#include <QPair>
+#include <QVector>
+#include <algorithm>
+
+using namespace Mappero;
+
+namespace Mappero {
+
+/* A time range, ends included, covered by one path; or a gap between two
+ * paths, if "path" is negative. */
+struct TimeInterval {
+    TimeInterval(time_t start = 0, time_t end = 0, int path = -1):
+        start(start), end(end), path(path) {}
+    time_t start;
+    time_t end;
+    int path;
+    /* For gaps: the positions right before and after them */
+    PathPoint before;
+    PathPoint after;
+};
+
+class TrackIndexPrivate
+{
+    Q_DECLARE_PUBLIC(TrackIndex)
+
+    inline TrackIndexPrivate(TrackIndex *q);
+    ~TrackIndexPrivate() {};
+
+    /* Adding several paths in a row costs a single rebuild, done when the
+     * index is first used */
+    void invalidate() { intervalsValid = false; }
+    void ensureIntervals() const;
+    void bridgeGaps() const;
+
+private:
+    mutable TrackIndex *q_ptr;
+    int maxGap;
+    QVector<Path> paths;
+    mutable bool intervalsValid;
+    /* Sorted by time, not overlapping */
+    mutable QVector<TimeInterval> intervals;
+};
+
+} // namespace
+
+static bool startsAfter(time_t time, const TimeInterval &interval)
+{
+    return time < interval.start;
+}
+
+TrackIndexPrivate::TrackIndexPrivate(TrackIndex *q):
+    q_ptr(q),
+    maxGap(10 * 60),
+    intervalsValid(true)
+{
+}
+
+void TrackIndexPrivate::ensureIntervals() const
+{
+    if (intervalsValid) return;
+    intervalsValid = true;
+
+    intervals.clear();
+
+    typedef QPair<time_t,int> TimeAndPath;
+    QVector<TimeAndPath> starts, ends;
+    QVector<time_t> boundaries;
+    for (int i = 0; i < paths.count(); i++) {
+        time_t start = paths[i].firstPoint().time;
+        /* As if the path ended one second later, so that its last second
+         * makes a non empty interval */
+        time_t end = paths[i].lastPoint().time + 1;
+        starts.append(qMakePair(start, i));
+        ends.append(qMakePair(end, i));
+        boundaries << start << end;
+    }
+    std::sort(starts.begin(), starts.end());
+    std::sort(ends.begin(), ends.end());
+    std::sort(boundaries.begin(), boundaries.end());
+    boundaries.erase(std::unique(boundaries.begin(), boundaries.end()),
+                     boundaries.end());
+
+    /* Sweep the boundaries, keeping the paths covering each elementary
+     * interval sorted by their start time: the last one wins */
+    QMap<TimeAndPath,int> active;
+    int s = 0, e = 0;
+    for (int b = 0; b + 1 < boundaries.count(); b++) {
+        time_t time = boundaries[b];
+        for (; e < ends.count() && ends[e].first == time; e++) {
+            int path = ends[e].second;
+            active.remove(qMakePair(paths[path].firstPoint().time, path));
+        }
+        for (; s < starts.count() && starts[s].first == time; s++) {
+            active.insert(starts[s], starts[s].second);
+        }
+        if (active.isEmpty()) continue;
+
+        int path = active.last();
+        time_t end = boundaries[b + 1] - 1;
+        if (!intervals.isEmpty() && intervals.last().path == path &&
+            intervals.last().end + 1 == time) {
+            intervals.last().end = end;
+        } else {
+            intervals.append(TimeInterval(time, end, path));
+        }
+    }
+
+    bridgeGaps();
+}
+
+void TrackIndexPrivate::bridgeGaps() const
+{
+    QVector<TimeInterval> bridged;
+    bridged.reserve(intervals.count() * 2);
+    for (int i = 0; i < intervals.count(); i++) {
+        if (i > 0) {
+            const TimeInterval &prev = intervals[i - 1];
+            const TimeInterval &next = intervals[i];
+            if (next.start > prev.end + 1 &&
+                next.start - prev.end <= maxGap) {
+                TimeInterval gap(prev.end + 1, next.start - 1);
+                gap.before = paths[prev.path].positionAt(prev.end);
+                gap.after = paths[next.path].positionAt(next.start);
+                bridged.append(gap);
+            }
+        }
+        bridged.append(intervals[i]);
+    }
+    intervals = bridged;
+}
+
+TrackIndex::TrackIndex():
+    d_ptr(new TrackIndexPrivate(this))
+{
+}
+
+TrackIndex::~TrackIndex()
+{
+    delete d_ptr;
+}
+
+void TrackIndex::setMaxGap(int seconds)
+{
+    Q_D(TrackIndex);
+    if (seconds == d->maxGap) return;
+    d->maxGap = seconds;
+    d->invalidate();
+}
+
+int TrackIndex::maxGap() const
+{
+    Q_D(const TrackIndex);
+    return d->maxGap;
+}
+
+bool TrackIndex::addPath(const Path &path)
+{
+    Q_D(TrackIndex);
+
+    if (path.isEmpty() ||
+        path.firstPoint().time == 0 || path.lastPoint().time == 0) {
+        DEBUG() << "Ignoring path without times" << path.source();
+        return false;
+    }
+
+    d->paths.append(path);
+    d->invalidate();
+    return true;
+}
+
+void TrackIndex::clear()
+{
+    Q_D(TrackIndex);
+    d->paths.clear();
+    d->intervals.clear();
+    d->intervalsValid = true;
+}
+
+int TrackIndex::pathCount() const
+{
+    Q_D(const TrackIndex);
+    return d->paths.count();
+}
+
+bool TrackIndex::isEmpty() const
+{
+    Q_D(const TrackIndex);
+    d->ensureIntervals();
+    return d->intervals.isEmpty();
+}
+
+time_t TrackIndex::startTime() const
+{
+    Q_D(const TrackIndex);
+    d->ensureIntervals();
+    return d->intervals.isEmpty() ? 0 : d->intervals.first().start;
+}
+
+time_t TrackIndex::endTime() const
+{
+    Q_D(const TrackIndex);
+    d->ensureIntervals();
+    return d->intervals.isEmpty() ? 0 : d->intervals.last().end;
+}
+
+PathPoint TrackIndex::positionAt(time_t time) const
+{
+    Q_D(const TrackIndex);
+
+    d->ensureIntervals();
+    QVector<TimeInterval>::const_iterator i =
+        std::upper_bound(d->intervals.begin(), d->intervals.end(), time,
+                         startsAfter);
+    if (i == d->intervals.begin()) return PathPoint();
+    i--;
+    if (time > i->end) return PathPoint();
+
+    if (i->path >= 0) return d->paths[i->path].positionAt(time);
+
+    /* Interpolate over the gap, whose ends are one second outside it */
+    double t = (double(time) - (i->start - 1)) / (i->end - i->start + 2);
+    const PathPoint &a = i->before;
+    const PathPoint &b = i->after;
+    GeoPoint geo(a.geo.lat + (b.geo.lat - a.geo.lat) * t,
+                 a.geo.lon + (b.geo.lon - a.geo.lon) * t);
+    return PathPoint(geo, int(a.altitude + (b.altitude - a.altitude) * t));
+}
@@ -0,0 +1,63 @@
+/* vi: set et sw=4 ts=4 cino=t0,(0: */
+/*
+ * Copyright (C) 2020 Alberto Mardegan <mardy@users.sourceforge.net>
+ *
+ * This file is part of Mappero.
+ *
+ * Mappero is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Mappero is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Mappero.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef MAPPERO_TRACK_INDEX_H
+#define MAPPERO_TRACK_INDEX_H
+
+#include "path.h"
+
+namespace Mappero {
+
+/* Finds positions by time across many tracks: their time ranges are split
+ * into disjoint intervals, each one covered by a single track, so that a
+ * lookup is a binary search over the intervals followed by one in the
+ * track. Where tracks overlap, the one which started last is used; gaps
+ * between tracks up to maxGap() seconds long are interpolated. */
+class TrackIndexPrivate;
+class MAPPERO_EXPORT TrackIndex
+{
+public:
+    TrackIndex();
+    ~TrackIndex();
+
+    void setMaxGap(int seconds);
+    int maxGap() const;
+
+    /* Paths without time information are ignored; returns whether the path
+     * was added. */
+    bool addPath(const Path &path);
+    void clear();
+
+    int pathCount() const;
+    bool isEmpty() const;
+    time_t startTime() const;
+    time_t endTime() const;
+
+    PathPoint positionAt(time_t time) const;
+
+private:
+    Q_DISABLE_COPY(TrackIndex)
+    TrackIndexPrivate *d_ptr;
+    Q_DECLARE_PRIVATE(TrackIndex)
+};
+
+} // namespace
+
+#endif // MAPPERO_TRACK_INDEX_H
@@ -36,6 +36,7 @@ RoutingModel {
                     builder.clear()
                     var steps = routes[i_route].legs[0].steps
                     var time = 0
+                    var pathPoints = []
                     for (var b in steps) {
                         var o = steps[b]
                         var p = {
@@ -53,7 +54,7 @@ RoutingModel {
                             case "turn-sharp-left": p["dir"] = "sharp-left"; break
                         }
 
-                        builder.addPoint(p)
+                        pathPoints.push(p)
 
                         time += o.duration.value
 
@@ -67,9 +68,10 @@ RoutingModel {
                             if (i == l - 1) {
                                 p["time"] = time
                             }
-                            builder.addPoint(p)
+                            pathPoints.push(p)
                         }
                     }
+                    builder.addPoints(pathPoints)
                     appendPath(builder.path)
                 }
                 root.running = false
@@ -242,6 +242,7 @@ RoutingModel {
                 for (var i_route in routes) {
                     builder.clear()
                     var route = routes[i_route][0]
+                    var pathPoints = []
                     for (var leg_i in route.legs) {
                         var leg = route.legs[leg_i]
                         for (var point_i in leg.locs) {
@@ -256,9 +257,10 @@ RoutingModel {
                                 parseType(leg.type, leg.code, p)
                                 p["length"] = leg.length
                             }
-                            builder.addPoint(p)
+                            pathPoints.push(p)
                         }
                     }
+                    builder.addPoints(pathPoints)
                     appendPath(builder.path)
                 }
                 root.running = false
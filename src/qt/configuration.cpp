@@ -24,17 +24,28 @@
 #include "configuration.h"
 #include "debug.h"
 
+#include <QDataStream>
 #include <QFileInfo>
 #include <QStandardPaths>
+#include <algorithm>
 
 using namespace Mappero;
 
+static const QLatin1String keyDemDirectory("DemDirectory");
 static const QLatin1String keyGpsInterval("GpsInterval");
 static const QLatin1String keyLastMainLayer("LastMainLayer");
+static const QLatin1String keyLastOverlay("LastOverlay");
 static const QLatin1String keyLastPosition("LastPosition");
 static const QLatin1String keyLastZoomLevel("LastZoomLevel");
+static const QLatin1String keyMainLayerTileFiles("MainLayerTileFiles");
 static const QLatin1String keyMapCacheDir("MapCacheDir");
 static const QLatin1String keyPreferredSearchPlugin("PreferredSearchPlugin");
+static const QLatin1String keyTileMemoryMode("TileMemoryMode");
+static const QLatin1String keyDataSaver("DataSaver");
+static const QLatin1String keyViewedAreas("ViewedAreas");
+
+/* Enough to cover a few home towns and holiday spots */
+static const int maxViewedAreas = 64;
 
 namespace Mappero {
 class ConfigurationPrivate
@@ -42,7 +53,8 @@ class ConfigurationPrivate
     Q_DECLARE_PUBLIC(Configuration)
 
     ConfigurationPrivate(Configuration *configuration):
-        q_ptr(configuration)
+        q_ptr(configuration),
+        viewedAreasLoaded(false)
     {
     }
 
@@ -50,11 +62,54 @@ class ConfigurationPrivate
     {
     }
 
+    void loadViewedAreas() const;
+    void saveViewedAreas();
+
 private:
     mutable Configuration *q_ptr;
+    mutable bool viewedAreasLoaded;
+    mutable QList<ViewedArea> viewedAreas;
 };
 };
 
+static bool viewedMoreOften(const ViewedArea &a1, const ViewedArea &a2)
+{
+    return a1.count > a2.count;
+}
+
+void ConfigurationPrivate::loadViewedAreas() const
+{
+    Q_Q(const Configuration);
+
+    if (viewedAreasLoaded) return;
+    viewedAreasLoaded = true;
+
+    /* Stored as a binary blob: zoom, x, y, count */
+    QByteArray data = q->value(keyViewedAreas).toByteArray();
+    QDataStream stream(data);
+    while (!stream.atEnd()) {
+        qint8 zoom;
+        qint32 x, y;
+        quint16 count;
+        stream >> zoom >> x >> y >> count;
+        if (stream.status() != QDataStream::Ok) break;
+        viewedAreas.append(ViewedArea(zoom, QPoint(x, y), count));
+    }
+}
+
+void ConfigurationPrivate::saveViewedAreas()
+{
+    Q_Q(Configuration);
+
+    QByteArray data;
+    QDataStream stream(&data, QIODevice::WriteOnly);
+    Q_FOREACH(const ViewedArea &area, viewedAreas) {
+        stream << qint8(area.zoom) << qint32(area.tile.x()) <<
+            qint32(area.tile.y()) << quint16(area.count);
+    }
+    q->setValue(keyViewedAreas, data);
+}
+
 Configuration::Configuration(QObject *parent):
     QSettings(parent),
     d_ptr(new ConfigurationPrivate(this))
@@ -115,6 +170,16 @@ QString Configuration::lastMainLayer() const
     return value(keyLastMainLayer, "OpenStreetMap").toString();
 }
 
+void Configuration::setMainLayerTileFiles(const QString &fileTemplate)
+{
+    setValue(keyMainLayerTileFiles, fileTemplate);
+}
+
+QString Configuration::mainLayerTileFiles() const
+{
+    return value(keyMainLayerTileFiles).toString();
+}
+
 void Configuration::setGpsInterval(int interval)
 {
     setValue(keyGpsInterval, interval);
@@ -136,3 +201,98 @@ QString Configuration::preferredSearchPlugin() const
 {
     return value(keyPreferredSearchPlugin, "nominatim").toString();
 }
+
+void Configuration::setTileMemoryMode(const QString &mode)
+{
+    setValue(keyTileMemoryMode, mode);
+    Q_EMIT tileMemoryModeChanged();
+}
+
+QString Configuration::tileMemoryMode() const
+{
+    return value(keyTileMemoryMode, "full").toString();
+}
+
+void Configuration::setDataSaver(const QString &mode)
+{
+    setValue(keyDataSaver, mode);
+    Q_EMIT dataSaverChanged();
+}
+
+QString Configuration::dataSaver() const
+{
+    return value(keyDataSaver, "auto").toString();
+}
+
+void Configuration::setLastOverlay(const QString &layerName)
+{
+    setValue(keyLastOverlay, layerName);
+    Q_EMIT lastOverlayChanged();
+}
+
+QString Configuration::lastOverlay() const
+{
+    return value(keyLastOverlay).toString();
+}
+
+void Configuration::setDemDirectory(const QString &directory)
+{
+    setValue(keyDemDirectory, directory);
+    Q_EMIT demDirectoryChanged();
+}
+
+QString Configuration::demDirectory() const
+{
+    if (contains(keyDemDirectory))
+        return value(keyDemDirectory).toString();
+
+    return QStandardPaths::writableLocation(QStandardPaths::AppDataLocation) +
+        QLatin1String("/DEM/");
+}
+
+void Configuration::recordViewedArea(int zoom, const QPoint &tile)
+{
+    Q_D(Configuration);
+
+    d->loadViewedAreas();
+
+    bool found = false;
+    bool halve = false;
+    for (int i = 0; i < d->viewedAreas.count(); i++) {
+        ViewedArea &area = d->viewedAreas[i];
+        if (area.zoom == zoom && area.tile == tile) {
+            area.count++;
+            /* counts are stored in 16 bits */
+            halve = area.count >= 0xffff;
+            found = true;
+            break;
+        }
+    }
+
+    if (!found) {
+        /* Make room by forgetting the least viewed area */
+        if (d->viewedAreas.count() >= maxViewedAreas) {
+            std::sort(d->viewedAreas.begin(), d->viewedAreas.end(),
+                      viewedMoreOften);
+            d->viewedAreas.removeLast();
+        }
+        d->viewedAreas.append(ViewedArea(zoom, tile));
+    } else if (halve) {
+        /* This also lets old habits fade */
+        for (int i = 0; i < d->viewedAreas.count(); i++) {
+            d->viewedAreas[i].count /= 2;
+        }
+    }
+
+    d->saveViewedAreas();
+}
+
+QList<ViewedArea> Configuration::mostViewedAreas(int maxCount) const
+{
+    Q_D(const Configuration);
+
+    d->loadViewedAreas();
+    QList<ViewedArea> areas = d->viewedAreas;
+    std::stable_sort(areas.begin(), areas.end(), viewedMoreOften);
+    return areas.mid(0, maxCount);
+}
@@ -23,11 +23,23 @@
 
 #include <Mappero/types.h>
 
+#include <QList>
 #include <QObject>
+#include <QPoint>
 #include <QSettings>
 
 namespace Mappero {
 
+/* A tile at the center of the view, and how many times it's been there */
+struct ViewedArea {
+    ViewedArea(): zoom(0), count(0) {}
+    ViewedArea(int zoom, const QPoint &tile, int count = 1):
+        zoom(zoom), tile(tile), count(count) {}
+    int zoom;
+    QPoint tile;
+    int count;
+};
+
 class ConfigurationPrivate;
 class Configuration: public QSettings
 {
@@ -43,6 +55,14 @@ class Configuration: public QSettings
     Q_PROPERTY(QString preferredSearchPlugin READ preferredSearchPlugin
                WRITE setPreferredSearchPlugin
                NOTIFY preferredSearchPluginChanged)
+    Q_PROPERTY(QString tileMemoryMode READ tileMemoryMode
+               WRITE setTileMemoryMode NOTIFY tileMemoryModeChanged)
+    Q_PROPERTY(QString dataSaver READ dataSaver WRITE setDataSaver
+               NOTIFY dataSaverChanged)
+    Q_PROPERTY(QString lastOverlay READ lastOverlay
+               WRITE setLastOverlay NOTIFY lastOverlayChanged)
+    Q_PROPERTY(QString demDirectory READ demDirectory
+               WRITE setDemDirectory NOTIFY demDirectoryChanged)
 
 public:
     Configuration(QObject *parent = 0);
@@ -59,18 +79,50 @@ public:
     void setLastMainLayer(const QString &layerName);
     QString lastMainLayer() const;
 
+    /* The TiledLayer::tileFileTemplate() of the main layer, for finding its
+     * tiles before the layer is created */
+    void setMainLayerTileFiles(const QString &fileTemplate);
+    QString mainLayerTileFiles() const;
+
     void setGpsInterval(int interval);
     int gpsInterval() const;
 
     void setPreferredSearchPlugin(const QString &pluginName);
     QString preferredSearchPlugin() const;
 
+    /* One of "full" (the default), "rgb888" or "rgb565": how opaque tiles
+     * are kept in memory until they are uploaded */
+    void setTileMemoryMode(const QString &mode);
+    QString tileMemoryMode() const;
+
+    /* One of "auto" (the default), "on" or "off": whether coarser tiles
+     * should be downloaded first, and used instead of the exact ones */
+    void setDataSaver(const QString &mode);
+    QString dataSaver() const;
+
+    void setLastOverlay(const QString &layerName);
+    QString lastOverlay() const;
+
+    /* Where the SRTM elevation files (N45E011.hgt and the like) used for
+     * the hillshade and relief overlays are found */
+    void setDemDirectory(const QString &directory);
+    QString demDirectory() const;
+
+    /* A compact heat map of the areas the user looks at, used to warm up
+     * the tile cache at startup */
+    void recordViewedArea(int zoom, const QPoint &tile);
+    QList<ViewedArea> mostViewedAreas(int maxCount) const;
+
 Q_SIGNALS:
     void lastPositionChanged();
     void lastZoomLevelChanged();
     void lastMainLayerChanged();
     void gpsIntervalChanged();
     void preferredSearchPluginChanged();
+    void tileMemoryModeChanged();
+    void dataSaverChanged();
+    void lastOverlayChanged();
+    void demDirectoryChanged();
 
 private:
     ConfigurationPrivate *d_ptr;
@@ -26,6 +26,8 @@
 #include "debug.h"
 #include "tile-cache.h"
 #include "tile-download.h"
+#include "tiled-layer.h"
+#include "types.h"
 
 #include <Mappero/Projection>
 #include <QElapsedTimer>
@@ -111,11 +113,48 @@ TileDownload *Controller::tileDownload() const
 
     if (d->tileDownload == 0) {
         d->tileDownload = new TileDownload(const_cast<Controller *>(this));
+
+        Controller *self = const_cast<Controller *>(this);
+        self->applyTileMemoryMode();
+        QObject::connect(configuration(), SIGNAL(tileMemoryModeChanged()),
+                         self, SLOT(applyTileMemoryMode()));
+        self->applyDataSaver();
+        QObject::connect(configuration(), SIGNAL(dataSaverChanged()),
+                         self, SLOT(applyDataSaver()));
     }
 
     return d->tileDownload;
 }
 
+void Controller::applyTileMemoryMode()
+{
+    Q_D(Controller);
+
+    /* Tiles already in memory are left as they are */
+    QString mode = configuration()->tileMemoryMode();
+    if (mode == "rgb565") {
+        d->tileDownload->setOpaqueTileFormat(QImage::Format_RGB16);
+    } else if (mode == "rgb888") {
+        d->tileDownload->setOpaqueTileFormat(QImage::Format_RGB888);
+    } else {
+        d->tileDownload->setOpaqueTileFormat(QImage::Format_Invalid);
+    }
+}
+
+void Controller::applyDataSaver()
+{
+    Q_D(Controller);
+
+    QString mode = configuration()->dataSaver();
+    if (mode == "on") {
+        d->tileDownload->setDataSaver(TileDownload::DataSaverOn);
+    } else if (mode == "off") {
+        d->tileDownload->setDataSaver(TileDownload::DataSaverOff);
+    } else {
+        d->tileDownload->setDataSaver(TileDownload::DataSaverAuto);
+    }
+}
+
 TileCache *Controller::tileCache() const
 {
     Q_D(const Controller);
@@ -127,6 +166,45 @@ TileCache *Controller::tileCache() const
     return d->tileCache;
 }
 
+static void addTilesAround(QList<TileSpec> &tiles, const QString &layerId,
+                           int zoom, const QPoint &center, int radius)
+{
+    for (int x = center.x() - radius; x <= center.x() + radius; x++) {
+        for (int y = center.y() - radius; y <= center.y() + radius; y++) {
+            TileSpec spec(x, y, zoom, layerId);
+            if (x >= 0 && y >= 0 && !tiles.contains(spec)) tiles.append(spec);
+        }
+    }
+}
+
+void Controller::warmUpTileCache()
+{
+    Configuration *conf = configuration();
+    QString layerId = conf->lastMainLayer();
+    QString fileTemplate = conf->mainLayerTileFiles();
+    if (layerId.isEmpty() || fileTemplate.isEmpty()) return;
+
+    QList<TileSpec> tiles;
+
+    /* The view we'll start with; the layer's projection is not known yet,
+     * but for most layers it's the default one */
+    int zoom = int(conf->lastZoomLevel());
+    Point center = projection()->geoToUnit(conf->lastPosition());
+    addTilesAround(tiles, layerId, zoom, center.toTile(zoom), 3);
+
+    Q_FOREACH(const ViewedArea &area, conf->mostViewedAreas(4)) {
+        addTilesAround(tiles, layerId, area.zoom, area.tile, 1);
+    }
+
+    QStringList fileNames;
+    QString baseDir = conf->mapCacheDir();
+    Q_FOREACH(const TileSpec &spec, tiles) {
+        fileNames.append(TiledLayer::tileFileName(baseDir, fileTemplate,
+                                                  spec.zoom, spec.x, spec.y));
+    }
+    tileDownload()->preloadTiles(fileNames);
+}
+
 Configuration *Controller::configuration() const
 {
     Q_D(const Controller);
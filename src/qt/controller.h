@@ -52,6 +52,11 @@ public:
     TileCache *tileCache() const;
     Configuration *configuration() const;
 
+    /* Starts reading, in the background, the cached tiles which will most
+     * likely be needed soon: those around the last position, and those of
+     * the most viewed areas. To be called at startup. */
+    void warmUpTileCache();
+
     static qint64 clock();
 
 public Q_SLOTS:
@@ -63,6 +68,10 @@ public Q_SLOTS:
     QString formatDuration(int ms);
     qreal uiScale() const;
 
+private Q_SLOTS:
+    void applyTileMemoryMode();
+    void applyDataSaver();
+
 private:
     ControllerPrivate *d_ptr;
     Q_DECLARE_PRIVATE(Controller)
@@ -0,0 +1,126 @@
+/* vi: set et sw=4 ts=4 cino=t0,(0: */
+/* -*- Mode: C; indent-tabs-mode: nil; c-basic-offset: 4; tab-width: 4 -*- */
+/*
+ * Copyright (C) 2020 Alberto Mardegan <mardy@users.sourceforge.net>
+ *
+ * This file is part of Mappero.
+ *
+ * Mappero is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Mappero is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Mappero.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "debug.h"
+#include "dem.h"
+
+#include <QDir>
+#include <QStringList>
+#include <math.h>
+
+using namespace Mappero;
+
+/* Each of them keeps a file descriptor open */
+static const int maxOpenFiles = 64;
+
+DemFile::DemFile(const QString &fileName, int south, int west):
+    m_file(fileName),
+    m_data(0),
+    m_size(0),
+    m_south(south),
+    m_west(west)
+{
+    if (!m_file.open(QIODevice::ReadOnly)) return;
+
+    /* Square grids of 16 bit samples: 1201 per side for 3 arc-second data,
+     * 3601 for 1 arc-second */
+    qint64 fileSize = m_file.size();
+    int size = int(sqrt(fileSize / 2.0) + 0.5);
+    if (size < 2 || qint64(size) * size * 2 != fileSize) {
+        qWarning() << "Not an elevation file:" << fileName;
+        return;
+    }
+
+    m_data = m_file.map(0, fileSize);
+    if (Q_UNLIKELY(!m_data)) {
+        qWarning() << "Could not map" << fileName;
+        return;
+    }
+    m_size = size;
+}
+
+DemFile::~DemFile()
+{
+    if (m_data) m_file.unmap(const_cast<uchar*>(m_data));
+}
+
+float DemFile::elevation(double lat, double lon) const
+{
+    /* The first row is the northern edge */
+    double fy = (m_south + 1 - lat) * (m_size - 1);
+    double fx = (lon - m_west) * (m_size - 1);
+    int row = qBound(0, int(fy), m_size - 2);
+    int column = qBound(0, int(fx), m_size - 2);
+    float ty = qBound(0.0, fy - row, 1.0);
+    float tx = qBound(0.0, fx - column, 1.0);
+
+    float top = sample(row, column) * (1 - tx) +
+        sample(row, column + 1) * tx;
+    float bottom = sample(row + 1, column) * (1 - tx) +
+        sample(row + 1, column + 1) * tx;
+    return top * (1 - ty) + bottom * ty;
+}
+
+DemStore::DemStore(const QString &directory):
+    m_directory(directory)
+{
+}
+
+DemStore::~DemStore()
+{
+}
+
+QSharedPointer<const DemFile> DemStore::file(int south, int west)
+{
+    qint32 key = ((south + 90) << 16) | (west + 180);
+
+    QMutexLocker locker(&m_mutex);
+    QHash<qint32,QSharedPointer<const DemFile> >::const_iterator i =
+        m_files.constFind(key);
+    if (i != m_files.constEnd()) {
+        m_recentlyUsed.removeOne(key);
+        m_recentlyUsed.append(key);
+        return i.value();
+    }
+
+    QString name = QString::asprintf("%c%02d%c%03d.hgt",
+                                     south < 0 ? 'S' : 'N', qAbs(south),
+                                     west < 0 ? 'W' : 'E', qAbs(west));
+    QDir dir(m_directory);
+    QSharedPointer<const DemFile> file;
+    /* Files are often distributed with lowercase names */
+    Q_FOREACH(const QString &candidate,
+              QStringList() << name << name.toLower()) {
+        if (!dir.exists(candidate)) continue;
+        QSharedPointer<DemFile> demFile(
+            new DemFile(dir.filePath(candidate), south, west));
+        if (demFile->isValid()) file = demFile;
+        break;
+    }
+
+    /* Files still in use by a renderer stay mapped until it's done */
+    if (m_recentlyUsed.count() >= maxOpenFiles) {
+        m_files.remove(m_recentlyUsed.takeFirst());
+    }
+    m_files.insert(key, file);
+    m_recentlyUsed.append(key);
+    return file;
+}
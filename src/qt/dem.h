@@ -0,0 +1,88 @@
+/* vi: set et sw=4 ts=4 cino=t0,(0: */
+/* -*- Mode: C; indent-tabs-mode: nil; c-basic-offset: 4; tab-width: 4 -*- */
+/*
+ * Copyright (C) 2020 Alberto Mardegan <mardy@users.sourceforge.net>
+ *
+ * This file is part of Mappero.
+ *
+ * Mappero is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Mappero is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Mappero.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef MAP_DEM_H
+#define MAP_DEM_H
+
+#include <QFile>
+#include <QHash>
+#include <QList>
+#include <QMutex>
+#include <QSharedPointer>
+#include <QString>
+#include <math.h>
+
+namespace Mappero {
+
+/* An SRTM elevation file, covering one degree of latitude and longitude;
+ * the file is mapped in memory, and never read as a whole */
+class DemFile
+{
+public:
+    DemFile(const QString &fileName, int south, int west);
+    ~DemFile();
+
+    bool isValid() const { return m_data != 0; }
+
+    /* Elevation in metres, interpolated between the nearest samples; the
+     * point must lie within the file's area. NaN if a sample is a void. */
+    float elevation(double lat, double lon) const;
+
+private:
+    inline float sample(int row, int column) const {
+        const uchar *p = m_data + 2 * (row * m_size + column);
+        /* Big endian; voids are not data, and must not be drawn */
+        qint16 value = qint16((p[0] << 8) | p[1]);
+        return value == -32768 ? NAN : float(value);
+    }
+
+    QFile m_file;
+    const uchar *m_data;
+    int m_size;
+    int m_south;
+    int m_west;
+};
+
+/* The elevation files found in a directory (named like "N60E024.hgt").
+ * It can be used from several threads at the same time. */
+class DemStore
+{
+public:
+    DemStore(const QString &directory);
+    ~DemStore();
+
+    QString directory() const { return m_directory; }
+
+    /* The file covering the degree cell whose south west corner is given;
+     * null if there's none */
+    QSharedPointer<const DemFile> file(int south, int west);
+
+private:
+    QString m_directory;
+    QMutex m_mutex;
+    /* Missing files are stored as null pointers */
+    QHash<qint32,QSharedPointer<const DemFile> > m_files;
+    QList<qint32> m_recentlyUsed;
+};
+
+}; // namespace
+
+#endif /* MAP_DEM_H */
@@ -0,0 +1,191 @@
+/* vi: set et sw=4 ts=4 cino=t0,(0: */
+/* -*- Mode: C; indent-tabs-mode: nil; c-basic-offset: 4; tab-width: 4 -*- */
+/*
+ * Copyright (C) 2020 Alberto Mardegan <mardy@users.sourceforge.net>
+ *
+ * This file is part of Mappero.
+ *
+ * Mappero is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Mappero is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Mappero.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "grid-generator.h"
+
+#include <Mappero/Projection>
+#include <QPainter>
+#include <QPen>
+#include <math.h>
+
+using namespace Mappero;
+
+namespace Mappero {
+
+class GridRenderer: public TileRenderer
+{
+public:
+    GridRenderer(qreal spacing, const QColor &color, qreal lineWidth):
+        spacing(spacing), color(color), lineWidth(lineWidth) {}
+
+    // reimplemented virtual method
+    QImage renderTile(const Projection *projection,
+                      int zoom, int x, int y) const Q_DECL_OVERRIDE;
+
+private:
+    qreal spacing;
+    QColor color;
+    qreal lineWidth;
+};
+
+class GridGeneratorPrivate
+{
+    Q_DECLARE_PUBLIC(GridGenerator)
+
+    GridGeneratorPrivate(GridGenerator *q):
+        q_ptr(q),
+        spacing(0),
+        color(0, 0, 0, 96),
+        lineWidth(1.0)
+    {
+    }
+
+private:
+    mutable GridGenerator *q_ptr;
+    qreal spacing;
+    QColor color;
+    qreal lineWidth;
+};
+
+}; // namespace
+
+/* Lines are kept at least this far apart, when the spacing is automatic */
+static const int minSpacingPixels = 128;
+
+static qreal automaticSpacing(int zoom)
+{
+    static const qreal steps[] = {
+        0.001, 0.002, 0.005, 0.01, 0.02, 0.05, 0.1, 0.2, 0.5,
+        1, 2, 5, 10, 15, 30,
+    };
+    static const int numSteps = sizeof(steps) / sizeof(steps[0]);
+
+    /* Measured at the equator: further away, parallels get further apart */
+    qreal pixelsPerDegree = (WORLD_SIZE_UNITS >> zoom) / 360.0;
+    for (int i = 0; i < numSteps; i++) {
+        if (steps[i] * pixelsPerDegree >= minSpacingPixels) return steps[i];
+    }
+    return steps[numSteps - 1];
+}
+
+QImage GridRenderer::renderTile(const Projection *projection,
+                                int zoom, int x, int y) const
+{
+    QImage image(TILE_SIZE_PIXELS, TILE_SIZE_PIXELS,
+                 QImage::Format_ARGB32_Premultiplied);
+    image.fill(Qt::transparent);
+
+    Unit tileUnits = TILE_SIZE_PIXELS << zoom;
+    Point topLeft(x * tileUnits, y * tileUnits);
+    Point bottomRight(topLeft.x() + tileUnits, topLeft.y() + tileUnits);
+    GeoPoint geoTopLeft = projection->unitToGeo(topLeft);
+    GeoPoint geoBottomRight = projection->unitToGeo(bottomRight);
+
+    qreal step = spacing > 0 ? spacing : automaticSpacing(zoom);
+    qreal unitsPerPixel = 1 << zoom;
+
+    QPainter painter(&image);
+    painter.setPen(QPen(color, lineWidth));
+
+    /* In our projections meridians are vertical lines, and parallels are
+     * horizontal; counting the lines avoids accumulating rounding errors */
+    for (int i = int(ceil(geoTopLeft.lon / step));
+         i * step <= geoBottomRight.lon; i++) {
+        Point p = projection->geoToUnit(GeoPoint(geoTopLeft.lat, i * step));
+        qreal px = (p.x() - topLeft.x()) / unitsPerPixel;
+        painter.drawLine(QPointF(px, 0), QPointF(px, TILE_SIZE_PIXELS));
+    }
+    for (int i = int(ceil(geoBottomRight.lat / step));
+         i * step <= geoTopLeft.lat; i++) {
+        Point p = projection->geoToUnit(GeoPoint(i * step, geoTopLeft.lon));
+        qreal py = (p.y() - topLeft.y()) / unitsPerPixel;
+        painter.drawLine(QPointF(0, py), QPointF(TILE_SIZE_PIXELS, py));
+    }
+
+    return image;
+}
+
+GridGenerator::GridGenerator(QObject *parent):
+    TileGenerator(parent),
+    d_ptr(new GridGeneratorPrivate(this))
+{
+}
+
+GridGenerator::~GridGenerator()
+{
+    delete d_ptr;
+}
+
+void GridGenerator::setSpacing(qreal spacing)
+{
+    Q_D(GridGenerator);
+    if (spacing == d->spacing) return;
+    d->spacing = spacing;
+    invalidate();
+}
+
+qreal GridGenerator::spacing() const
+{
+    Q_D(const GridGenerator);
+    return d->spacing;
+}
+
+void GridGenerator::setColor(const QColor &color)
+{
+    Q_D(GridGenerator);
+    if (color == d->color) return;
+    d->color = color;
+    invalidate();
+}
+
+QColor GridGenerator::color() const
+{
+    Q_D(const GridGenerator);
+    return d->color;
+}
+
+void GridGenerator::setLineWidth(qreal width)
+{
+    Q_D(GridGenerator);
+    if (width == d->lineWidth) return;
+    d->lineWidth = width;
+    invalidate();
+}
+
+qreal GridGenerator::lineWidth() const
+{
+    Q_D(const GridGenerator);
+    return d->lineWidth;
+}
+
+TileRenderer *GridGenerator::createRenderer() const
+{
+    Q_D(const GridGenerator);
+    return new GridRenderer(d->spacing, d->color, d->lineWidth);
+}
+
+QByteArray GridGenerator::parameters() const
+{
+    Q_D(const GridGenerator);
+    return QByteArray::number(d->spacing) + ' ' +
+        d->color.name(QColor::HexArgb).toLatin1() + ' ' +
+        QByteArray::number(d->lineWidth);
+}
@@ -0,0 +1,71 @@
+/* vi: set et sw=4 ts=4 cino=t0,(0: */
+/* -*- Mode: C; indent-tabs-mode: nil; c-basic-offset: 4; tab-width: 4 -*- */
+/*
+ * Copyright (C) 2020 Alberto Mardegan <mardy@users.sourceforge.net>
+ *
+ * This file is part of Mappero.
+ *
+ * Mappero is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Mappero is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Mappero.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef MAP_GRID_GENERATOR_H
+#define MAP_GRID_GENERATOR_H
+
+#include "tile-generator.h"
+
+#include <QColor>
+
+namespace Mappero {
+
+/* Draws the lines of latitude and longitude; meant to be used in an
+ * overlay */
+class GridGeneratorPrivate;
+class GridGenerator: public TileGenerator
+{
+    Q_OBJECT
+    Q_PROPERTY(qreal spacing READ spacing WRITE setSpacing \
+               NOTIFY generatorChanged);
+    Q_PROPERTY(QColor color READ color WRITE setColor \
+               NOTIFY generatorChanged);
+    Q_PROPERTY(qreal lineWidth READ lineWidth WRITE setLineWidth \
+               NOTIFY generatorChanged);
+
+public:
+    GridGenerator(QObject *parent = 0);
+    ~GridGenerator();
+
+    /* Degrees between two lines; 0 (the default) picks a spacing suitable
+     * for each zoom level */
+    void setSpacing(qreal spacing);
+    qreal spacing() const;
+
+    void setColor(const QColor &color);
+    QColor color() const;
+
+    void setLineWidth(qreal width);
+    qreal lineWidth() const;
+
+protected:
+    // reimplemented virtual methods
+    TileRenderer *createRenderer() const Q_DECL_OVERRIDE;
+    QByteArray parameters() const Q_DECL_OVERRIDE;
+
+private:
+    GridGeneratorPrivate *d_ptr;
+    Q_DECLARE_PRIVATE(GridGenerator)
+};
+
+}; // namespace
+
+#endif /* MAP_GRID_GENERATOR_H */
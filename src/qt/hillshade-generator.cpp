@@ -0,0 +1,376 @@
+/* vi: set et sw=4 ts=4 cino=t0,(0: */
+/* -*- Mode: C; indent-tabs-mode: nil; c-basic-offset: 4; tab-width: 4 -*- */
+/*
+ * Copyright (C) 2020 Alberto Mardegan <mardy@users.sourceforge.net>
+ *
+ * This file is part of Mappero.
+ *
+ * Mappero is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Mappero is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Mappero.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "dem.h"
+#include "hillshade-generator.h"
+
+#include <Mappero/Projection>
+#include <QVarLengthArray>
+#include <QVector>
+#include <QtNumeric>
+#include <limits.h>
+#include <math.h>
+
+using namespace Mappero;
+
+/* One extra row and column of samples on each side, for the kernel */
+static const int gridSize = TILE_SIZE_PIXELS + 2;
+
+/* Tiles larger than this (in degrees) would need too many elevation files,
+ * and show no useful relief anyway */
+static const double maxTileSpan = 4.0;
+
+static const double earthCircumference = 2 * M_PI * 6378137.0;
+
+namespace Mappero {
+
+/* Direction of the light, as a unit vector */
+struct Light {
+    float east;
+    float north;
+    float up;
+};
+
+class HillshadeRenderer: public TileRenderer
+{
+public:
+    HillshadeRenderer(const QSharedPointer<DemStore> &store,
+                      const Light &light, float exaggeration,
+                      bool colorRelief):
+        store(store), light(light), exaggeration(exaggeration),
+        colorRelief(colorRelief) {}
+
+    // reimplemented virtual method
+    QImage renderTile(const Projection *projection,
+                      int zoom, int x, int y) const Q_DECL_OVERRIDE;
+
+private:
+    bool sampleElevations(const Projection *projection, int zoom, int x, int y,
+                          float *elevations, float *cellSizes) const;
+
+private:
+    QSharedPointer<DemStore> store;
+    Light light;
+    float exaggeration;
+    bool colorRelief;
+};
+
+class HillshadeGeneratorPrivate
+{
+    Q_DECLARE_PUBLIC(HillshadeGenerator)
+
+    HillshadeGeneratorPrivate(HillshadeGenerator *q):
+        q_ptr(q),
+        azimuth(315),
+        altitude(45),
+        exaggeration(1.0),
+        colorRelief(false)
+    {
+    }
+
+private:
+    mutable HillshadeGenerator *q_ptr;
+    QString demDirectory;
+    qreal azimuth;
+    qreal altitude;
+    qreal exaggeration;
+    bool colorRelief;
+    QSharedPointer<DemStore> store;
+};
+
+}; // namespace
+
+/* Horn's method: the gradient at each point is estimated from its eight
+ * neighbours, and the shade is the cosine of the angle between the surface
+ * normal and the light. Everything is computed on whole rows, without
+ * branches or function calls, so that the compiler can vectorize it. */
+static void shadeRow(const float *above, const float *row, const float *below,
+                     int width, float scale, const Light &light, float *shade)
+{
+    for (int i = 0; i < width; i++) {
+        float p = ((above[i + 2] + 2 * row[i + 2] + below[i + 2]) -
+                   (above[i] + 2 * row[i] + below[i])) * scale;
+        float q = ((above[i] + 2 * above[i + 1] + above[i + 2]) -
+                   (below[i] + 2 * below[i + 1] + below[i + 2])) * scale;
+        float s = (light.up - p * light.east - q * light.north) /
+            sqrtf(1 + p * p + q * q);
+        /* Written so that NaN (missing data) goes through */
+        shade[i] = s < 0 ? 0 : s;
+    }
+}
+
+struct ReliefStop {
+    float elevation;
+    int red;
+    int green;
+    int blue;
+};
+
+static const ReliefStop reliefStops[] = {
+    { 0, 0x6e, 0xa0, 0x5a },
+    { 300, 0xa8, 0xc0, 0x6c },
+    { 800, 0xe6, 0xd2, 0x8c },
+    { 1500, 0xc4, 0x96, 0x64 },
+    { 2500, 0x96, 0x78, 0x6e },
+    { 3500, 0xc8, 0xc8, 0xc8 },
+    { 5000, 0xff, 0xff, 0xff },
+};
+static const int numReliefStops = sizeof(reliefStops) / sizeof(reliefStops[0]);
+
+static QRgb reliefColor(float elevation, float light)
+{
+    if (qIsNaN(elevation) || qIsNaN(light)) return 0;
+
+    int i = 1;
+    while (i < numReliefStops - 1 && elevation > reliefStops[i].elevation) i++;
+    const ReliefStop &low = reliefStops[i - 1];
+    const ReliefStop &high = reliefStops[i];
+    float t = qBound(0.0f, (elevation - low.elevation) /
+                     (high.elevation - low.elevation), 1.0f);
+
+    /* light is 1 on flat terrain */
+    float factor = qBound(0.3f, 0.5f + 0.5f * light, 1.3f);
+    int red = int((low.red + (high.red - low.red) * t) * factor);
+    int green = int((low.green + (high.green - low.green) * t) * factor);
+    int blue = int((low.blue + (high.blue - low.blue) * t) * factor);
+    return qRgb(qMin(red, 255), qMin(green, 255), qMin(blue, 255));
+}
+
+static QRgb overlayColor(float shade, float flatShade)
+{
+    if (qIsNaN(shade)) return 0;
+
+    /* Premultiplied: darken the slopes in the shadow, and lighten a bit
+     * those facing the light */
+    if (shade < flatShade) {
+        int alpha = int((flatShade - shade) / flatShade * 200);
+        return qRgba(0, 0, 0, alpha);
+    }
+    if (flatShade > 0.999f) return 0;
+    int alpha = int((shade - flatShade) / (1 - flatShade) * 80);
+    return qRgba(alpha, alpha, alpha, alpha);
+}
+
+bool HillshadeRenderer::sampleElevations(const Projection *projection,
+                                         int zoom, int x, int y,
+                                         float *elevations,
+                                         float *cellSizes) const
+{
+    Unit pixelUnits = 1 << zoom;
+    Unit tileUnits = TILE_SIZE_PIXELS << zoom;
+    Unit x0 = x * tileUnits;
+    Unit y0 = y * tileUnits;
+
+    /* In our projections longitude only depends on x, and latitude on y:
+     * no need to project every sample */
+    QVarLengthArray<double, gridSize> lats(gridSize);
+    QVarLengthArray<double, gridSize> lons(gridSize);
+    for (int i = 0; i < gridSize; i++) {
+        Unit offset = (i - 1) * pixelUnits + pixelUnits / 2;
+        lons[i] = projection->unitToGeo(Point(x0 + offset, y0)).lon;
+        lats[i] = projection->unitToGeo(Point(x0, y0 + offset)).lat;
+    }
+    if (lons[gridSize - 1] - lons[0] > maxTileSpan ||
+        lats[0] - lats[gridSize - 1] > maxTileSpan) return false;
+
+    /* Ground size of a pixel, which only depends on the latitude */
+    double worldPixels = WORLD_SIZE_UNITS >> zoom;
+    for (int r = 0; r < gridSize; r++) {
+        cellSizes[r] =
+            earthCircumference * cos(lats[r] * M_PI / 180) / worldPixels;
+    }
+
+    bool haveData = false;
+    QSharedPointer<const DemFile> file;
+    int fileSouth = INT_MIN, fileWest = INT_MIN;
+    for (int r = 0; r < gridSize; r++) {
+        int south = int(floor(lats[r]));
+        float *out = elevations + r * gridSize;
+        for (int c = 0; c < gridSize; c++) {
+            int west = int(floor(lons[c]));
+            if (south != fileSouth || west != fileWest) {
+                file = store->file(south, west);
+                fileSouth = south;
+                fileWest = west;
+            }
+            if (file) {
+                out[c] = file->elevation(lats[r], lons[c]);
+                haveData = true;
+            } else {
+                out[c] = NAN;
+            }
+        }
+    }
+    return haveData;
+}
+
+QImage HillshadeRenderer::renderTile(const Projection *projection,
+                                     int zoom, int x, int y) const
+{
+    QImage image(TILE_SIZE_PIXELS, TILE_SIZE_PIXELS,
+                 QImage::Format_ARGB32_Premultiplied);
+    image.fill(Qt::transparent);
+
+    QVector<float> elevations(gridSize * gridSize);
+    QVector<float> cellSizes(gridSize);
+    if (!sampleElevations(projection, zoom, x, y,
+                          elevations.data(), cellSizes.data())) {
+        /* Nothing to draw here: still, a valid tile, so that it's cached */
+        return image;
+    }
+
+    QVector<float> shade(TILE_SIZE_PIXELS);
+    float flatShade = light.up;
+    for (int r = 0; r < TILE_SIZE_PIXELS; r++) {
+        const float *above = elevations.constData() + r * gridSize;
+        const float *row = above + gridSize;
+        const float *below = row + gridSize;
+        shadeRow(above, row, below, TILE_SIZE_PIXELS,
+                 exaggeration / (8 * cellSizes[r + 1]), light, shade.data());
+
+        QRgb *line = reinterpret_cast<QRgb*>(image.scanLine(r));
+        if (colorRelief) {
+            for (int c = 0; c < TILE_SIZE_PIXELS; c++) {
+                line[c] = reliefColor(row[c + 1], shade[c] / flatShade);
+            }
+        } else {
+            for (int c = 0; c < TILE_SIZE_PIXELS; c++) {
+                line[c] = overlayColor(shade[c], flatShade);
+            }
+        }
+    }
+
+    return image;
+}
+
+HillshadeGenerator::HillshadeGenerator(QObject *parent):
+    TileGenerator(parent),
+    d_ptr(new HillshadeGeneratorPrivate(this))
+{
+}
+
+HillshadeGenerator::~HillshadeGenerator()
+{
+    delete d_ptr;
+}
+
+void HillshadeGenerator::setDemDirectory(const QString &directory)
+{
+    Q_D(HillshadeGenerator);
+    if (directory == d->demDirectory) return;
+    d->demDirectory = directory;
+    /* The store of the old directory lives on in the old renderers */
+    d->store.clear();
+    invalidate();
+}
+
+QString HillshadeGenerator::demDirectory() const
+{
+    Q_D(const HillshadeGenerator);
+    return d->demDirectory;
+}
+
+void HillshadeGenerator::setAzimuth(qreal azimuth)
+{
+    Q_D(HillshadeGenerator);
+    if (azimuth == d->azimuth) return;
+    d->azimuth = azimuth;
+    invalidate();
+}
+
+qreal HillshadeGenerator::azimuth() const
+{
+    Q_D(const HillshadeGenerator);
+    return d->azimuth;
+}
+
+void HillshadeGenerator::setAltitude(qreal altitude)
+{
+    Q_D(HillshadeGenerator);
+    altitude = qBound(0.0, altitude, 90.0);
+    if (altitude == d->altitude) return;
+    d->altitude = altitude;
+    invalidate();
+}
+
+qreal HillshadeGenerator::altitude() const
+{
+    Q_D(const HillshadeGenerator);
+    return d->altitude;
+}
+
+void HillshadeGenerator::setExaggeration(qreal exaggeration)
+{
+    Q_D(HillshadeGenerator);
+    if (exaggeration == d->exaggeration) return;
+    d->exaggeration = exaggeration;
+    invalidate();
+}
+
+qreal HillshadeGenerator::exaggeration() const
+{
+    Q_D(const HillshadeGenerator);
+    return d->exaggeration;
+}
+
+void HillshadeGenerator::setColorRelief(bool colorRelief)
+{
+    Q_D(HillshadeGenerator);
+    if (colorRelief == d->colorRelief) return;
+    d->colorRelief = colorRelief;
+    invalidate();
+}
+
+bool HillshadeGenerator::colorRelief() const
+{
+    Q_D(const HillshadeGenerator);
+    return d->colorRelief;
+}
+
+TileRenderer *HillshadeGenerator::createRenderer() const
+{
+    Q_D(const HillshadeGenerator);
+
+    /* Keep the mapped files across parameter changes */
+    HillshadeGeneratorPrivate *dd = const_cast<HillshadeGeneratorPrivate*>(d);
+    if (!dd->store) {
+        dd->store = QSharedPointer<DemStore>(new DemStore(d->demDirectory));
+    }
+
+    double azimuth = d->azimuth * M_PI / 180;
+    double altitude = d->altitude * M_PI / 180;
+    Light light;
+    light.east = float(cos(altitude) * sin(azimuth));
+    light.north = float(cos(altitude) * cos(azimuth));
+    light.up = float(sin(altitude));
+    return new HillshadeRenderer(d->store, light, float(d->exaggeration),
+                                 d->colorRelief);
+}
+
+QByteArray HillshadeGenerator::parameters() const
+{
+    Q_D(const HillshadeGenerator);
+    return d->demDirectory.toUtf8() + ' ' +
+        QByteArray::number(d->azimuth) + ' ' +
+        QByteArray::number(d->altitude) + ' ' +
+        QByteArray::number(d->exaggeration) + ' ' +
+        (d->colorRelief ? "relief" : "shade");
+}
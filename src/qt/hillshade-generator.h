@@ -0,0 +1,84 @@
+/* vi: set et sw=4 ts=4 cino=t0,(0: */
+/* -*- Mode: C; indent-tabs-mode: nil; c-basic-offset: 4; tab-width: 4 -*- */
+/*
+ * Copyright (C) 2020 Alberto Mardegan <mardy@users.sourceforge.net>
+ *
+ * This file is part of Mappero.
+ *
+ * Mappero is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Mappero is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Mappero.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef MAP_HILLSHADE_GENERATOR_H
+#define MAP_HILLSHADE_GENERATOR_H
+
+#include "tile-generator.h"
+
+#include <QString>
+
+namespace Mappero {
+
+/* Shades the terrain described by the SRTM elevation files (".hgt") found
+ * in a local directory; no network is needed. By default it produces a
+ * transparent overlay, which darkens the slopes facing away from the sun;
+ * with colorRelief set, it produces opaque tiles coloured by elevation. */
+class HillshadeGeneratorPrivate;
+class HillshadeGenerator: public TileGenerator
+{
+    Q_OBJECT
+    Q_PROPERTY(QString demDirectory READ demDirectory WRITE setDemDirectory \
+               NOTIFY generatorChanged);
+    Q_PROPERTY(qreal azimuth READ azimuth WRITE setAzimuth \
+               NOTIFY generatorChanged);
+    Q_PROPERTY(qreal altitude READ altitude WRITE setAltitude \
+               NOTIFY generatorChanged);
+    Q_PROPERTY(qreal exaggeration READ exaggeration WRITE setExaggeration \
+               NOTIFY generatorChanged);
+    Q_PROPERTY(bool colorRelief READ colorRelief WRITE setColorRelief \
+               NOTIFY generatorChanged);
+
+public:
+    HillshadeGenerator(QObject *parent = 0);
+    ~HillshadeGenerator();
+
+    void setDemDirectory(const QString &directory);
+    QString demDirectory() const;
+
+    /* Direction of the light, in degrees clockwise from north */
+    void setAzimuth(qreal azimuth);
+    qreal azimuth() const;
+
+    /* Elevation of the light above the horizon, in degrees */
+    void setAltitude(qreal altitude);
+    qreal altitude() const;
+
+    /* Vertical scale factor, to make gentle terrain stand out */
+    void setExaggeration(qreal exaggeration);
+    qreal exaggeration() const;
+
+    void setColorRelief(bool colorRelief);
+    bool colorRelief() const;
+
+protected:
+    // reimplemented virtual methods
+    TileRenderer *createRenderer() const Q_DECL_OVERRIDE;
+    QByteArray parameters() const Q_DECL_OVERRIDE;
+
+private:
+    HillshadeGeneratorPrivate *d_ptr;
+    Q_DECLARE_PRIVATE(HillshadeGenerator)
+};
+
+}; // namespace
+
+#endif /* MAP_HILLSHADE_GENERATOR_H */
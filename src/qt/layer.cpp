@@ -79,7 +79,8 @@ Layer::Layer():
 Layer::~Layer()
 {
     Q_D(Layer);
-    if (!d->id.isEmpty()) {
+    /* another layer might have taken over our id */
+    if (!d->id.isEmpty() && layerIdMap.value(d->id) == this) {
         layerIdMap.remove(d->id);
     }
     delete d_ptr;
@@ -96,7 +97,7 @@ void Layer::setId(const QString &id)
 
     if (id == d->id) return;
 
-    if (!d->id.isEmpty()) {
+    if (!d->id.isEmpty() && layerIdMap.value(d->id) == this) {
         layerIdMap.remove(d->id);
     }
     d->id = id;
@@ -21,6 +21,8 @@
 #include "configuration.h"
 #include "controller.h"
 #include "gps.h"
+#include "grid-generator.h"
+#include "hillshade-generator.h"
 #include "map.h"
 #include "path-item.h"
 #include "path-layer.h"
@@ -32,8 +34,11 @@
 #include "taggable-selection.h"
 #include "taggable.h"
 #include "ticks.h"
+#include "track-collection.h"
+#include "track-importer.h"
 #include "updater.h"
 #endif
+#include "tile-prefetcher.h"
 #include "tiled-layer.h"
 #include "tracker.h"
 
@@ -70,6 +75,11 @@ int main(int argc, char *argv[])
     MapperoUi::registerTypes();
     qmlRegisterType<Mappero::Map>("Mappero", 1, 0, "MapView");
     qmlRegisterType<Mappero::TiledLayer>("Mappero", 1, 0, "TiledLayer");
+    qmlRegisterType<Mappero::TilePrefetcher>("Mappero", 1, 0,
+                                             "TilePrefetcher");
+    qmlRegisterType<Mappero::GridGenerator>("Mappero", 1, 0, "GridGenerator");
+    qmlRegisterType<Mappero::HillshadeGenerator>("Mappero", 1, 0,
+                                                 "HillshadeGenerator");
     qmlRegisterType<Mappero::Tracker>("Mappero", 1, 0, "Tracker");
     qmlRegisterType<Mappero::PathItem>("Mappero", 1, 0, "PathItem");
     qmlRegisterType<Mappero::PathLayer>("Mappero", 1, 0, "PathLayer");
@@ -81,11 +91,14 @@ int main(int argc, char *argv[])
     qmlRegisterUncreatableType<Mappero::MapItem>("Mappero", 1, 0, "MapItem",
                                                  "C++ creation only");
     qmlRegisterType<Mappero::Layer>();
+    qmlRegisterType<Mappero::TileGenerator>();
     qmlRegisterType<QAbstractItemModel>();
     qmlRegisterType<QAbstractListModel>();
     qmlRegisterType<Mappero::Configuration>();
 
     Mappero::Controller controller;
+    /* Get the disk busy while QML is being loaded */
+    controller.warmUpTileCache();
     QQmlApplicationEngine engine;
     engine.rootContext()->setContextProperty("application",
                                              QVariant::fromValue(&app));
@@ -103,6 +116,10 @@ int main(int argc, char *argv[])
     engine.addImageProvider(Mappero::Taggable::ImageProvider::name(),
                             Mappero::Taggable::ImageProvider::instance());
     qmlRegisterType<Mappero::Ticks>("Mappero", 1, 0, "Ticks");
+    qmlRegisterType<Mappero::TrackCollection>("Mappero", 1, 0,
+                                              "TrackCollection");
+    qmlRegisterType<Mappero::TrackImporter>("Mappero", 1, 0,
+                                            "TrackImporter");
     qmlRegisterType<Mardy::Updater>("Mardy", 1, 0, "Updater");
 #endif
 
@@ -21,6 +21,7 @@
 #ifdef HAVE_CONFIG_H
 #   include "config.h"
 #endif
+#include "configuration.h"
 #include "controller.h"
 #include "debug.h"
 #include "gps.h"
@@ -29,10 +30,14 @@
 #include "map-object.h"
 #include "mark.h"
 #include "path-item.h"
+#include "tile-download.h"
+#include "tiled-layer.h"
 
 #include <Mappero/Path>
 #include <Mappero/Projection>
 #include <QEvent>
+#include <QPropertyAnimation>
+#include <QTimer>
 #include <math.h>
 
 using namespace Mappero;
@@ -40,6 +45,7 @@ using namespace Mappero;
 namespace Mappero {
 
 typedef QQmlListProperty<QObject> MapItemList;
+typedef QQmlListProperty<Layer> LayerList;
 
 class LayerGroup: public MapItem
 {
@@ -111,8 +117,34 @@ class MapPrivate: public QObject
     void itemAdded(QQuickItem *item);
     void itemRemoved(QQuickItem *item);
 
+    void parkLayer(Layer *layer);
+    void trimLayerPool();
+
+    static void overlayAppend(LayerList *p, Layer *layer) {
+        MapPrivate *d = reinterpret_cast<MapPrivate*>(p->data);
+        d->q_ptr->addOverlay(layer);
+    }
+    static int overlayCount(LayerList *p) {
+        MapPrivate *d = reinterpret_cast<MapPrivate*>(p->data);
+        return d->overlays.count();
+    }
+    static Layer *overlayAt(LayerList *p, int idx) {
+        MapPrivate *d = reinterpret_cast<MapPrivate*>(p->data);
+        return d->overlays.at(idx);
+    }
+    static void overlayClear(LayerList *p) {
+        MapPrivate *d = reinterpret_cast<MapPrivate*>(p->data);
+        while (!d->overlays.isEmpty()) {
+            d->q_ptr->removeOverlay(d->overlays.last());
+        }
+    }
+    void restackOverlays();
+
 private Q_SLOTS:
     void deliverMapEvent();
+    void recordViewedArea();
+    void finishFading();
+    void onOverlayDestroyed(QObject *object);
     void onFlickablePan();
     void onFlickablePanFinished();
 
@@ -124,6 +156,16 @@ private:
     QList<MapObject*> mapObjects;
     LayerGroup *layerGroup;
     Layer *mainLayer;
+    /* Recently used layers, kept alive (with their tiles) so that switching
+     * back to them is instant; the most recently used is the last one */
+    QList<Layer*> layerPool;
+    int layerPoolSize;
+    /* The previous main layer, while it fades out */
+    Layer *fadingLayer;
+    QPropertyAnimation *fadeAnimation;
+    /* Only views the user stays on for a while are recorded */
+    QTimer viewedAreaTimer;
+    QList<Layer*> overlays;
     GeoPoint center;
     QPointF animatedCenterUnits;
     GeoPoint requestedCenter;
@@ -149,6 +191,9 @@ MapPrivate::MapPrivate(Map *q):
     reparenting(false),
     layerGroup(new LayerGroup),
     mainLayer(0),
+    layerPoolSize(2),
+    fadingLayer(0),
+    fadeAnimation(new QPropertyAnimation(this)),
     center(0, 0),
     animatedCenterUnits(0, 0),
     requestedCenter(0, 0),
@@ -174,6 +219,18 @@ MapPrivate::MapPrivate(Map *q):
                      this, SLOT(deliverMapEvent()), Qt::QueuedConnection);
     QObject::connect(q, SIGNAL(animatedCenterUnitsChanged(const QPointF&)),
                      this, SLOT(deliverMapEvent()), Qt::QueuedConnection);
+
+    fadeAnimation->setPropertyName("opacity");
+    fadeAnimation->setStartValue(1.0);
+    fadeAnimation->setEndValue(0.0);
+    fadeAnimation->setDuration(250);
+    QObject::connect(fadeAnimation, SIGNAL(finished()),
+                     this, SLOT(finishFading()));
+
+    viewedAreaTimer.setSingleShot(true);
+    viewedAreaTimer.setInterval(3000);
+    QObject::connect(&viewedAreaTimer, SIGNAL(timeout()),
+                     this, SLOT(recordViewedArea()));
 }
 
 void MapPrivate::setRequestedCenter(const Point &centerUnits)
@@ -211,6 +268,70 @@ void MapPrivate::itemRemoved(QQuickItem *item)
     }
 }
 
+void MapPrivate::parkLayer(Layer *layer)
+{
+    /* Keep showing the layer above the new one while it fades out; it will
+     * be hidden (or deleted, if it didn't make it into the pool) once done */
+    finishFading();
+    fadingLayer = layer;
+    layer->setZ(-9);
+    fadeAnimation->setTargetObject(layer);
+    fadeAnimation->start();
+
+    layerPool.append(layer);
+    trimLayerPool();
+}
+
+void MapPrivate::trimLayerPool()
+{
+    while (layerPool.count() > layerPoolSize) {
+        Layer *layer = layerPool.takeFirst();
+        if (layer != fadingLayer) {
+            layer->setMap(0);
+            delete layer;
+        }
+    }
+}
+
+void MapPrivate::finishFading()
+{
+    if (!fadingLayer) return;
+
+    Layer *layer = fadingLayer;
+    fadingLayer = 0;
+    fadeAnimation->stop();
+    fadeAnimation->setTargetObject(0);
+
+    layer->setMap(0);
+    if (layerPool.contains(layer)) {
+        layer->setVisible(false);
+        layer->setOpacity(1.0);
+        layer->setZ(-10);
+    } else {
+        delete layer;
+    }
+}
+
+void MapPrivate::restackOverlays()
+{
+    /* Above the main layer and the one fading out, below everything else */
+    for (int i = 0; i < overlays.count(); i++) {
+        overlays[i]->setZ(-8 + i * 0.01);
+    }
+}
+
+void MapPrivate::onOverlayDestroyed(QObject *object)
+{
+    Q_Q(Map);
+    for (int i = 0; i < overlays.count(); i++) {
+        if (static_cast<QObject*>(overlays[i]) == object) {
+            q->removeObject(overlays.takeAt(i));
+            Q_EMIT q->overlaysChanged();
+            break;
+        }
+    }
+}
+
 void MapPrivate::deliverMapEvent()
 {
     bool sendToAll = mapEvent.centerChanged() ||
@@ -218,16 +339,47 @@ void MapPrivate::deliverMapEvent()
         mapEvent.sizeChanged();
     bool sendToUnscalable = mapEvent.animated();
 
+    /* Animations, pinches and GPS updates move the view many times per
+     * second: wait for it to settle */
+    if (mapEvent.centerChanged() || mapEvent.zoomLevelChanged()) {
+        viewedAreaTimer.start();
+    }
+
     if (sendToAll || sendToUnscalable) {
+        /* Let the tiles needed by all the layers be queued at once, so that
+         * they get downloaded in order of priority */
+        TileDownload *tileDownload = Controller::instance()->tileDownload();
+        tileDownload->beginBatch();
         foreach (MapObject *object, mapObjects) {
             if (sendToAll || !object->isScalable()) {
                 object->mapEvent(&mapEvent);
             }
         }
+        tileDownload->endBatch();
         mapEvent.clear();
     }
 }
 
+void MapPrivate::recordViewedArea()
+{
+    if (mainLayer == 0 || zoomLevel < 0) return;
+
+    /* Remember where the user looks at, to warm up the tile cache at the
+     * next startup */
+    Configuration *configuration = Controller::instance()->configuration();
+    int zoom = int(zoomLevel);
+    configuration->recordViewedArea(zoom, centerUnits.toTile(zoom));
+
+    /* And where the tiles are: the layer won't exist yet at that time */
+    TiledLayer *tiledLayer = qobject_cast<TiledLayer*>(mainLayer);
+    if (tiledLayer) {
+        QString fileTemplate = tiledLayer->tileFileTemplate();
+        if (fileTemplate != configuration->mainLayerTileFiles()) {
+            configuration->setMainLayerTileFiles(fileTemplate);
+        }
+    }
+}
+
 void MapPrivate::onFlickablePan()
 {
     Q_Q(Map);
@@ -288,6 +440,9 @@ Map::Map():
 
 Map::~Map()
 {
+    Q_D(Map);
+    d->finishFading();
+    qDeleteAll(d->layerPool);
     delete d_ptr;
 }
 
@@ -297,12 +452,19 @@ void Map::setMainLayer(Layer *layer)
 
     if (layer == d->mainLayer) return;
 
-    if (d->mainLayer != 0) {
-        d->mainLayer->setMap(0);
-        delete d->mainLayer;
+    if (layer != 0) {
+        if (layer == d->fadingLayer) d->finishFading();
+        d->layerPool.removeOne(layer);
     }
+
+    Layer *oldLayer = d->mainLayer;
     d->mainLayer = layer;
+    if (oldLayer != 0) {
+        d->parkLayer(oldLayer);
+    }
     if (layer != 0) {
+        layer->setVisible(true);
+        layer->setOpacity(1.0);
         layer->setParentItem(d->layerGroup);
         layer->setZ(-10);
         layer->setMap(this);
@@ -324,6 +486,65 @@ Layer *Map::mainLayer() const
     return d->mainLayer;
 }
 
+void Map::setLayerPoolSize(int size)
+{
+    Q_D(Map);
+    if (size == d->layerPoolSize) return;
+    d->layerPoolSize = qMax(size, 0);
+    d->trimLayerPool();
+    Q_EMIT layerPoolSizeChanged();
+}
+
+int Map::layerPoolSize() const
+{
+    Q_D(const Map);
+    return d->layerPoolSize;
+}
+
+QQmlListProperty<Layer> Map::overlays()
+{
+    return LayerList(this, d_ptr,
+                     MapPrivate::overlayAppend,
+                     MapPrivate::overlayCount,
+                     MapPrivate::overlayAt,
+                     MapPrivate::overlayClear);
+}
+
+void Map::addOverlay(Layer *layer)
+{
+    Q_D(Map);
+
+    if (layer == 0 || d->overlays.contains(layer)) return;
+
+    d->overlays.append(layer);
+    QObject::connect(layer, SIGNAL(destroyed(QObject*)),
+                     d, SLOT(onOverlayDestroyed(QObject*)));
+    layer->setParentItem(d->layerGroup);
+    d->restackOverlays();
+    layer->setMap(this);
+    Q_EMIT overlaysChanged();
+}
+
+void Map::removeOverlay(Layer *layer)
+{
+    Q_D(Map);
+
+    if (!d->overlays.removeOne(layer)) return;
+
+    QObject::disconnect(layer, SIGNAL(destroyed(QObject*)),
+                        d, SLOT(onOverlayDestroyed(QObject*)));
+    layer->setMap(0);
+    layer->setParentItem(0);
+    d->restackOverlays();
+    Q_EMIT overlaysChanged();
+}
+
+QList<Layer*> Map::overlayList() const
+{
+    Q_D(const Map);
+    return d->overlays;
+}
+
 void Map::addObject(MapObject *mapObject)
 {
     Q_D(Map);
@@ -24,6 +24,7 @@
 
 #include "types.h"
 
+#include <QQmlListProperty>
 #include <QQuickItem>
 
 namespace Mappero {
@@ -68,6 +69,10 @@ class Map: public QQuickItem {
                NOTIFY pinchScaleChanged);
     Q_PROPERTY(Mappero::Layer *mainLayer READ mainLayer WRITE setMainLayer \
                NOTIFY mainLayerChanged);
+    Q_PROPERTY(int layerPoolSize READ layerPoolSize WRITE setLayerPoolSize \
+               NOTIFY layerPoolSizeChanged);
+    Q_PROPERTY(QQmlListProperty<Mappero::Layer> overlays READ overlays \
+               NOTIFY overlaysChanged);
     Q_PROPERTY(bool followGps READ followGps WRITE setFollowGps \
                NOTIFY followGpsChanged);
 
@@ -113,6 +118,19 @@ public:
     void setMainLayer(Layer *layer);
     Layer *mainLayer() const;
 
+    /* How many of the previous main layers are kept alive, with their tiles,
+     * to be switched back to instantly */
+    void setLayerPoolSize(int size);
+    int layerPoolSize() const;
+
+    /* Layers drawn over the main layer, bottom to top; they must use the
+     * same projection as the main layer. The map doesn't take ownership of
+     * them. */
+    QQmlListProperty<Layer> overlays();
+    void addOverlay(Layer *layer);
+    void removeOverlay(Layer *layer);
+    QList<Layer*> overlayList() const;
+
     void setFollowGps(bool followGps);
     bool followGps() const;
 
@@ -137,6 +155,8 @@ Q_SIGNALS:
     void pinchScaleChanged();
     void sizeChanged();
     void mainLayerChanged();
+    void layerPoolSizeChanged();
+    void overlaysChanged();
     void followGpsChanged(bool followGps);
 
 protected Q_SLOTS:
@@ -23,7 +23,9 @@
 
 #include <QAbstractListModel>
 #include <QDateTime>
+#include <QPair>
 #include <QUrl>
+#include <algorithm>
 
 using namespace Mappero;
 
@@ -278,6 +280,39 @@ GeoPoint PathItem::positionAt(const QDateTime &time) const
     return p.geo;
 }
 
+QVariantList PathItem::positionsAt(const QVariantList &times) const
+{
+    Q_D(const PathItem);
+
+    /* Look the times up in order, then return the positions in the order
+     * the times were given */
+    QVector<QPair<time_t,int> > sorted;
+    sorted.reserve(times.count());
+    for (int i = 0; i < times.count(); i++) {
+        QDateTime time = times[i].toDateTime();
+        sorted.append(qMakePair(time_t(time.addSecs(-d->offset).toTime_t()),
+                                i));
+    }
+    std::sort(sorted.begin(), sorted.end());
+
+    QVector<time_t> sortedTimes;
+    sortedTimes.reserve(sorted.count());
+    for (int i = 0; i < sorted.count(); i++) {
+        sortedTimes.append(sorted[i].first);
+    }
+
+    QVector<PathPoint> points = d->path.positionsAt(sortedTimes);
+    QVariantList positions;
+    positions.reserve(times.count());
+    for (int i = 0; i < times.count(); i++) {
+        positions.append(QVariant());
+    }
+    for (int i = 0; i < sorted.count(); i++) {
+        positions[sorted[i].second] = QVariant::fromValue(points[i].geo);
+    }
+    return positions;
+}
+
 QRectF PathItem::itemArea() const
 {
     Q_D(const PathItem);
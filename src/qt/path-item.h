@@ -75,6 +75,7 @@ public:
     QAbstractListModel *wayPointModel() const;
 
     Q_INVOKABLE GeoPoint positionAt(const QDateTime &time) const;
+    Q_INVOKABLE QVariantList positionsAt(const QVariantList &times) const;
     Q_INVOKABLE QRectF itemArea() const;
 
 public Q_SLOTS:
@@ -24,8 +24,17 @@
 #include "path-layer.h"
 
 #include <Mappero/Path>
+#include <QHash>
 #include <QPainter>
 #include <QPen>
+#include <QQuickWindow>
+#include <QSGFlatColorMaterial>
+#include <QSGGeometryNode>
+#include <QSGOpacityNode>
+#include <QSGRenderNode>
+#include <QSGRendererInterface>
+#include <QSGTransformNode>
+#include <cmath>
 
 using namespace Mappero;
 
@@ -33,11 +42,112 @@ namespace Mappero {
 
 typedef QQmlListProperty<PathItem> PathList;
 
+static const float lineWidth = 4;
+/* Sharper turns get a shorter (bevel-like) join */
+static const float miterLimit = 2;
+
 struct PathItemData {
     inline PathItemData(PathItem *pathItem);
+    /* Identifies the item's node in the scene graph */
+    int id;
     PathItem *pathItem;
-    QPainterPath painterPath;
-    QPen pen;
+    QColor color;
+    /* Whether the path must be tessellated again */
+    bool pathChanged;
+};
+
+/* The polylines of a path, as drawn at a given zoom level: a thick line is
+ * tessellated into a single triangle strip, where consecutive polylines are
+ * joined by degenerate triangles. */
+class PolylineNode: public QSGGeometryNode
+{
+public:
+    PolylineNode():
+        m_geometry(QSGGeometry::defaultAttributes_Point2D(), 0)
+    {
+        m_geometry.setDrawingMode(QSGGeometry::DrawTriangleStrip);
+        m_geometry.setVertexDataPattern(QSGGeometry::StaticPattern);
+        setGeometry(&m_geometry);
+        setMaterial(&m_material);
+    }
+
+    void setColor(const QColor &color) {
+        if (color == m_material.color()) return;
+        m_material.setColor(color);
+        markDirty(DirtyMaterial);
+    }
+
+    void setPolylines(const QVector<QPolygonF> &polylines);
+
+private:
+    QSGGeometry m_geometry;
+    QSGFlatColorMaterial m_material;
+};
+
+/* The software renderer doesn't draw geometry nodes: there the polylines are
+ * stroked with a QPainter; the transformation still comes from the scene
+ * graph. */
+class PainterPolylineNode: public QSGRenderNode
+{
+public:
+    PainterPolylineNode(QQuickWindow *window):
+        m_window(window),
+        m_pen(Qt::black, lineWidth)
+    {
+        m_pen.setCosmetic(true);
+        m_pen.setCapStyle(Qt::FlatCap);
+    }
+
+    void setColor(const QColor &color) {
+        if (color == m_pen.color()) return;
+        m_pen.setColor(color);
+        markDirty(DirtyMaterial);
+    }
+
+    void setPolylines(const QVector<QPolygonF> &polylines);
+
+    void render(const RenderState *state) Q_DECL_OVERRIDE;
+    StateFlags changedStates() const Q_DECL_OVERRIDE { return 0; }
+    RenderingFlags flags() const Q_DECL_OVERRIDE {
+        return BoundedRectRendering;
+    }
+    QRectF rect() const Q_DECL_OVERRIDE { return m_rect; }
+
+private:
+    QQuickWindow *m_window;
+    QPen m_pen;
+    QPainterPath m_path;
+    QRectF m_rect;
+};
+
+/* Holds the contents of one path item: the vertices are in the pixel
+ * coordinates of the zoom level they were computed for, relative to
+ * "origin" in order not to lose precision with floats; the transformation
+ * matrix places them in the item and scales them to the current zoom. Only
+ * the parts of the path crossing "builtArea" (in map units) are there. */
+class PathNode: public QSGTransformNode
+{
+public:
+    PathNode(QQuickWindow *window, int itemId);
+
+    void setPath(const Path &path, int zoomLevel, const QRect &area);
+    void setColor(const QColor &color);
+    void setOpacity(qreal opacity) { m_opacityNode->setOpacity(opacity); }
+    void updateMatrix(const Point &centerUnits, qreal zoom,
+                      const QPointF &itemCenter);
+
+    int itemId() const { return m_itemId; }
+    int zoomLevel() const { return m_zoomLevel; }
+    const QRect &builtArea() const { return m_builtArea; }
+
+private:
+    int m_itemId;
+    int m_zoomLevel;
+    QRect m_builtArea;
+    QPointF m_origin;
+    QSGOpacityNode *m_opacityNode;
+    PolylineNode *m_polylineNode;
+    PainterPolylineNode *m_painterNode;
 };
 
 class PathLayerPrivate: public QObject
@@ -47,7 +157,9 @@ class PathLayerPrivate: public QObject
 
     PathLayerPrivate(PathLayer *pathLayer):
         QObject(0),
-        q_ptr(pathLayer)
+        q_ptr(pathLayer),
+        lastItemId(0),
+        itemsChanged(false)
     {
     }
     ~PathLayerPrivate() {};
@@ -70,6 +182,8 @@ class PathLayerPrivate: public QObject
             delete data;
         }
         d->items.clear();
+        d->itemsChanged = true;
+        d->q_ptr->update();
         Q_EMIT d->q_ptr->itemsChanged();
     }
 
@@ -78,6 +192,7 @@ class PathLayerPrivate: public QObject
     void addPathItem(PathItem *pathItem);
 
     PathItemData *pathItemData(const PathItem *item);
+    QRect visibleArea() const;
 
 public Q_SLOTS:
     void onPathChanged();
@@ -86,14 +201,188 @@ public Q_SLOTS:
 private:
     mutable PathLayer *q_ptr;
     QList<PathItemData *> items;
+    int lastItemId;
+    /* Items have been added or removed: their nodes must be created or
+     * deleted */
+    bool itemsChanged;
 };
 }; // namespace
 
+static QVector<QPolygonF> toPolylines(const QPainterPath &painterPath,
+                                      const QPointF &origin)
+{
+    QVector<QPolygonF> polylines;
+    for (int i = 0; i < painterPath.elementCount(); i++) {
+        const QPainterPath::Element &e = painterPath.elementAt(i);
+        QPointF p = QPointF(e.x, e.y) - origin;
+        if (e.isMoveTo()) {
+            polylines.append(QPolygonF());
+        } else if (p == polylines.last().last()) {
+            /* Points falling on the same pixel don't make a direction */
+            continue;
+        }
+        polylines.last().append(p);
+    }
+    return polylines;
+}
+
+void PolylineNode::setPolylines(const QVector<QPolygonF> &polylines)
+{
+    int vertexCount = 0;
+    Q_FOREACH(const QPolygonF &polyline, polylines) {
+        if (polyline.count() < 2) continue;
+        /* Two degenerate vertices join it to the previous one */
+        if (vertexCount > 0) vertexCount += 2;
+        vertexCount += polyline.count() * 2;
+    }
+
+    m_geometry.allocate(vertexCount);
+    QSGGeometry::Point2D *v = m_geometry.vertexDataAsPoint2D();
+    const float halfWidth = lineWidth / 2;
+    bool first = true;
+    Q_FOREACH(const QPolygonF &polyline, polylines) {
+        int count = polyline.count();
+        if (count < 2) continue;
+
+        if (!first) {
+            *v = *(v - 1);
+            v++;
+        }
+
+        QPointF normalIn, normalOut;
+        for (int i = 0; i < count; i++) {
+            const QPointF &p = polyline[i];
+            if (i + 1 < count) {
+                QPointF d = polyline[i + 1] - p;
+                qreal length = sqrt(QPointF::dotProduct(d, d));
+                normalOut = QPointF(-d.y(), d.x()) / length;
+            }
+            if (i == 0) normalIn = normalOut;
+
+            /* At the joins, extend the offset along the bisector so that
+             * both segments keep their width */
+            QPointF miter = normalIn + normalOut;
+            qreal miterLength = sqrt(QPointF::dotProduct(miter, miter));
+            qreal offset = halfWidth;
+            if (miterLength > 0.0001) {
+                miter /= miterLength;
+                qreal cosine = QPointF::dotProduct(miter, normalOut);
+                offset = qMin(halfWidth / cosine, halfWidth * miterLimit);
+            } else {
+                miter = normalOut;
+            }
+            miter *= offset;
+
+            if (!first && i == 0) {
+                v->set(p.x() + miter.x(), p.y() + miter.y());
+                v++;
+            }
+            v->set(p.x() + miter.x(), p.y() + miter.y());
+            v++;
+            v->set(p.x() - miter.x(), p.y() - miter.y());
+            v++;
+            normalIn = normalOut;
+        }
+        first = false;
+    }
+    markDirty(DirtyGeometry);
+}
+
+void PainterPolylineNode::setPolylines(const QVector<QPolygonF> &polylines)
+{
+    m_path = QPainterPath();
+    Q_FOREACH(const QPolygonF &polyline, polylines) {
+        m_path.addPolygon(polyline);
+    }
+    m_rect = m_path.boundingRect().adjusted(-lineWidth, -lineWidth,
+                                            lineWidth, lineWidth);
+    markDirty(DirtyGeometry);
+}
+
+void PainterPolylineNode::render(const RenderState *state)
+{
+    QSGRendererInterface *rif = m_window->rendererInterface();
+    QPainter *painter = static_cast<QPainter *>(
+        rif->getResource(m_window, QSGRendererInterface::PainterResource));
+    Q_ASSERT(painter);
+
+    painter->setTransform(matrix()->toTransform());
+    painter->setOpacity(inheritedOpacity());
+    const QRegion *clipRegion = state->clipRegion();
+    if (clipRegion && !clipRegion->isEmpty()) {
+        painter->setClipRegion(*clipRegion, Qt::IntersectClip);
+    }
+    painter->setRenderHints(QPainter::Antialiasing, true);
+    painter->setPen(m_pen);
+    painter->setBrush(Qt::NoBrush);
+    painter->drawPath(m_path);
+}
+
+PathNode::PathNode(QQuickWindow *window, int itemId):
+    QSGTransformNode(),
+    m_itemId(itemId),
+    m_zoomLevel(-1),
+    m_opacityNode(new QSGOpacityNode),
+    m_polylineNode(0),
+    m_painterNode(0)
+{
+    appendChildNode(m_opacityNode);
+
+    QSGRendererInterface *rif = window->rendererInterface();
+    if (rif->graphicsApi() == QSGRendererInterface::Software) {
+        m_painterNode = new PainterPolylineNode(window);
+        m_opacityNode->appendChildNode(m_painterNode);
+    } else {
+        m_polylineNode = new PolylineNode;
+        m_opacityNode->appendChildNode(m_polylineNode);
+    }
+}
+
+void PathNode::setPath(const Path &path, int zoomLevel, const QRect &area)
+{
+    QPainterPath painterPath = path.toPainterPath(zoomLevel, area);
+    m_zoomLevel = zoomLevel;
+    m_builtArea = area;
+    m_origin = painterPath.elementCount() > 0 ?
+        QPointF(painterPath.elementAt(0)) : QPointF();
+
+    QVector<QPolygonF> polylines = toPolylines(painterPath, m_origin);
+    if (m_polylineNode) {
+        m_polylineNode->setPolylines(polylines);
+    } else {
+        m_painterNode->setPolylines(polylines);
+    }
+}
+
+void PathNode::setColor(const QColor &color)
+{
+    if (m_polylineNode) {
+        m_polylineNode->setColor(color);
+    } else {
+        m_painterNode->setColor(color);
+    }
+}
+
+void PathNode::updateMatrix(const Point &centerUnits, qreal zoom,
+                            const QPointF &itemCenter)
+{
+    /* Done in doubles: the origin and the center can be far from 0 */
+    qreal scale = exp2(m_zoomLevel - zoom);
+    QPointF translation = m_origin * scale - centerUnits.toPixelF(zoom) +
+        itemCenter;
+
+    QMatrix4x4 matrix;
+    matrix.translate(translation.x(), translation.y());
+    matrix.scale(scale);
+    setMatrix(matrix);
+}
+
 PathItemData::PathItemData(PathItem *pathItem):
+    id(0),
     pathItem(pathItem),
-    pen(pathItem->color(), 4)
+    color(pathItem->color()),
+    pathChanged(true)
 {
-    pen.setCosmetic(true);
 }
 
 void PathLayerPrivate::itemAdded(QQuickItem *item)
@@ -113,6 +402,9 @@ void PathLayerPrivate::itemRemoved(QQuickItem *item)
         QObject::disconnect(pathItem, 0, this, 0);
         QObject::disconnect(pathItem, 0, q, 0);
         items.removeOne(data);
+        delete data;
+        itemsChanged = true;
+        q->update();
         Q_EMIT q->itemsChanged();
     }
 }
@@ -120,13 +412,17 @@ void PathLayerPrivate::itemRemoved(QQuickItem *item)
 void PathLayerPrivate::addPathItem(PathItem *pathItem)
 {
     Q_Q(PathLayer);
-    items.append(new PathItemData(pathItem));
+    PathItemData *data = new PathItemData(pathItem);
+    data->id = ++lastItemId;
+    items.append(data);
+    itemsChanged = true;
     QObject::connect(pathItem, SIGNAL(pathChanged()),
                      this, SLOT(onPathChanged()));
     QObject::connect(pathItem, SIGNAL(colorChanged()),
                      this, SLOT(onPathPenChanged()));
     QObject::connect(pathItem, SIGNAL(opacityChanged()),
                      q, SLOT(update()));
+    q->update();
     Q_EMIT q->itemsChanged();
 }
 
@@ -143,6 +439,18 @@ PathItemData *PathLayerPrivate::pathItemData(const PathItem *item)
     return 0;
 }
 
+QRect PathLayerPrivate::visibleArea() const
+{
+    Q_Q(const PathLayer);
+
+    Map *map = q->map();
+    Point center = map->centerUnits();
+    qreal halfSide = qMax(q->width(), q->height()) / 2 *
+        exp2(map->zoomLevel());
+    return QRect(QPoint(center.x() - halfSide, center.y() - halfSide),
+                 QPoint(center.x() + halfSide, center.y() + halfSide));
+}
+
 void PathLayerPrivate::onPathChanged()
 {
     Q_Q(PathLayer);
@@ -154,7 +462,7 @@ void PathLayerPrivate::onPathChanged()
         return;
     }
 
-    data->painterPath = pathItem->path().toPainterPath(q->map()->zoomLevel());
+    data->pathChanged = true;
     q->update();
 }
 
@@ -169,14 +477,15 @@ void PathLayerPrivate::onPathPenChanged()
         return;
     }
 
-    data->pen = QPen(pathItem->color(), 4);
+    data->color = pathItem->color();
     q->update();
 }
 
 PathLayer::PathLayer(QQuickItem *parent):
-    QQuickPaintedItem(parent),
+    QQuickItem(parent),
     d_ptr(new PathLayerPrivate(this))
 {
+    setFlags(QQuickItem::ItemHasContents);
 }
 
 PathLayer::~PathLayer()
@@ -193,24 +502,64 @@ QQmlListProperty<PathItem> PathLayer::items()
                     PathLayerPrivate::itemClear);
 }
 
-void PathLayer::paint(QPainter *painter)
+QSGNode *PathLayer::updatePaintNode(QSGNode *node, UpdatePaintNodeData *)
 {
-    Q_D(const PathLayer);
-
-    QTransform transformation = painter->transform();
+    Q_D(PathLayer);
 
-    qreal zoom = map()->zoomLevel();
+    if (!node) {
+        node = new QSGNode;
+        d->itemsChanged = true;
+    }
 
-    Point offset = -map()->centerUnits().toPixel(zoom);
-    transformation.translate(offset.x() + width() / 2, offset.y() + height() / 2);
+    if (d->itemsChanged) {
+        /* Keep the nodes of the items which are still there, in the order
+         * of the items; only the new items get a node */
+        QHash<int,PathNode*> pathNodes;
+        while (QSGNode *child = node->firstChild()) {
+            node->removeChildNode(child);
+            PathNode *pathNode = static_cast<PathNode*>(child);
+            pathNodes.insert(pathNode->itemId(), pathNode);
+        }
+        foreach (PathItemData *data, d->items) {
+            PathNode *pathNode = pathNodes.take(data->id);
+            if (!pathNode) {
+                pathNode = new PathNode(window(), data->id);
+                data->pathChanged = true;
+            }
+            node->appendChildNode(pathNode);
+        }
+        qDeleteAll(pathNodes);
+        d->itemsChanged = false;
+    }
 
-    painter->setTransform(transformation);
-    painter->setRenderHints(QPainter::Antialiasing, true);
+    /* The paths are tessellated only when the level of detail changes, or
+     * when the view leaves the area they were built for: panning within it,
+     * and zooming within the same level, just move the nodes. The margin
+     * around the view keeps the cost proportional to what's visible. */
+    qreal zoom = map()->zoomLevel();
+    int zoomLevel = int(zoom);
+    Point centerUnits = map()->centerUnits();
+    QPointF itemCenter(width() / 2, height() / 2);
+    QRect visibleArea = d->visibleArea();
+    QRect buildArea = visibleArea.adjusted(-visibleArea.width() / 2,
+                                           -visibleArea.height() / 2,
+                                           visibleArea.width() / 2,
+                                           visibleArea.height() / 2);
+    QSGNode *child = node->firstChild();
     foreach (PathItemData *data, d->items) {
-        painter->setOpacity(data->pathItem->opacity());
-        painter->setPen(data->pen);
-        painter->drawPath(data->painterPath);
+        PathNode *pathNode = static_cast<PathNode*>(child);
+        if (data->pathChanged || pathNode->zoomLevel() != zoomLevel ||
+            !pathNode->builtArea().contains(visibleArea)) {
+            pathNode->setPath(data->pathItem->path(), zoomLevel, buildArea);
+            data->pathChanged = false;
+        }
+        pathNode->setColor(data->color);
+        pathNode->setOpacity(data->pathItem->opacity());
+        pathNode->updateMatrix(centerUnits, zoom, itemCenter);
+        child = child->nextSibling();
     }
+
+    return node;
 }
 
 void PathLayer::itemChange(ItemChange change, const ItemChangeData &value)
@@ -228,19 +577,6 @@ void PathLayer::itemChange(ItemChange change, const ItemChangeData &value)
 
 void PathLayer::mapEvent(MapEvent *event)
 {
-    Q_D(PathLayer);
-    if (event->zoomLevelChanged() ||
-        event->centerChanged()) {
-        setX(-width() / 2);
-        setY(-height() / 2);
-
-        foreach (PathItemData *data, d->items) {
-            data->painterPath =
-                data->pathItem->path().toPainterPath(map()->zoomLevel());
-        }
-        update();
-    }
-
     if (event->sizeChanged()) {
         QSizeF size = map()->boundingRect().size();
         qreal radius = qMax(size.width(), size.height());
@@ -249,6 +585,14 @@ void PathLayer::mapEvent(MapEvent *event)
         setX(-width() / 2);
         setY(-height() / 2);
     }
+
+    if (event->zoomLevelChanged() ||
+        event->centerChanged() ||
+        event->sizeChanged()) {
+        setX(-width() / 2);
+        setY(-height() / 2);
+        update();
+    }
 }
 
 #include "path-layer.moc"
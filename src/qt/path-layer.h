@@ -22,7 +22,7 @@
 #ifndef MAP_PATH_LAYER_H
 #define MAP_PATH_LAYER_H
 
-#include <QQuickPaintedItem>
+#include <QQuickItem>
 #include "map-object.h"
 
 namespace Mappero {
@@ -31,7 +31,7 @@ class Path;
 class PathItem;
 
 class PathLayerPrivate;
-class PathLayer: public QQuickPaintedItem, MapObject
+class PathLayer: public QQuickItem, MapObject
 {
     Q_OBJECT
     Q_PROPERTY(QQmlListProperty<Mappero::PathItem> items READ items \
@@ -49,7 +49,8 @@ Q_SIGNALS:
 
 protected:
     // reimplemented methods
-    void paint(QPainter *painter) Q_DECL_OVERRIDE;
+    QSGNode *updatePaintNode(QSGNode *node,
+                             UpdatePaintNodeData *) Q_DECL_OVERRIDE;
     void itemChange(ItemChange change,
                     const ItemChangeData &value) Q_DECL_OVERRIDE;
 
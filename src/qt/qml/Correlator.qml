@@ -4,7 +4,7 @@ import QtQuick 2.0
 Item {
     id: root
 
-    property var track
+    property var tracks
     property var selection
 
     property string _fontFamily: "Helvetica"
@@ -12,7 +12,7 @@ Item {
 
     width: 200
     height: controls.height + 2 * controls.anchors.margins
-    visible: !track.empty
+    visible: !tracks.empty
 
     PaneBackground {}
 
@@ -43,7 +43,7 @@ Item {
                 font.family: root._fontFamily
                 font.pointSize: root._fontSize
                 horizontalAlignment: Text.AlignRight
-                text: Qt.formatDateTime(track.startTime, "d/M/yyyy hh:mm")
+                text: Qt.formatDateTime(tracks.startTime, "d/M/yyyy hh:mm")
             }
         }
 
@@ -60,7 +60,7 @@ Item {
                 font.family: root._fontFamily
                 font.pointSize: root._fontSize
                 horizontalAlignment: Text.AlignRight
-                text: Qt.formatDateTime(track.endTime, "d/M/yyyy hh:mm")
+                text: Qt.formatDateTime(tracks.endTime, "d/M/yyyy hh:mm")
             }
         }
 
@@ -80,9 +80,9 @@ Item {
     }
 
     Connections {
-        target: track
-        onTimeOffsetChanged: root.updateItems()
-        onPathChanged: root.updateItems()
+        target: tracks
+        /* Also emitted when the time offset changes */
+        onTracksChanged: root.updateItems()
     }
 
     Connections {
@@ -91,16 +91,20 @@ Item {
     }
 
     function updateOffset() {
-        track.timeOffset = timeZone.value * 3600 + seconds.value
+        tracks.timeOffset = timeZone.value * 3600 + seconds.value
     }
 
     function updateItems() {
-        if (track.empty) return;
-        var l = selection.items.length
+        if (tracks.empty) return;
+        var items = selection.items
+        var l = items.length
+        var times = []
         for (var i = 0; i < l; i++) {
-            var taggable = selection.items[i]
-            var position = track.positionAt(taggable.time)
-            taggable.setCorrelatedLocation(position)
+            times.push(items[i].time)
+        }
+        var positions = tracks.positionsAt(times)
+        for (var i = 0; i < l; i++) {
+            items[i].setCorrelatedLocation(positions[i])
         }
     }
 }
@@ -14,6 +14,46 @@ Item {
         id: layerManager
     }
 
+    TrackCollection {
+        id: tracks
+    }
+
+    Component {
+        id: trackComponent
+        PathItem {
+            color: "red"
+        }
+    }
+
+    TrackImporter {
+        id: trackImporter
+
+        /* The area covered by the tracks loaded in this import */
+        property var area: null
+
+        onBusyChanged: if (busy) area = null
+        onTrackLoaded: {
+            var track = trackComponent.createObject(pathLayer, { "path": path })
+            tracks.addTrack(track)
+            var a = track.itemArea()
+            if (area) {
+                var x = Math.min(area.x, a.x)
+                var y = Math.min(area.y, a.y)
+                var right = Math.max(area.x + area.width, a.x + a.width)
+                var bottom = Math.max(area.y + area.height, a.y + a.height)
+                area = Qt.rect(x, y, right - x, bottom - y)
+            } else {
+                area = a
+                map.lookAt(area, 0, 0, map.width / 4, map.height / 4)
+            }
+        }
+        onFinished: {
+            if (area) {
+                map.lookAt(area, 0, 0, map.width / 4, map.height / 4)
+            }
+        }
+    }
+
     Item {
         id: mapView
         anchors.left: parent.left
@@ -32,6 +72,7 @@ Item {
             flickable: mapFlickable
 
             mainLayer: layerManager.mainLayer
+            overlays: layerManager.overlays
             center: Controller.conf.lastPosition
             requestedZoomLevel: Controller.conf.lastZoomLevel
 
@@ -59,10 +100,7 @@ Item {
             }
 
             PathLayer {
-                PathItem {
-                    id: track
-                    color: "red"
-                }
+                id: pathLayer
             }
 
             PoiView {
@@ -114,10 +152,7 @@ Item {
                 }
             }
 
-            onTrackLoaded: {
-                track.loadFile(filePath)
-                map.lookAt(track.itemArea(), 0, 0, map.width / 4, map.height / 4)
-            }
+            onTracksSelected: trackImporter.importTracks(urls)
 
             onHelp: helpLoader.setSource("Help.qml", {
                     latestVersion: updater.latestVersion
@@ -129,7 +164,7 @@ Item {
             anchors.top: parent.top
             anchors.margins: UI.ToolSpacing
             selection: dropArea.model.selection
-            track: track
+            tracks: tracks
         }
     }
 
@@ -7,35 +7,103 @@ Item {
     property var mainLayer: root.createLayer(mainLayerIndex)
     property int mainLayerIndex: layerModel.find(Controller.conf.lastMainLayer)
     property var model: layerModel
+    property int overlayIndex: overlayModel.find(Controller.conf.lastOverlay)
+    property var overlays: overlayIndex > 0 ?
+        [ root.createOverlay(overlayIndex) ] : []
+    property var overlayModel: overlayModel
 
     property var __currentLayer: null
     property int __currentIndex: -1
+    /* Layers created so far, by index: the map keeps the recently used ones
+     * alive, so that switching back to them is instant. The layers it
+     * deletes remove themselves from here. */
+    property var __layers: ({})
+    /* Overlays are few and cheap to keep, since their tiles are generated */
+    property var __overlays: ({})
 
     TiledMaps {
         id: layerModel
     }
 
+    TiledOverlays {
+        id: overlayModel
+    }
+
     function createLayer(index) {
         if (index != __currentIndex || !__currentLayer) {
             __currentIndex = index
-            __currentLayer = tiledLayer.createObject(root, layerModel.get(index))
+            var layer = __layers[index]
+            if (!layer) {
+                layer = tiledLayer.createObject(root, layerModel.get(index))
+                layer.layerIndex = index
+                __layers[index] = layer
+            }
+            __currentLayer = layer
         }
         return __currentLayer
     }
 
+    function createOverlay(index) {
+        var layer = __overlays[index]
+        if (!layer) {
+            var data = overlayModel.get(index)
+            layer = overlayLayer.createObject(root, {
+                "uid": data.uid,
+                "name": data.name,
+                "minZoom": data.minZoom,
+                "maxZoom": data.maxZoom,
+            })
+            if (data.kind == "grid") {
+                layer.generator = gridGenerator.createObject(layer)
+            } else {
+                layer.generator = hillshadeGenerator.createObject(layer, {
+                    "colorRelief": data.kind == "relief",
+                })
+            }
+            __overlays[index] = layer
+        }
+        return layer
+    }
+
     Component {
         id: tiledLayer
+        TiledLayer {
+            property int layerIndex: -1
+            /* A deleted object stored in a JS object doesn't become null */
+            Component.onDestruction: delete root.__layers[layerIndex]
+        }
+    }
+
+    Component {
+        id: overlayLayer
         TiledLayer {}
     }
 
+    Component {
+        id: gridGenerator
+        GridGenerator {}
+    }
+
+    Component {
+        id: hillshadeGenerator
+        HillshadeGenerator {
+            demDirectory: Controller.conf.demDirectory
+        }
+    }
+
     Connections {
         target: mainWindow
         onClosing: {
             Controller.conf.lastMainLayer = mainLayer.uid
+            Controller.conf.lastOverlay = overlayModel.get(overlayIndex).uid
         }
     }
 
     function setLayer(index) {
         mainLayerIndex = index
     }
+
+    function setOverlay(index) {
+        overlayIndex = index
+    }
 }
@@ -7,11 +7,17 @@ Popup {
     property var manager
 
     minimumWidth: 200
-    minimumHeight: 250
+    minimumHeight: 400
 
     ListView {
         id: view
-        anchors.fill: parent
+        anchors {
+            top: parent.top
+            left: parent.left
+            right: parent.right
+            bottom: overlayView.top
+            bottomMargin: 8
+        }
         clip: true
         spacing: 2
         model: manager.model
@@ -32,4 +38,33 @@ Popup {
             }
         }
     }
+
+    ListView {
+        id: overlayView
+        anchors {
+            left: parent.left
+            right: parent.right
+            bottom: parent.bottom
+        }
+        height: count * (UI.PaneButtonHeight + spacing)
+        interactive: false
+        spacing: 2
+        model: manager.overlayModel
+        currentIndex: manager.overlayIndex
+        onCurrentIndexChanged: manager.setOverlay(currentIndex)
+        delegate: Rectangle {
+            width: overlayView.width
+            height: UI.PaneButtonHeight
+            radius: height / 3
+            color: ListView.isCurrentItem ? "#d0dfdf" : "#eee"
+            Text {
+                anchors.centerIn: parent
+                text: model.name
+            }
+            MouseArea {
+                anchors.fill: parent
+                onClicked: { overlayView.currentIndex = index; root.close() }
+            }
+        }
+    }
 }
@@ -35,6 +35,7 @@ Item {
         flickable: mapFlickable
 
         mainLayer: layerManager.mainLayer
+        overlays: layerManager.overlays
         center: Controller.conf.lastPosition
         requestedZoomLevel: Controller.conf.lastZoomLevel
         followGps: visible
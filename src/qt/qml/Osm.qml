@@ -1,5 +1,6 @@
 import QtQuick 2.0
 import QtQuick.Window 2.1
+import Mappero 1.0
 import Mappero.Ui 1.0
 import "UIConstants.js" as UI
 
@@ -13,6 +14,10 @@ Item {
     property var searchBox
     property var router
 
+    /* Kept here, so that downloads survive closing the panes */
+    TilePrefetcher { id: trackPrefetcher }
+    TilePrefetcher { id: routePrefetcher }
+
     states: [
         State {
             name: "allHidden"
@@ -81,6 +86,8 @@ Item {
             onClicked: {
                 trackPane.setSource("OsmPathItem.qml", {
                     "path": tracker,
+                    "layer": map.mainLayer,
+                    "prefetcher": trackPrefetcher,
                 })
                 trackPane.item.open()
             }
@@ -95,6 +102,8 @@ Item {
             onClicked: {
                 routePane.setSource("OsmPathItem.qml", {
                     "path": route,
+                    "layer": map.mainLayer,
+                    "prefetcher": routePrefetcher,
                 })
                 routePane.item.open()
             }
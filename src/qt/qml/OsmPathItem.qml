@@ -6,6 +6,16 @@ Pane {
     id: pane
 
     property var path
+    property var layer
+    property var prefetcher
+
+    Component.onCompleted: {
+        /* The tracker's path grows with every fix: take a snapshot */
+        if (prefetcher.running || path.empty || !layer) return
+        prefetcher.layer = layer
+        prefetcher.path = path.path
+        prefetcher.estimate()
+    }
 
     Column {
         width: 400
@@ -28,6 +38,30 @@ Pane {
             enabled: !path.empty
             onClicked: { path.clear(); pane.close() }
         }
+        MenuButton {
+            text: prefetcher.running ?
+                "Stop downloading map" : "Download map along path"
+            enabled: prefetcher.running || (!path.empty && !!layer)
+            onClicked: {
+                if (prefetcher.running) {
+                    prefetcher.cancel()
+                } else {
+                    prefetcher.layer = layer
+                    prefetcher.path = path.path
+                    prefetcher.start()
+                }
+            }
+        }
+        Text {
+            anchors.horizontalCenter: parent.horizontalCenter
+            visible: prefetcher.estimating || prefetcher.tileCount > 0
+            text: prefetcher.estimating ? "Counting tiles..." :
+                prefetcher.tileCount + " tiles, about " +
+                (prefetcher.estimatedSize / 1048576).toFixed(1) + " MB" +
+                (prefetcher.running || prefetcher.doneCount > 0 ?
+                 " (" + Math.round(prefetcher.progress * 100) + "% done)" :
+                 "")
+        }
     }
 
     resources: [
@@ -49,7 +83,7 @@ Pane {
             id: fileChooserLoad
             title: "Choose a file"
             fileMode: FileDialog.OpenFile
-            nameFilters: [ "Tracks (*.gpx *.kml)" ]
+            nameFilters: [ "Tracks (*.gpx *.kml *.mtrk)" ]
 
             onFolderChanged: { console.log("Folder changed: " + folder) }
             onAccepted: {
@@ -0,0 +1,45 @@
+import QtQuick 2.0
+
+ListModel {
+    id: root
+
+    ListElement {
+        uid: ""
+        name: "No overlay"
+        kind: ""
+        minZoom: 0
+        maxZoom: 0
+    }
+
+    ListElement {
+        uid: "Hillshade"
+        name: "Hillshade"
+        kind: "hillshade"
+        minZoom: 3
+        maxZoom: 15
+    }
+
+    ListElement {
+        uid: "ColorRelief"
+        name: "Colour relief"
+        kind: "relief"
+        minZoom: 3
+        maxZoom: 15
+    }
+
+    ListElement {
+        uid: "Grid"
+        name: "Coordinate grid"
+        kind: "grid"
+        minZoom: 1
+        maxZoom: 19
+    }
+
+    function find(uid) {
+        var l = root.count
+        for (var i = 0; i < l; i++) {
+            if (root.get(i).uid == uid) return i
+        }
+        return 0
+    }
+}
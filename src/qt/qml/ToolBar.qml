@@ -9,7 +9,7 @@ Item {
     property var selection
 
     signal geoSetterDropped(var pos)
-    signal trackLoaded(url filePath)
+    signal tracksSelected(var urls)
     signal help()
 
     width: row.width + 2 * UI.ToolbarMargins
@@ -59,7 +59,7 @@ Item {
         }
 
         ImageButton {
-            property string toolTip: qsTr("Open a GPX track")
+            property string toolTip: qsTr("Open GPX tracks (or drop track files and folders here)")
 
             width: UI.TaggableToolsSize
             height: UI.TaggableToolsSize
@@ -69,10 +69,21 @@ Item {
 
             FileDialog {
                 id: fileChooserLoad
-                title: "Choose a file"
-                nameFilters: [ "GPS tracks (*.gpx *.kml)", "All files (*.*)" ]
+                title: "Choose the track files"
+                fileMode: FileDialog.OpenFiles
+                nameFilters: [ "GPS tracks (*.gpx *.kml *.mtrk)", "All files (*.*)" ]
 
-                onAccepted: root.trackLoaded(file)
+                onAccepted: root.tracksSelected(files)
+            }
+
+            DropArea {
+                anchors.fill: parent
+                keys: [ "text/uri-list" ]
+                onDropped: {
+                    if (!drop.hasUrls) return
+                    drop.acceptProposedAction()
+                    root.tracksSelected(drop.urls)
+                }
             }
         }
 
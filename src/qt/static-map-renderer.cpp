@@ -0,0 +1,388 @@
+/* vi: set et sw=4 ts=4 cino=t0,(0: */
+/* -*- Mode: C; indent-tabs-mode: nil; c-basic-offset: 4; tab-width: 4 -*- */
+/*
+ * Copyright (C) 2020 Alberto Mardegan <mardy@users.sourceforge.net>
+ *
+ * This file is part of Mappero.
+ *
+ * Mappero is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Mappero is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Mappero.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "controller.h"
+#include "debug.h"
+#include "static-map-renderer.h"
+#include "tile-download.h"
+#include "tile-grid.h"
+#include "tiled-layer.h"
+
+#include <Mappero/Projection>
+#include <QEventLoop>
+#include <QHash>
+#include <QList>
+#include <QPainter>
+#include <QPair>
+#include <QPolygonF>
+#include <QRunnable>
+#include <QThreadPool>
+#include <QTimer>
+#include <string.h>
+
+using namespace Mappero;
+
+namespace Mappero {
+
+/* Copies a tile into the canvas. Tiles never overlap, so several of these
+ * can write into the same canvas at the same time. */
+class TileStitcher: public QRunnable
+{
+public:
+    TileStitcher(const QImage &tile, const QList<QPoint> &positions,
+                 uchar *bits, int bytesPerLine, const QSize &canvasSize):
+        tile(tile), positions(positions), bits(bits),
+        bytesPerLine(bytesPerLine), canvasSize(canvasSize) {}
+
+    // reimplemented virtual method
+    void run();
+
+private:
+    QImage tile;
+    QList<QPoint> positions;
+    uchar *bits;
+    int bytesPerLine;
+    QSize canvasSize;
+};
+
+typedef QPair<Path,QPen> PathOverlay;
+typedef QPair<GeoPoint,QColor> MarkerOverlay;
+
+class StaticMapRendererPrivate: public QObject
+{
+    Q_OBJECT
+    Q_DECLARE_PUBLIC(StaticMapRenderer)
+
+    StaticMapRendererPrivate(StaticMapRenderer *q);
+
+    void unitArea(Point *topLeft, Point *bottomRight) const;
+    void drawOverlays(QPainter &painter, const Point &origin) const;
+
+private Q_SLOTS:
+    void onTileDownloaded(const TileSpec &tileSpec, TileContents tileContents);
+
+private:
+    mutable StaticMapRenderer *q_ptr;
+    TiledLayer *layer;
+    GeoPoint corner1;
+    GeoPoint corner2;
+    int zoomLevel;
+    int timeout;
+    QColor backgroundColor;
+    QList<PathOverlay> paths;
+    QList<MarkerOverlay> markers;
+
+    /* While rendering: where each of the tiles we wait for goes */
+    QHash<TileSpec,QList<QPoint> > pendingTiles;
+    QImage canvas;
+    uchar *canvasBits;
+    int missingTiles;
+    QEventLoop *loop;
+    QThreadPool pool;
+};
+
+}; // namespace
+
+void TileStitcher::run()
+{
+    QImage source = tile;
+    if (source.size() != QSize(TILE_SIZE_PIXELS, TILE_SIZE_PIXELS)) {
+        source = source.scaled(TILE_SIZE_PIXELS, TILE_SIZE_PIXELS,
+                               Qt::IgnoreAspectRatio,
+                               Qt::SmoothTransformation);
+    }
+    if (source.format() != QImage::Format_ARGB32_Premultiplied) {
+        source = source.convertToFormat(QImage::Format_ARGB32_Premultiplied);
+    }
+
+    QRect canvasRect(QPoint(0, 0), canvasSize);
+    Q_FOREACH(const QPoint &position, positions) {
+        QRect target = QRect(position, source.size()).intersected(canvasRect);
+        if (target.isEmpty()) continue;
+
+        int offset = (target.left() - position.x()) * 4;
+        for (int y = target.top(); y <= target.bottom(); y++) {
+            memcpy(bits + y * bytesPerLine + target.left() * 4,
+                   source.constScanLine(y - position.y()) + offset,
+                   target.width() * 4);
+        }
+    }
+}
+
+StaticMapRendererPrivate::StaticMapRendererPrivate(StaticMapRenderer *q):
+    QObject(),
+    q_ptr(q),
+    layer(0),
+    zoomLevel(MAX_ZOOM - 16),
+    timeout(30000),
+    backgroundColor(0xe0, 0xe0, 0xe0),
+    canvasBits(0),
+    missingTiles(0),
+    loop(0)
+{
+}
+
+void StaticMapRendererPrivate::unitArea(Point *topLeft,
+                                        Point *bottomRight) const
+{
+    const Projection *projection = layer->projection();
+    Point p1 = projection->geoToUnit(corner1);
+    Point p2 = projection->geoToUnit(corner2);
+    *topLeft = Point(qMin(p1.x(), p2.x()), qMin(p1.y(), p2.y()));
+    *bottomRight = Point(qMax(p1.x(), p2.x()), qMax(p1.y(), p2.y()));
+}
+
+void StaticMapRendererPrivate::drawOverlays(QPainter &painter,
+                                            const Point &origin) const
+{
+    qreal unitsPerPixel = 1 << zoomLevel;
+
+    painter.setBrush(Qt::NoBrush);
+    Q_FOREACH(const PathOverlay &overlay, paths) {
+        painter.setPen(overlay.second);
+        Q_FOREACH(const QPolygon &polyline, overlay.first.toUnitPolylines()) {
+            QPolygonF points;
+            points.reserve(polyline.count());
+            Q_FOREACH(const QPoint &unit, polyline) {
+                points.append(QPointF(unit - origin) / unitsPerPixel);
+            }
+            painter.drawPolyline(points);
+        }
+    }
+
+    const Projection *projection = layer->projection();
+    painter.setPen(QPen(Qt::white, 2));
+    Q_FOREACH(const MarkerOverlay &marker, markers) {
+        Point unit = projection->geoToUnit(marker.first);
+        painter.setBrush(marker.second);
+        painter.drawEllipse(QPointF(unit - origin) / unitsPerPixel, 6, 6);
+    }
+}
+
+void StaticMapRendererPrivate::onTileDownloaded(const TileSpec &tileSpec,
+                                                TileContents tileContents)
+{
+    QHash<TileSpec,QList<QPoint> >::iterator i =
+        pendingTiles.find(tileSpec);
+    if (i == pendingTiles.end()) return;
+
+    if (tileContents.image.isNull()) {
+        DEBUG() << "Missing tile" << tileSpec;
+        missingTiles++;
+    } else {
+        pool.start(new TileStitcher(tileContents.image, i.value(),
+                                    canvasBits, canvas.bytesPerLine(),
+                                    canvas.size()));
+    }
+    pendingTiles.erase(i);
+
+    if (pendingTiles.isEmpty() && loop) loop->quit();
+}
+
+StaticMapRenderer::StaticMapRenderer(QObject *parent):
+    QObject(parent),
+    d_ptr(new StaticMapRendererPrivate(this))
+{
+}
+
+StaticMapRenderer::~StaticMapRenderer()
+{
+    delete d_ptr;
+}
+
+void StaticMapRenderer::setLayer(TiledLayer *layer)
+{
+    Q_D(StaticMapRenderer);
+    d->layer = layer;
+}
+
+TiledLayer *StaticMapRenderer::layer() const
+{
+    Q_D(const StaticMapRenderer);
+    return d->layer;
+}
+
+void StaticMapRenderer::setArea(const GeoPoint &corner1,
+                                const GeoPoint &corner2)
+{
+    Q_D(StaticMapRenderer);
+    d->corner1 = corner1;
+    d->corner2 = corner2;
+}
+
+void StaticMapRenderer::setZoomLevel(int zoom)
+{
+    Q_D(StaticMapRenderer);
+    d->zoomLevel = qBound(MIN_ZOOM, zoom, MAX_ZOOM);
+}
+
+int StaticMapRenderer::zoomLevel() const
+{
+    Q_D(const StaticMapRenderer);
+    return d->zoomLevel;
+}
+
+void StaticMapRenderer::setTimeout(int ms)
+{
+    Q_D(StaticMapRenderer);
+    d->timeout = ms;
+}
+
+int StaticMapRenderer::timeout() const
+{
+    Q_D(const StaticMapRenderer);
+    return d->timeout;
+}
+
+void StaticMapRenderer::setBackgroundColor(const QColor &color)
+{
+    Q_D(StaticMapRenderer);
+    d->backgroundColor = color;
+}
+
+QColor StaticMapRenderer::backgroundColor() const
+{
+    Q_D(const StaticMapRenderer);
+    return d->backgroundColor;
+}
+
+void StaticMapRenderer::addPath(const Path &path, const QPen &pen)
+{
+    Q_D(StaticMapRenderer);
+    d->paths.append(PathOverlay(path, pen));
+}
+
+void StaticMapRenderer::addMarker(const GeoPoint &position,
+                                  const QColor &color)
+{
+    Q_D(StaticMapRenderer);
+    d->markers.append(MarkerOverlay(position, color));
+}
+
+void StaticMapRenderer::clearOverlays()
+{
+    Q_D(StaticMapRenderer);
+    d->paths.clear();
+    d->markers.clear();
+}
+
+QSize StaticMapRenderer::imageSize() const
+{
+    Q_D(const StaticMapRenderer);
+
+    if (!d->layer || !d->corner1.isValid() || !d->corner2.isValid())
+        return QSize();
+
+    Point topLeft, bottomRight;
+    d->unitArea(&topLeft, &bottomRight);
+    return QSize((bottomRight.x() - topLeft.x()) >> d->zoomLevel,
+                 (bottomRight.y() - topLeft.y()) >> d->zoomLevel);
+}
+
+QImage StaticMapRenderer::render()
+{
+    Q_D(StaticMapRenderer);
+
+    if (Q_UNLIKELY(!d->layer || d->layer->id().isEmpty())) {
+        qWarning() << "StaticMapRenderer: no valid layer set";
+        return QImage();
+    }
+
+    QSize size = imageSize();
+    if (size.isEmpty()) return QImage();
+
+    Point topLeft, bottomRight;
+    d->unitArea(&topLeft, &bottomRight);
+
+    d->canvas = QImage(size, QImage::Format_ARGB32_Premultiplied);
+    d->canvas.fill(d->backgroundColor);
+    d->canvasBits = d->canvas.bits();
+    d->missingTiles = 0;
+
+    TileGrid grid = TileGrid::covering(topLeft, bottomRight, d->zoomLevel);
+    QPoint centerTile = (grid.start() + grid.stop()) / 2;
+    TileDownload *tileDownload = Controller::instance()->tileDownload();
+    QObject::connect(tileDownload,
+                     SIGNAL(tileDownloaded(const TileSpec &,TileContents)),
+                     d,
+                     SLOT(onTileDownloaded(const TileSpec &,TileContents)));
+
+    tileDownload->beginBatch();
+    for (int tx = grid.start().x(); tx <= grid.stop().x(); tx++) {
+        for (int ty = grid.start().y(); ty <= grid.stop().y(); ty++) {
+            TileSpec tileSpec = grid.spec(tx, ty, d->layer->id());
+            QPoint position = grid.position(tx, ty, topLeft, d->zoomLevel);
+
+            /* An area wider than the world shows some tiles twice */
+            QHash<TileSpec,QList<QPoint> >::iterator i =
+                d->pendingTiles.find(tileSpec);
+            if (i != d->pendingTiles.end()) {
+                i.value().append(position);
+                continue;
+            }
+            d->pendingTiles.insert(tileSpec, QList<QPoint>() << position);
+            tileDownload->requestTile(tileSpec,
+                TileGrid::distance(tx, ty, centerTile) * 16);
+        }
+    }
+    tileDownload->endBatch();
+
+    if (!d->pendingTiles.isEmpty()) {
+        QEventLoop loop;
+        QTimer timer;
+        timer.setSingleShot(true);
+        QObject::connect(&timer, SIGNAL(timeout()), &loop, SLOT(quit()));
+        timer.start(d->timeout);
+        d->loop = &loop;
+        loop.exec();
+        d->loop = 0;
+    }
+
+    QObject::disconnect(tileDownload,
+                        SIGNAL(tileDownloaded(const TileSpec &,TileContents)),
+                        d,
+                        SLOT(onTileDownloaded(const TileSpec &,TileContents)));
+    if (!d->pendingTiles.isEmpty()) {
+        qWarning() << "Timed out waiting for" << d->pendingTiles.count() <<
+            "tiles";
+        d->missingTiles += d->pendingTiles.count();
+        d->pendingTiles.clear();
+    }
+    d->pool.waitForDone();
+
+    QPainter painter(&d->canvas);
+    painter.setRenderHint(QPainter::Antialiasing);
+    d->drawOverlays(painter, topLeft);
+    painter.end();
+
+    QImage image = d->canvas;
+    d->canvas = QImage();
+    d->canvasBits = 0;
+    return image;
+}
+
+int StaticMapRenderer::missingTiles() const
+{
+    Q_D(const StaticMapRenderer);
+    return d->missingTiles;
+}
+
+#include "static-map-renderer.moc"
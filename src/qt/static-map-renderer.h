@@ -0,0 +1,83 @@
+/* vi: set et sw=4 ts=4 cino=t0,(0: */
+/* -*- Mode: C; indent-tabs-mode: nil; c-basic-offset: 4; tab-width: 4 -*- */
+/*
+ * Copyright (C) 2020 Alberto Mardegan <mardy@users.sourceforge.net>
+ *
+ * This file is part of Mappero.
+ *
+ * Mappero is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Mappero is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Mappero.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef MAP_STATIC_MAP_RENDERER_H
+#define MAP_STATIC_MAP_RENDERER_H
+
+#include <Mappero/Path>
+#include <QColor>
+#include <QImage>
+#include <QObject>
+#include <QPen>
+
+namespace Mappero {
+
+class TiledLayer;
+
+/* Renders an area of a tiled layer into an image, with paths and markers
+ * drawn over it. No window is needed, so that it can be used from command
+ * line tools; tiles are taken from the disk cache, or downloaded. */
+class StaticMapRendererPrivate;
+class StaticMapRenderer: public QObject
+{
+    Q_OBJECT
+
+public:
+    StaticMapRenderer(QObject *parent = 0);
+    ~StaticMapRenderer();
+
+    void setLayer(TiledLayer *layer);
+    TiledLayer *layer() const;
+
+    /* The area between two opposite corners */
+    void setArea(const GeoPoint &corner1, const GeoPoint &corner2);
+
+    /* Map zoom level (0 is the most detailed) */
+    void setZoomLevel(int zoom);
+    int zoomLevel() const;
+
+    /* How long to wait for the missing tiles, in milliseconds */
+    void setTimeout(int ms);
+    int timeout() const;
+
+    void setBackgroundColor(const QColor &color);
+    QColor backgroundColor() const;
+
+    void addPath(const Path &path, const QPen &pen);
+    void addMarker(const GeoPoint &position, const QColor &color);
+    void clearOverlays();
+
+    QSize imageSize() const;
+
+    /* Blocks until all the tiles have been fetched, or the timeout has
+     * expired; tiles are decoded and stitched on all the available cores */
+    QImage render();
+    /* The number of tiles which could not be drawn by the last render() */
+    int missingTiles() const;
+
+private:
+    StaticMapRendererPrivate *d_ptr;
+    Q_DECLARE_PRIVATE(StaticMapRenderer)
+};
+
+}; // namespace
+
+#endif /* MAP_STATIC_MAP_RENDERER_H */
@@ -26,8 +26,9 @@
 #include "tile.h"
 #include "tiled-layer.h"
 
+#include <QHash>
 #include <QPixmap>
-#include <QQueue>
+#include <list>
 
 using namespace Mappero;
 
@@ -42,7 +43,10 @@ struct TileData
     Tile *tile;
 };
 
-typedef QQueue<TileData> TileQueue;
+/* Least recently used first; the index finds a tile's position in the
+ * queue without walking it */
+typedef std::list<TileData> TileQueue;
+typedef QHash<TileSpec, TileQueue::iterator> TileIndex;
 
 class TileCachePrivate: public QObject
 {
@@ -66,57 +70,55 @@ private:
     mutable TileCache *q_ptr;
     int maxSize;
     TileQueue tiles;
+    TileIndex index;
 };
 
-inline bool operator==(const TileData &t1, const TileData &t2)
-{
-    return t1.spec == t2.spec;
-}
-
 } // namespace
 
 Tile *TileCachePrivate::tile(const TileSpec &tileSpec, bool *found)
 {
-    TileData tileData(tileSpec);
-
-    int idx = tiles.indexOf(tileData);
-    if (idx >= 0) {
+    TileIndex::iterator i = index.find(tileSpec);
+    if (i != index.end()) {
         /* return this tile, after repositioning it at the end of the queue */
-        tileData = tiles.takeAt(idx);
+        tiles.splice(tiles.end(), tiles, i.value());
         *found = true;
-    } else {
-        /* We didn't find the tile; see if we are allowed to allocate a new
-         * one, otherwise just return the first one of the queue, so it will be
-         * reused */
-        TiledLayer *layer =
-            qobject_cast<TiledLayer*>(Layer::find(tileData.spec.layerId));
-        if (Q_UNLIKELY(!layer)) {
-            *found = false;
-            return 0;
-        }
+        return tiles.back().tile;
+    }
 
-        if (tiles.count() < maxSize) {
-            tileData.tile = new Tile(layer);
-            QObject::connect(tileData.tile, SIGNAL(destroyed()),
-                             this, SLOT(onTileDestroyed()));
-        } else {
-            tileData.tile = tiles.head().tile;
-            tileData.tile->setImage(QImage());
-            tileData.tile->setParentItem(layer);
-            tiles.dequeue();
-        }
+    /* We didn't find the tile; see if we are allowed to allocate a new
+     * one, otherwise just reuse the first one of the queue */
+    TiledLayer *layer =
+        qobject_cast<TiledLayer*>(Layer::find(tileSpec.layerId));
+    if (Q_UNLIKELY(!layer)) {
         *found = false;
+        return 0;
+    }
+
+    Tile *tile;
+    if (int(tiles.size()) < maxSize) {
+        tile = new Tile(layer);
+        QObject::connect(tile, SIGNAL(destroyed()),
+                         this, SLOT(onTileDestroyed()));
+    } else {
+        tile = tiles.front().tile;
+        tile->setImage(QImage());
+        tile->setParentItem(layer);
+        index.remove(tiles.front().spec);
+        tiles.pop_front();
     }
-    tiles.enqueue(tileData);
-    return tileData.tile;
+    *found = false;
+    tiles.push_back(TileData(tileSpec, tile));
+    index.insert(tileSpec, --tiles.end());
+    return tile;
 }
 
 void TileCachePrivate::onTileDestroyed()
 {
     Tile *tile = reinterpret_cast<Tile*>(sender());
-    Q_FOREACH(const TileData &tileData, tiles) {
-        if (tileData.tile == tile) {
-            tiles.removeOne(tileData);
+    for (TileQueue::iterator i = tiles.begin(); i != tiles.end(); i++) {
+        if (i->tile == tile) {
+            index.remove(i->spec);
+            tiles.erase(i);
             break;
         }
     }
@@ -150,9 +152,8 @@ Tile *TileCache::find(const TileSpec &tileSpec) const
 {
     Q_D(const TileCache);
 
-    TileData tileData(tileSpec);
-    int idx = d->tiles.indexOf(tileData);
-    return idx >= 0 ? d->tiles[idx].tile : 0;
+    TileIndex::const_iterator i = d->index.find(tileSpec);
+    return i != d->index.end() ? i.value()->tile : 0;
 }
 
 #include "tile-cache.moc"
@@ -21,14 +21,24 @@
 #ifdef HAVE_CONFIG_H
 #   include "config.h"
 #endif
+#include "configuration.h"
+#include "controller.h"
 #include "debug.h"
 #include "tile-download.h"
+#include "tile-generator.h"
+#include "tile-transcoder.h"
 #include "tiled-layer.h"
 
+#include <QBuffer>
+#include <QCache>
+#include <QCryptographicHash>
 #include <QDir>
+#include <QDirIterator>
+#include <QElapsedTimer>
 #include <QEventLoop>
 #include <QFile>
 #include <QFileInfo>
+#include <QHash>
 #include <QMap>
 #include <QMutex>
 #include <QNetworkAccessManager>
@@ -36,12 +46,26 @@
 #include <QNetworkReply>
 #include <QNetworkRequest>
 #include <QNetworkSession>
+#include <QQmlNetworkAccessManagerFactory>
 #include <QRunnable>
+#include <QSaveFile>
+#include <QSet>
+#include <QSharedPointer>
+#include <QStringBuilder>
 #include <QThreadPool>
+#include <QTimer>
 #include <QUrl>
+#ifdef Q_OS_UNIX
+#include <stdio.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
 using namespace Mappero;
 
+/* How many blobs may be left unused before we look for them */
+static const int blobPruneThreshold = 256;
+
 namespace Mappero {
 
 struct TileTask
@@ -50,17 +74,35 @@ struct TileTask
     TileSpec spec;
     QString fileName;
     QUrl url;
+    TileTranscoder transcoder;
+    /* Don't download the tile, just read it from the disk cache */
+    bool cacheOnly;
+    /* Just store the tile in the disk cache, without decoding it */
+    bool prefetchOnly;
+    /* For generated tiles */
+    QSharedPointer<const TileRenderer> renderer;
+    const Projection *projection;
 
-    TileTask(): priority(0), spec(0, 0, 0, 0) {}
+    TileTask(): priority(0), spec(0, 0, 0, 0), cacheOnly(false),
+        prefetchOnly(false), projection(0) {}
     TileTask(const TileSpec &spec, int priority):
         priority(priority),
-        spec(spec)
+        spec(spec),
+        cacheOnly(false),
+        prefetchOnly(false),
+        projection(0)
     {
         TiledLayer *layer =
             qobject_cast<TiledLayer*>(Layer::find(spec.layerId));
         if (Q_LIKELY(layer)) {
             fileName = layer->tileFileName(spec.zoom, spec.x, spec.y);
-            url = layer->urlForTile(spec.zoom, spec.x, spec.y);
+            transcoder = layer->tileTranscoder();
+            if (layer->generator()) {
+                renderer = layer->generator()->renderer();
+                projection = layer->projection();
+            } else {
+                url = layer->urlForTile(spec.zoom, spec.x, spec.y);
+            }
         }
     }
     ~TileTask() {}
@@ -76,10 +118,17 @@ struct TaskData
 
     Status status;
     TileContents tileContents;
+    /* Whether the tile is now in the disk cache (or about to be written) */
+    bool cached;
+    /* If the tile was requested again while being prefetched, the priority
+     * of that request; -1 otherwise */
+    int requeuePriority;
 
     TaskData():
         status(Queued),
-        tileContents()
+        tileContents(),
+        cached(false),
+        requeuePriority(-1)
     {}
 };
 
@@ -103,11 +152,161 @@ inline bool operator<(const TileTask &t1, const TileTask &t2)
     return t1.spec.layerId < t2.spec.layerId;
 }
 
+/* Identical tiles (sea, empty land, blank overlays) are very common: this
+ * cache, keyed by the hash of the encoded tile, lets them share a single
+ * decoded image. Only hashes which have been seen at least twice get their
+ * image stored, so that unique tiles don't take up space here. */
+class DecodedImageCache
+{
+public:
+    DecodedImageCache(): images(8 * 1024) {}
+
+    bool find(const QByteArray &hash, QImage *image);
+    void insert(const QByteArray &hash, const QImage &image);
+
+private:
+    QMutex mutex;
+    QSet<QByteArray> seenHashes;
+    QCache<QByteArray,QImage> images; // cost is in KiB
+};
+
+/* Tiles waiting to be written to the disk cache. Persisting a tile
+ * (transcoding it, creating its directories, writing it) is done by a single
+ * writer thread, so that the download threads can move on to the next tile
+ * right away; until a tile is on disk, its image can be read from here. */
+class TileWriteQueue
+{
+public:
+    struct Entry {
+        Entry(): serial(0) {}
+        QImage image;
+        QByteArray data;
+        QByteArray hash;
+        TileTranscoder transcoder;
+        quint64 serial;
+    };
+
+    TileWriteQueue(const QString &blobDir);
+    ~TileWriteQueue();
+
+    void enqueue(const QString &fileName, const Entry &entry);
+    bool find(const QString &fileName, QImage *image, QByteArray *data);
+
+    void writeAll();
+
+private:
+    void makeDir(const QString &path);
+    bool writeFile(const QString &fileName, const QByteArray &data);
+    void write(const QString &fileName, const Entry &entry);
+    void pruneBlobs();
+
+private:
+    QString blobDir;
+    QMutex mutex;
+    QHash<QString,Entry> pending;
+    QStringList queue;
+    quint64 lastSerial;
+    bool writerRunning;
+    QSet<QString> knownDirs; // only used by the writer thread
+    int orphanedBlobs; // only used by the writer thread
+    QThreadPool pool;
+};
+
+/* Keeps a running average of the latency and of the throughput of the tile
+ * downloads. Since several tiles are downloaded in parallel, the throughput
+ * is the one seen by each tile, not the capacity of the link: that's what
+ * tells how long the user has to wait for a tile. */
+class NetworkMeter
+{
+public:
+    enum Speed {
+        Unknown = 0,
+        Fast,
+        Slow,
+        VerySlow,
+    };
+
+    NetworkMeter(): latency(0), throughput(-1), samples(0) {}
+
+    void addSample(qint64 latencyMs, qint64 transferMs, qint64 bytes);
+    Speed speed() const;
+
+private:
+    mutable QMutex mutex;
+    qreal latency; // ms, till the reply headers arrive
+    qreal throughput; // bytes per second, negative if unknown
+    int samples;
+};
+
+/* Tiles read in advance (at startup) which haven't been requested yet */
+class PreloadedTiles
+{
+public:
+    PreloadedTiles(): images(24 * 1024) {}
+
+    void insert(const QString &fileName, const QImage &image);
+    bool take(const QString &fileName, QImage *image);
+    void clear();
+
+private:
+    QMutex mutex;
+    QCache<QString,QImage> images; // cost is in KiB
+};
+
+/* Decodes tiles, sharing the images of identical tiles */
+class TileDecoder
+{
+public:
+    TileDecoder(DecodedImageCache &imageCache, QImage::Format opaqueFormat):
+        imageCache(imageCache), opaqueFormat(opaqueFormat) {}
+
+    QImage loadTile(QFile &tileFile);
+    QImage decodeTile(const uchar *data, int size, const QByteArray &hash);
+    /* For tiles which don't need decoding */
+    QImage shareImage(const QImage &image, const QByteArray &hash);
+
+private:
+    DecodedImageCache &imageCache;
+    QImage::Format opaqueFormat;
+};
+
+class Preloader: public QRunnable
+{
+public:
+    Preloader(const QStringList &fileNames, const TileDecoder &decoder,
+              PreloadedTiles &preloaded):
+        fileNames(fileNames), decoder(decoder), preloaded(preloaded) {}
+
+    // reimplemented virtual method
+    void run();
+
+private:
+    QStringList fileNames;
+    TileDecoder decoder;
+    PreloadedTiles &preloaded;
+};
+
+class TileWriter: public QRunnable
+{
+public:
+    TileWriter(TileWriteQueue &writeQueue): writeQueue(writeQueue) {}
+    void run() { writeQueue.writeAll(); }
+
+private:
+    TileWriteQueue &writeQueue;
+};
+
 class Downloader: public QRunnable
 {
 public:
     Downloader(TaskMap &tasks, QMutex &mutex,
                QNetworkConfigurationManager *ncm,
+               QQmlNetworkAccessManagerFactory *namFactory,
+               QImage::Format opaqueFormat,
+               DecodedImageCache &imageCache,
+               TileWriteQueue &writeQueue,
+               PreloadedTiles &preloaded,
+               NetworkMeter &meter,
                QObject *listener);
     ~Downloader();
 
@@ -117,11 +316,17 @@ public:
 private:
     void processTask(const TileTask &tile);
     QByteArray downloadTile(const TileTask &tile);
+    QByteArray generateTile(const TileTask &tile, QImage *image);
 
 private:
     TaskMap &tasks;
     QMutex &mutex;
     QNetworkConfigurationManager *ncm;
+    QQmlNetworkAccessManagerFactory *namFactory;
+    TileDecoder decoder;
+    TileWriteQueue &writeQueue;
+    PreloadedTiles &preloaded;
+    NetworkMeter &meter;
     QObject *listener;
     QNetworkAccessManager *networkAccessManager;
 };
@@ -134,19 +339,33 @@ class TileDownloadPrivate: public QObject
     inline TileDownloadPrivate(TileDownload *tileDownload);
     ~TileDownloadPrivate() {};
 
+    static QString blobDir();
+
 public Q_SLOTS:
     void taskCompleted(const TileTask &t);
+    void dropPreloadedTiles() { preloaded.clear(); }
 
 private:
     void requestTile(const TileTask &task);
+    void startDownloaders();
 
 private:
     mutable TileDownload *q_ptr;
     bool networkRequested;
+    int batchLevel;
     TaskMap tasks;
+    /* The priority each queued tile has been requested with */
+    QHash<TileSpec,int> taskPriorities;
     QMutex tasksMutex;
     QThreadPool *pool;
     QNetworkConfigurationManager ncm;
+    QQmlNetworkAccessManagerFactory *namFactory;
+    QImage::Format opaqueFormat;
+    DecodedImageCache imageCache;
+    TileWriteQueue writeQueue;
+    PreloadedTiles preloaded;
+    NetworkMeter meter;
+    TileDownload::DataSaver dataSaver;
 };
 }; // namespace
 
@@ -155,7 +374,12 @@ Q_DECLARE_METATYPE(Mappero::TileTask)
 TileDownloadPrivate::TileDownloadPrivate(TileDownload *tileDownload):
     QObject(tileDownload),
     q_ptr(tileDownload),
-    networkRequested(false)
+    networkRequested(false),
+    batchLevel(0),
+    namFactory(0),
+    opaqueFormat(QImage::Format_Invalid),
+    writeQueue(blobDir()),
+    dataSaver(TileDownload::DataSaverAuto)
 {
     pool = QThreadPool::globalInstance();
     qRegisterMetaType<TileTask>("TileTask");
@@ -166,18 +390,302 @@ TileDownloadPrivate::TileDownloadPrivate(TileDownload *tileDownload):
                      SIGNAL(onlineStateChanged(bool)));
 }
 
+QString TileDownloadPrivate::blobDir()
+{
+    Configuration *configuration = Controller::instance()->configuration();
+    return configuration->mapCacheDir() + QLatin1String(".blobs/");
+}
+
 inline QDebug operator<<(QDebug dbg, const TileTask &t)
 {
     dbg.nospace() << t.spec;
     return dbg.space();
 }
 
+static inline QByteArray tileHash(const uchar *data, int size)
+{
+    return QCryptographicHash::hash(
+        QByteArray::fromRawData(reinterpret_cast<const char*>(data), size),
+        QCryptographicHash::Sha1);
+}
+
+bool DecodedImageCache::find(const QByteArray &hash, QImage *image)
+{
+    QMutexLocker locker(&mutex);
+    QImage *cached = images.object(hash);
+    if (!cached) return false;
+    *image = *cached;
+    return true;
+}
+
+void DecodedImageCache::insert(const QByteArray &hash, const QImage &image)
+{
+    if (image.isNull()) return;
+
+    QMutexLocker locker(&mutex);
+    if (!seenHashes.contains(hash)) {
+        /* 20 bytes per tile: we can afford to remember quite a few */
+        if (seenHashes.count() > 50000) seenHashes.clear();
+        seenHashes.insert(hash);
+        return;
+    }
+    int cost = qMax(1, int(image.sizeInBytes() / 1024));
+    images.insert(hash, new QImage(image), cost);
+}
+
+void PreloadedTiles::insert(const QString &fileName, const QImage &image)
+{
+    QMutexLocker locker(&mutex);
+    int cost = qMax(1, int(image.sizeInBytes() / 1024));
+    images.insert(fileName, new QImage(image), cost);
+}
+
+bool PreloadedTiles::take(const QString &fileName, QImage *image)
+{
+    QMutexLocker locker(&mutex);
+    QImage *preloaded = images.take(fileName);
+    if (!preloaded) return false;
+    *image = *preloaded;
+    delete preloaded;
+    return true;
+}
+
+void PreloadedTiles::clear()
+{
+    QMutexLocker locker(&mutex);
+    images.clear();
+}
+
+void Preloader::run()
+{
+    Q_FOREACH(const QString &fileName, fileNames) {
+        QFile tileFile(fileName);
+        if (!tileFile.open(QIODevice::ReadOnly)) continue;
+        QImage image = decoder.loadTile(tileFile);
+        if (!image.isNull()) preloaded.insert(fileName, image);
+    }
+}
+
+TileWriteQueue::TileWriteQueue(const QString &blobDir):
+    blobDir(blobDir),
+    lastSerial(0),
+    writerRunning(false),
+    orphanedBlobs(0)
+{
+    pool.setMaxThreadCount(1);
+}
+
+TileWriteQueue::~TileWriteQueue()
+{
+    /* Don't lose the tiles we already have */
+    pool.waitForDone();
+}
+
+void TileWriteQueue::enqueue(const QString &fileName, const Entry &entry)
+{
+    QMutexLocker locker(&mutex);
+    Entry &queued = pending[fileName];
+    /* If an older version of this tile is still waiting, just replace it */
+    if (queued.serial == 0) queue.append(fileName);
+    queued = entry;
+    queued.serial = ++lastSerial;
+
+    if (!writerRunning) {
+        writerRunning = true;
+        pool.start(new TileWriter(*this));
+    }
+}
+
+bool TileWriteQueue::find(const QString &fileName, QImage *image,
+                          QByteArray *data)
+{
+    QMutexLocker locker(&mutex);
+    QHash<QString,Entry>::const_iterator i = pending.constFind(fileName);
+    if (i == pending.constEnd()) return false;
+    *image = i.value().image;
+    *data = i.value().data;
+    return true;
+}
+
+void TileWriteQueue::writeAll()
+{
+    Q_FOREVER {
+        /* Take all the tiles queued so far; the directories they need are
+         * remembered in knownDirs, so each one is only created once */
+        mutex.lock();
+        if (queue.isEmpty()) {
+            writerRunning = false;
+            mutex.unlock();
+            return;
+        }
+        QStringList batch = queue;
+        queue.clear();
+        QList<Entry> entries;
+        Q_FOREACH(const QString &fileName, batch) {
+            entries.append(pending.value(fileName));
+            /* Another version of the tile queued from now on must be queued
+             * again */
+            pending[fileName].serial = 0;
+        }
+        mutex.unlock();
+
+        for (int i = 0; i < batch.count(); i++) {
+            write(batch[i], entries[i]);
+        }
+
+        mutex.lock();
+        for (int i = 0; i < batch.count(); i++) {
+            QHash<QString,Entry>::iterator p = pending.find(batch[i]);
+            /* Only forget the tile if it hasn't been replaced meanwhile */
+            if (p != pending.end() && p.value().serial == 0) {
+                pending.erase(p);
+            }
+        }
+        mutex.unlock();
+    }
+}
+
+void TileWriteQueue::makeDir(const QString &path)
+{
+    if (knownDirs.contains(path)) return;
+    if (QDir().mkpath(path)) knownDirs.insert(path);
+}
+
+bool TileWriteQueue::writeFile(const QString &fileName,
+                               const QByteArray &data)
+{
+    /* QSaveFile writes to a temporary file and renames it over the target
+     * only when all the data is there: a crash can't leave a truncated tile
+     * behind */
+    QSaveFile file(fileName);
+    if (!file.open(QIODevice::WriteOnly)) return false;
+    file.write(data);
+    return file.commit();
+}
+
+void TileWriteQueue::write(const QString &fileName, const Entry &entry)
+{
+    /* The blob is still named after the hash of the original data, so that
+     * identical tiles keep being stored only once. The image in the entry
+     * may have been compacted to a lossy format for display, so we decode
+     * the original data again rather than transcode from it. */
+    QByteArray tileData = entry.data;
+    if (!entry.transcoder.isNull()) {
+        tileData = entry.transcoder.transcode(QImage::fromData(entry.data),
+                                              entry.data);
+    }
+    makeDir(QFileInfo(fileName).path());
+
+#ifdef Q_OS_UNIX
+    /* Store the contents once under their hash, and make the tile file a
+     * hard link to it: identical tiles then share the disk space, while
+     * readers keep finding a regular file at the usual path. The link is
+     * created under a temporary name and renamed over the tile, which is
+     * atomic. */
+    QString hex = QString::fromLatin1(entry.hash.toHex());
+    QString blobName = blobDir % hex.left(2) % '/' % hex;
+    bool haveBlob = QFile::exists(blobName);
+    if (!haveBlob) {
+        makeDir(blobDir + hex.left(2));
+        haveBlob = writeFile(blobName, tileData);
+    }
+    if (haveBlob) {
+        QByteArray linkName = QFile::encodeName(fileName + ".new");
+        QByteArray tileName = QFile::encodeName(fileName);
+        /* If the tile we are replacing was the only other link to its blob,
+         * that blob is left unused */
+        struct stat oldTile;
+        bool orphansBlob = ::stat(tileName.constData(), &oldTile) == 0 &&
+            oldTile.st_nlink == 2;
+        ::unlink(linkName.constData());
+        if (::link(QFile::encodeName(blobName).constData(),
+                   linkName.constData()) == 0) {
+            if (::rename(linkName.constData(), tileName.constData()) == 0) {
+                if (orphansBlob && ++orphanedBlobs >= blobPruneThreshold) {
+                    pruneBlobs();
+                }
+                return;
+            }
+            ::unlink(linkName.constData());
+        }
+    }
+#endif
+
+    /* No link support: just store a copy */
+    if (!writeFile(fileName, tileData)) {
+        qWarning() << "Couldn't save tile" << fileName;
+        /* maybe the cache was cleared under our feet */
+        knownDirs.clear();
+    }
+}
+
+void TileWriteQueue::pruneBlobs()
+{
+#ifdef Q_OS_UNIX
+    /* A blob whose only link is its own name isn't used by any tile. This
+     * runs in the writer thread, so no tile can be linked to a blob while we
+     * look at it. */
+    orphanedBlobs = 0;
+    QDirIterator it(blobDir, QDir::Files, QDirIterator::Subdirectories);
+    while (it.hasNext()) {
+        QByteArray blobName = QFile::encodeName(it.next());
+        struct stat st;
+        if (::stat(blobName.constData(), &st) == 0 && st.st_nlink == 1) {
+            ::unlink(blobName.constData());
+        }
+    }
+#endif
+}
+
+static bool isOpaque(const QImage &image)
+{
+    if (!image.hasAlphaChannel()) return true;
+
+    for (int y = 0; y < image.height(); y++) {
+        const QRgb *line =
+            reinterpret_cast<const QRgb*>(image.constScanLine(y));
+        for (int x = 0; x < image.width(); x++) {
+            if (qAlpha(line[x]) != 0xff) return false;
+        }
+    }
+    return true;
+}
+
+static QImage compactImage(const QImage &image, QImage::Format opaqueFormat)
+{
+    if (opaqueFormat == QImage::Format_Invalid || image.isNull())
+        return image;
+
+    switch (image.format()) {
+    case QImage::Format_RGB32:
+        return image.convertToFormat(opaqueFormat);
+    case QImage::Format_ARGB32:
+    case QImage::Format_ARGB32_Premultiplied:
+        return isOpaque(image) ? image.convertToFormat(opaqueFormat) : image;
+    default:
+        /* Palette images (Indexed8, Mono) are already at most one byte per
+         * pixel; anything else we leave alone */
+        return image;
+    }
+}
+
 Downloader::Downloader(TaskMap &tasks, QMutex &mutex,
                        QNetworkConfigurationManager *ncm,
+                       QQmlNetworkAccessManagerFactory *namFactory,
+                       QImage::Format opaqueFormat,
+                       DecodedImageCache &imageCache,
+                       TileWriteQueue &writeQueue,
+                       PreloadedTiles &preloaded,
+                       NetworkMeter &meter,
                        QObject *listener):
     tasks(tasks),
     mutex(mutex),
     ncm(ncm),
+    namFactory(namFactory),
+    decoder(imageCache, opaqueFormat),
+    writeQueue(writeQueue),
+    preloaded(preloaded),
+    meter(meter),
     listener(listener)
 {
 }
@@ -190,7 +698,8 @@ void Downloader::run()
 {
     bool hasTasks;
 
-    networkAccessManager = new QNetworkAccessManager;
+    networkAccessManager = namFactory ?
+        namFactory->create(0) : new QNetworkAccessManager;
 
     do {
         /* pick a task */
@@ -225,25 +734,66 @@ void Downloader::processTask(const TileTask &tile)
     TaskData &data = tasks[tile];
     mutex.unlock();
 
+    TileWriteQueue::Entry entry;
+
     QFile tileFile(tile.fileName);
-    if (tileFile.exists() &&
-        tileFile.open(QIODevice::ReadOnly)) {
-        data.tileContents.image = tileFile.readAll();
+    QByteArray queuedData;
+    if (writeQueue.find(tile.fileName, &data.tileContents.image,
+                        &queuedData)) {
+        /* downloaded recently, and not written yet; prefetched tiles are
+         * queued without being decoded */
+        if (data.tileContents.image.isNull() && !tile.prefetchOnly) {
+            const uchar *bytes =
+                reinterpret_cast<const uchar*>(queuedData.constData());
+            data.tileContents.image =
+                decoder.decodeTile(bytes, queuedData.size(),
+                                   tileHash(bytes, queuedData.size()));
+        }
+        data.cached = true;
+    } else if (tile.prefetchOnly && tileFile.exists()) {
+        data.cached = true;
+    } else if (preloaded.take(tile.fileName, &data.tileContents.image)) {
+        /* read at startup */
+    } else if (tileFile.exists() &&
+               tileFile.open(QIODevice::ReadOnly)) {
+        data.tileContents.image = decoder.loadTile(tileFile);
+        if (data.tileContents.image.isNull()) {
+            /* Most likely a tile truncated before writes were atomic: drop
+             * it, so that it gets downloaded again */
+            tileFile.remove();
+            data.tileContents.needsNetwork = true;
+        }
+    } else if (tile.renderer) {
+        QImage image;
+        entry.data = generateTile(tile, &image);
+        if (!entry.data.isEmpty()) {
+            entry.hash =
+                tileHash(reinterpret_cast<const uchar*>(entry.data.constData()),
+                         entry.data.size());
+            entry.transcoder = tile.transcoder;
+            if (!tile.prefetchOnly) {
+                entry.image = decoder.shareImage(image, entry.hash);
+                data.tileContents.image = entry.image;
+            }
+        }
+    } else if (tile.cacheOnly) {
+        data.tileContents.needsNetwork = true;
     } else {
 #ifndef Q_OS_WIN32
-        if (ncm->isOnline()) {
+        if (namFactory || ncm->isOnline()) {
 #else
         if (1) {
 #endif
-            data.tileContents.image = downloadTile(tile);
-            /* save the tile */
-            if (!data.tileContents.image.isEmpty()) {
-                QFileInfo info(tileFile.fileName());
-                info.dir().mkpath(QLatin1String("."));
-                if (tileFile.open(QIODevice::WriteOnly)) {
-                    tileFile.write(data.tileContents.image);
-                } else {
-                    qWarning() << "Couldn't save tile" << tileFile.fileName();
+            entry.data = downloadTile(tile);
+            if (!entry.data.isEmpty()) {
+                const uchar *bytes =
+                    reinterpret_cast<const uchar*>(entry.data.constData());
+                entry.hash = tileHash(bytes, entry.data.size());
+                entry.transcoder = tile.transcoder;
+                if (!tile.prefetchOnly) {
+                    entry.image = decoder.decodeTile(bytes, entry.data.size(),
+                                                     entry.hash);
+                    data.tileContents.image = entry.image;
                 }
             }
         } else {
@@ -252,23 +802,98 @@ void Downloader::processTask(const TileTask &tile)
         }
     }
 
+    /* Queue the tile for saving before reporting the task as completed: a
+     * new request for it will then find it in the write queue */
+    if (!entry.data.isEmpty()) {
+        writeQueue.enqueue(tile.fileName, entry);
+        data.cached = true;
+    }
+
     data.status = TaskData::Completed;
     QMetaObject::invokeMethod(listener, "taskCompleted", Qt::AutoConnection,
                               Q_ARG(TileTask, tile));
 }
 
+QImage TileDecoder::loadTile(QFile &tileFile)
+{
+    /* Decode the tile straight from the page cache: mapping the file avoids
+     * copying its contents into a heap buffer first. */
+    qint64 size = tileFile.size();
+    uchar *mapped = size > 0 ? tileFile.map(0, size) : 0;
+    if (Q_UNLIKELY(!mapped)) {
+        QByteArray tileData = tileFile.readAll();
+        const uchar *bytes =
+            reinterpret_cast<const uchar*>(tileData.constData());
+        return decodeTile(bytes, tileData.size(),
+                          tileHash(bytes, tileData.size()));
+    }
+
+    /* Hashing a tile is much cheaper than decoding it */
+    QImage image = decodeTile(mapped, int(size), tileHash(mapped, int(size)));
+    tileFile.unmap(mapped);
+    return image;
+}
+
+QImage TileDecoder::decodeTile(const uchar *data, int size,
+                               const QByteArray &hash)
+{
+    QImage image;
+    if (imageCache.find(hash, &image)) return image;
+
+    image = compactImage(QImage::fromData(data, size), opaqueFormat);
+    imageCache.insert(hash, image);
+    return image;
+}
+
+QImage TileDecoder::shareImage(const QImage &image, const QByteArray &hash)
+{
+    QImage shared;
+    if (imageCache.find(hash, &shared)) return shared;
+
+    shared = compactImage(image, opaqueFormat);
+    imageCache.insert(hash, shared);
+    return shared;
+}
+
+QByteArray Downloader::generateTile(const TileTask &tile, QImage *image)
+{
+    *image = tile.renderer->renderTile(tile.projection, tile.spec.zoom,
+                                       tile.spec.x, tile.spec.y);
+    if (image->isNull()) return QByteArray();
+
+    /* Encode it as if it had been downloaded, so that it can be cached */
+    QByteArray tileData;
+    QBuffer buffer(&tileData);
+    buffer.open(QIODevice::WriteOnly);
+    QByteArray format = QFileInfo(tile.fileName).suffix().toLatin1();
+    if (Q_UNLIKELY(!image->save(&buffer, format.constData()))) {
+        qWarning() << "Could not encode generated tile as" << format;
+        tileData.clear();
+    }
+    return tileData;
+}
+
 QByteArray Downloader::downloadTile(const TileTask &tile)
 {
     QNetworkRequest request(tile.url);
     request.setRawHeader("User-Agent", "Mappero 1.0");
+    QElapsedTimer timer;
+    timer.start();
     QNetworkReply *reply = networkAccessManager->get(request);
 
     /* QNetworkReply does not implement QIODevice::waitForReadyRead(); let's
-     * run an event loop till the request is finished */
+     * run an event loop till the request is finished. The loop is first
+     * interrupted when the headers arrive, to measure the latency. */
     QEventLoop loop;
+    QObject::connect(reply, SIGNAL(metaDataChanged()),
+                     &loop, SLOT(quit()));
     QObject::connect(reply, SIGNAL(finished()),
                      &loop, SLOT(quit()));
     loop.exec();
+    qint64 latency = timer.elapsed();
+    QObject::disconnect(reply, SIGNAL(metaDataChanged()),
+                        &loop, SLOT(quit()));
+    if (!reply->isFinished()) loop.exec();
 
     QByteArray tileData;
     QNetworkReply::NetworkError error = reply->error();
@@ -276,12 +901,49 @@ QByteArray Downloader::downloadTile(const TileTask &tile)
         DEBUG() << "Got error" << error << reply->errorString();
     } else {
         tileData = reply->readAll();
+        meter.addSample(latency, timer.elapsed() - latency, tileData.size());
     }
     delete reply;
 
     return tileData;
 }
 
+void NetworkMeter::addSample(qint64 latencyMs, qint64 transferMs,
+                             qint64 bytes)
+{
+    /* Exponentially weighted averages: the latest downloads count most, so
+     * that we notice quickly when the network changes */
+    static const qreal weight = 0.25;
+
+    QMutexLocker locker(&mutex);
+    latency = samples == 0 ? latencyMs :
+        latency + weight * (latencyMs - latency);
+
+    /* Small tiles on a fast link arrive all at once; the throughput can only
+     * be measured on the slower transfers */
+    if (transferMs > 0) {
+        qreal bytesPerSecond = bytes * 1000.0 / transferMs;
+        throughput = throughput < 0 ? bytesPerSecond :
+            throughput + weight * (bytesPerSecond - throughput);
+    }
+    samples++;
+}
+
+NetworkMeter::Speed NetworkMeter::speed() const
+{
+    QMutexLocker locker(&mutex);
+
+    /* Don't judge on the first couple of tiles, which also pay for the DNS
+     * lookup and the connection setup */
+    if (samples < 3) return Unknown;
+
+    if (latency > 1500 || (throughput >= 0 && throughput < 16 * 1024))
+        return VerySlow;
+    if (latency > 600 || (throughput >= 0 && throughput < 64 * 1024))
+        return Slow;
+    return Fast;
+}
+
 void TileDownloadPrivate::taskCompleted(const TileTask &tile)
 {
     Q_Q(TileDownload);
@@ -290,15 +952,28 @@ void TileDownloadPrivate::taskCompleted(const TileTask &tile)
     TaskMap::iterator t = tasks.find(tile);
     TaskData &data = t.value();
 
-    Q_EMIT q->tileDownloaded(tile.spec, data.tileContents);
+    if (tile.prefetchOnly) {
+        Q_EMIT q->tilePrefetched(tile.spec, data.cached);
+    } else {
+        Q_EMIT q->tileDownloaded(tile.spec, data.tileContents);
+    }
 
     /* Note: we can destroy the TaskData only because we know that the signal
      * connection is immediate; otherwise the receiver might end up accessing
      * deleted data */
-    bool needsNetwork = data.tileContents.needsNetwork;
+    /* Tiles requested from the cache only don't need the network up */
+    bool needsNetwork = data.tileContents.needsNetwork && !tile.cacheOnly;
+    int requeuePriority = data.requeuePriority;
     tasks.erase(t);
+    taskPriorities.remove(tile.spec);
     tasksMutex.unlock();
 
+    /* The tile is in the cache now, and will be decoded from there */
+    if (requeuePriority >= 0) {
+        TileTask task(tile.spec, requeuePriority);
+        if (!task.fileName.isEmpty()) requestTile(task);
+    }
+
     if (needsNetwork && !networkRequested) {
         networkRequested = true;
         QNetworkConfiguration cfg = ncm.defaultConfiguration();
@@ -310,17 +985,51 @@ void TileDownloadPrivate::taskCompleted(const TileTask &tile)
 void TileDownloadPrivate::requestTile(const TileTask &task)
 {
     tasksMutex.lock();
-    /* Check if the task is already in progress */
-    TaskMap::iterator t = tasks.find(task);
-    if (t != tasks.end() && t.value().status >= TaskData::InProgress) {
-        tasksMutex.unlock();
-        return;
+    QHash<TileSpec,int>::iterator p = taskPriorities.find(task.spec);
+    if (p != taskPriorities.end()) {
+        TileTask old(task);
+        old.priority = p.value();
+        TaskMap::iterator t = tasks.find(old);
+        /* Check if the task is already in progress */
+        if (t != tasks.end() && t.value().status >= TaskData::InProgress) {
+            /* A prefetched tile won't be decoded: ask for it again once it's
+             * done */
+            if (t.key().prefetchOnly && !task.prefetchOnly)
+                t.value().requeuePriority = task.priority;
+            tasksMutex.unlock();
+            return;
+        }
+        /* Prefetching a tile doesn't replace a request for its image */
+        if (t != tasks.end() && task.prefetchOnly && !t.key().prefetchOnly) {
+            tasksMutex.unlock();
+            return;
+        }
+        /* Still queued: requeue it with the new priority */
+        if (t != tasks.end()) tasks.erase(t);
     }
     tasks.insert(task, TaskData());
+    taskPriorities.insert(task.spec, task.priority);
     tasksMutex.unlock();
 
-    if (pool->activeThreadCount() < pool->maxThreadCount()) {
-        Downloader *downloader = new Downloader(tasks, tasksMutex, &ncm, this);
+    if (batchLevel == 0) startDownloaders();
+}
+
+void TileDownloadPrivate::startDownloaders()
+{
+    tasksMutex.lock();
+    int queued = 0;
+    Q_FOREACH(const TaskData &data, tasks) {
+        if (data.status == TaskData::Queued) queued++;
+    }
+    tasksMutex.unlock();
+
+    /* Each downloader keeps picking tasks until there are none left */
+    int available = pool->maxThreadCount() - pool->activeThreadCount();
+    for (int i = 0; i < qMin(queued, available); i++) {
+        Downloader *downloader = new Downloader(tasks, tasksMutex, &ncm,
+                                                namFactory, opaqueFormat,
+                                                imageCache, writeQueue,
+                                                preloaded, meter, this);
         pool->start(downloader);
     }
 }
@@ -348,4 +1057,113 @@ void TileDownload::requestTile(const TileSpec &tileSpec, int priority)
     d->requestTile(task);
 }
 
+void TileDownload::requestCachedTile(const TileSpec &tileSpec, int priority)
+{
+    Q_D(TileDownload);
+
+    TileTask task(tileSpec, priority);
+    if (Q_UNLIKELY(task.fileName.isEmpty())) {
+        qWarning() << "Tile task has no filename, skipping";
+        return;
+    }
+    task.cacheOnly = true;
+    d->requestTile(task);
+}
+
+void TileDownload::prefetchTile(const TileSpec &tileSpec, int priority)
+{
+    Q_D(TileDownload);
+
+    TileTask task(tileSpec, priority);
+    if (Q_UNLIKELY(task.fileName.isEmpty())) {
+        qWarning() << "Tile task has no filename, skipping";
+        return;
+    }
+    task.prefetchOnly = true;
+    d->requestTile(task);
+}
+
+void TileDownload::preloadTiles(const QStringList &fileNames)
+{
+    Q_D(TileDownload);
+
+    if (fileNames.isEmpty()) return;
+
+    d->pool->start(new Preloader(fileNames,
+                                 TileDecoder(d->imageCache, d->opaqueFormat),
+                                 d->preloaded));
+
+    /* If the tiles haven't been asked for by then, they won't be */
+    QTimer::singleShot(60 * 1000, d, SLOT(dropPreloadedTiles()));
+}
+
+void TileDownload::beginBatch()
+{
+    Q_D(TileDownload);
+    d->batchLevel++;
+}
+
+void TileDownload::endBatch()
+{
+    Q_D(TileDownload);
+    if (Q_UNLIKELY(d->batchLevel == 0)) {
+        qWarning() << "endBatch() called without beginBatch()";
+        return;
+    }
+    if (--d->batchLevel == 0) d->startDownloaders();
+}
+
+void TileDownload::setDataSaver(DataSaver mode)
+{
+    Q_D(TileDownload);
+    d->dataSaver = mode;
+}
+
+TileDownload::DataSaver TileDownload::dataSaver() const
+{
+    Q_D(const TileDownload);
+    return d->dataSaver;
+}
+
+int TileDownload::coarseLevels() const
+{
+    Q_D(const TileDownload);
+
+    if (d->dataSaver == DataSaverOff) return 0;
+
+    switch (d->meter.speed()) {
+    case NetworkMeter::VerySlow:
+        return 2;
+    case NetworkMeter::Slow:
+        return 1;
+    default:
+        return d->dataSaver == DataSaverOn ? 1 : 0;
+    }
+}
+
+void TileDownload::setOpaqueTileFormat(QImage::Format format)
+{
+    Q_D(TileDownload);
+    d->opaqueFormat = format;
+}
+
+QImage::Format TileDownload::opaqueTileFormat() const
+{
+    Q_D(const TileDownload);
+    return d->opaqueFormat;
+}
+
+void TileDownload::setNetworkAccessManagerFactory(
+    QQmlNetworkAccessManagerFactory *factory)
+{
+    Q_D(TileDownload);
+    d->namFactory = factory;
+}
+
+QQmlNetworkAccessManagerFactory *TileDownload::networkAccessManagerFactory() const
+{
+    Q_D(const TileDownload);
+    return d->namFactory;
+}
+
 #include "tile-download.moc"
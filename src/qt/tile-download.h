@@ -24,15 +24,21 @@
 
 #include "types.h"
 
+#include <QImage>
 #include <QMetaType>
 #include <QObject>
+#include <QStringList>
+
+class QQmlNetworkAccessManagerFactory;
 
 namespace Mappero {
 
 struct TileContents {
-    TileContents(): image(QByteArray()), needsNetwork(false) {}
+    TileContents(): image(), needsNetwork(false) {}
 
-    QByteArray image;
+    /* The decoded tile; QImage is implicitly shared, so passing this struct
+     * around (even across threads) never copies the pixel data */
+    QImage image;
     /* true if the tile image data could be improved by fetching it from the
      * network */
     bool needsNetwork;
@@ -44,13 +50,62 @@ class TileDownload: public QObject
     Q_OBJECT
 
 public:
+    enum DataSaver {
+        /* Tiles are always fetched at the requested zoom level */
+        DataSaverOff = 0,
+        /* On slow networks, coarser tiles are fetched first */
+        DataSaverAuto,
+        /* Only coarser tiles are downloaded; the requested ones are used
+         * only if they are already in the disk cache */
+        DataSaverOn,
+    };
+
     TileDownload(QObject *parent = 0);
     ~TileDownload();
 
+    /* Lower values of priority are served first; requesting a tile which
+     * is still queued just updates its priority */
     void requestTile(const TileSpec &spec, int priority);
+    /* Like requestTile(), but the tile is not downloaded if it's not in the
+     * disk cache */
+    void requestCachedTile(const TileSpec &spec, int priority);
+    /* Stores the tile in the disk cache, without decoding it; completion is
+     * reported by tilePrefetched() */
+    void prefetchTile(const TileSpec &spec, int priority);
+
+    /* Requests made between these calls are queued together, and the
+     * download threads are started only at the end: this way the tiles are
+     * fetched in order of priority. Batches can be nested. */
+    void beginBatch();
+    void endBatch();
+
+    /* Reads the given tile files from the disk cache in the background, and
+     * keeps them decoded in memory for a while, ready to be requested */
+    void preloadTiles(const QStringList &fileNames);
+
+    void setDataSaver(DataSaver mode);
+    DataSaver dataSaver() const;
+
+    /* How many zoom levels coarser than the needed tiles should be fetched
+     * first, according to the data saver mode and to the speed measured on
+     * the latest downloads; 0 means that tiles should be fetched as they
+     * are */
+    int coarseLevels() const;
+
+    /* If set to a valid format, fully opaque true-colour tiles are converted
+     * to it after decoding; palette tiles are always kept as they are. It
+     * can be changed at any time; running downloads keep the old format. */
+    void setOpaqueTileFormat(QImage::Format format);
+    QImage::Format opaqueTileFormat() const;
+
+    /* Lets tiles be fetched through a custom network; when a factory is set
+     * the system's online state is not taken into account */
+    void setNetworkAccessManagerFactory(QQmlNetworkAccessManagerFactory *f);
+    QQmlNetworkAccessManagerFactory *networkAccessManagerFactory() const;
 
 Q_SIGNALS:
     void tileDownloaded(const TileSpec &tileSpec, TileContents tileContents);
+    void tilePrefetched(const TileSpec &tileSpec, bool cached);
     void onlineStateChanged(bool isOnline);
 
 private:
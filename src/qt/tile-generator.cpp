@@ -0,0 +1,88 @@
+/* vi: set et sw=4 ts=4 cino=t0,(0: */
+/* -*- Mode: C; indent-tabs-mode: nil; c-basic-offset: 4; tab-width: 4 -*- */
+/*
+ * Copyright (C) 2020 Alberto Mardegan <mardy@users.sourceforge.net>
+ *
+ * This file is part of Mappero.
+ *
+ * Mappero is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Mappero is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Mappero.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "tile-generator.h"
+
+#include <QCryptographicHash>
+
+using namespace Mappero;
+
+namespace Mappero {
+class TileGeneratorPrivate
+{
+    Q_DECLARE_PUBLIC(TileGenerator)
+
+    TileGeneratorPrivate(TileGenerator *q): q_ptr(q) {}
+
+private:
+    mutable TileGenerator *q_ptr;
+    QSharedPointer<const TileRenderer> renderer;
+    /* Computed on first use: it's needed for every tile file name */
+    QByteArray cacheKey;
+};
+}; // namespace
+
+TileGenerator::TileGenerator(QObject *parent):
+    QObject(parent),
+    d_ptr(new TileGeneratorPrivate(this))
+{
+}
+
+TileGenerator::~TileGenerator()
+{
+    delete d_ptr;
+}
+
+QSharedPointer<const TileRenderer> TileGenerator::renderer() const
+{
+    Q_D(const TileGenerator);
+
+    if (!d->renderer) {
+        const_cast<TileGeneratorPrivate*>(d)->renderer =
+            QSharedPointer<const TileRenderer>(createRenderer());
+    }
+    return d->renderer;
+}
+
+QByteArray TileGenerator::cacheKey() const
+{
+    Q_D(const TileGenerator);
+
+    if (d->cacheKey.isEmpty()) {
+        QByteArray data = QByteArray(metaObject()->className()) + ':' +
+            parameters();
+        const_cast<TileGeneratorPrivate*>(d)->cacheKey =
+            QCryptographicHash::hash(data, QCryptographicHash::Md5).
+            toHex().left(8);
+    }
+    return d->cacheKey;
+}
+
+void TileGenerator::invalidate()
+{
+    Q_D(TileGenerator);
+
+    /* Renderers still in use by the download threads stay alive until
+     * they are done */
+    d->renderer.clear();
+    d->cacheKey.clear();
+    Q_EMIT generatorChanged();
+}
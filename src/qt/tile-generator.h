@@ -0,0 +1,86 @@
+/* vi: set et sw=4 ts=4 cino=t0,(0: */
+/* -*- Mode: C; indent-tabs-mode: nil; c-basic-offset: 4; tab-width: 4 -*- */
+/*
+ * Copyright (C) 2020 Alberto Mardegan <mardy@users.sourceforge.net>
+ *
+ * This file is part of Mappero.
+ *
+ * Mappero is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Mappero is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Mappero.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef MAP_TILE_GENERATOR_H
+#define MAP_TILE_GENERATOR_H
+
+#include <QByteArray>
+#include <QImage>
+#include <QObject>
+#include <QSharedPointer>
+
+namespace Mappero {
+
+class Projection;
+
+/* Draws tiles with a fixed set of parameters. Renderers are used by the
+ * download threads, possibly by several at the same time, so they must not
+ * be modified once created. */
+class TileRenderer
+{
+public:
+    virtual ~TileRenderer() {}
+
+    /* zoom is the map zoom level (0 is the most detailed); a null image
+     * means that the tile could not be generated */
+    virtual QImage renderTile(const Projection *projection,
+                              int zoom, int x, int y) const = 0;
+};
+
+/* The base class for local tile sources: a TiledLayer with a generator
+ * gets its tiles from it instead of downloading them. Generated tiles are
+ * scheduled and cached just like downloaded ones. */
+class TileGeneratorPrivate;
+class TileGenerator: public QObject
+{
+    Q_OBJECT
+
+public:
+    TileGenerator(QObject *parent = 0);
+    ~TileGenerator();
+
+    /* A renderer for the current parameters; a new one is created after
+     * they change */
+    QSharedPointer<const TileRenderer> renderer() const;
+
+    /* Identifies the current parameters, so that tiles generated with
+     * different ones are cached separately */
+    QByteArray cacheKey() const;
+
+Q_SIGNALS:
+    void generatorChanged();
+
+protected:
+    virtual TileRenderer *createRenderer() const = 0;
+    /* All the parameters which affect the tiles' contents */
+    virtual QByteArray parameters() const = 0;
+
+    /* To be called by subclasses when a parameter has changed */
+    void invalidate();
+
+private:
+    TileGeneratorPrivate *d_ptr;
+    Q_DECLARE_PRIVATE(TileGenerator)
+};
+
+}; // namespace
+
+#endif /* MAP_TILE_GENERATOR_H */
@@ -0,0 +1,94 @@
+/* vi: set et sw=4 ts=4 cino=t0,(0: */
+/* -*- Mode: C; indent-tabs-mode: nil; c-basic-offset: 4; tab-width: 4 -*- */
+/*
+ * Copyright (C) 2020 Alberto Mardegan <mardy@users.sourceforge.net>
+ *
+ * This file is part of Mappero.
+ *
+ * Mappero is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Mappero is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Mappero.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef MAP_TILE_GRID_H
+#define MAP_TILE_GRID_H
+
+#include "types.h"
+
+#include <QPoint>
+#include <QString>
+
+namespace Mappero {
+
+/* The tiles covering a rectangular area of the map at a given zoom level.
+ * Tile coordinates can lie outside of the world: they are wrapped around
+ * when resolved into a TileSpec. */
+class TileGrid
+{
+public:
+    TileGrid(int zoom, const QPoint &start, const QPoint &stop):
+        m_zoom(zoom), m_start(start), m_stop(stop) {}
+
+    /* The tiles containing the points between topLeft and bottomRight,
+     * which are in map units */
+    static TileGrid covering(const Point &topLeft, const Point &bottomRight,
+                             int zoom) {
+        return TileGrid(zoom, topLeft.toTile(zoom), bottomRight.toTile(zoom));
+    }
+
+    int zoom() const { return m_zoom; }
+    QPoint start() const { return m_start; }
+    QPoint stop() const { return m_stop; }
+    int columns() const { return m_stop.x() - m_start.x() + 1; }
+    int rows() const { return m_stop.y() - m_start.y() + 1; }
+
+    /* Number of tiles along each side of the world */
+    int worldSize() const { return 1 << (MAX_ZOOM + 1 - m_zoom); }
+
+    int wrap(int t) const {
+        int m = t % worldSize();
+        return m < 0 ? m + worldSize() : m;
+    }
+
+    TileSpec spec(int tx, int ty, const QString &layerId) const {
+        return TileSpec(wrap(tx), wrap(ty), m_zoom, layerId);
+    }
+
+    /* The top left corner of a tile, in pixels of the given zoom level and
+     * relative to origin (in map units). Rounding is always done downwards,
+     * so that adjacent tiles are drawn without gaps. */
+    QPoint position(int tx, int ty, const Point &origin,
+                    int pixelZoom) const {
+        qint64 tileUnits = qint64(TILE_SIZE_PIXELS) << m_zoom;
+        return QPoint(floorDiv(tx * tileUnits - origin.x(), pixelZoom),
+                      floorDiv(ty * tileUnits - origin.y(), pixelZoom));
+    }
+
+    /* How far a tile is from the given one, in tiles */
+    static int distance(int tx, int ty, const QPoint &tile) {
+        return qMax(qAbs(tx - tile.x()), qAbs(ty - tile.y()));
+    }
+
+private:
+    static int floorDiv(qint64 units, int zoom) {
+        qint64 d = qint64(1) << zoom;
+        return int(units >= 0 ? units / d : -((-units + d - 1) / d));
+    }
+
+    int m_zoom;
+    QPoint m_start;
+    QPoint m_stop;
+};
+
+}; // namespace
+
+#endif /* MAP_TILE_GRID_H */
@@ -0,0 +1,569 @@
+/* vi: set et sw=4 ts=4 cino=t0,(0: */
+/*
+ * Copyright (C) 2020 Alberto Mardegan <mardy@users.sourceforge.net>
+ *
+ * This file is part of Mappero.
+ *
+ * Mappero is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Mappero is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Mappero.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#   include "config.h"
+#endif
+#include "controller.h"
+#include "debug.h"
+#include "tile-download.h"
+#include "tile-prefetcher.h"
+#include "tiled-layer.h"
+#include "types.h"
+
+#include <Mappero/Projection>
+#include <QFile>
+#include <QFileInfo>
+#include <QMutex>
+#include <QPointer>
+#include <QRunnable>
+#include <QSet>
+#include <QSharedPointer>
+#include <QThreadPool>
+#include <QTimer>
+#include <math.h>
+
+using namespace Mappero;
+
+/* Prefetched tiles are only downloaded when nothing else is waiting */
+static const int prefetchPriority = 1 << 24;
+/* How many tiles we let TileDownload queue at any time */
+static const int maxOutstandingTiles = 32;
+/* How many files we check for existence before yielding to the event loop */
+static const int maxChecksPerRun = 256;
+/* Used for the size estimate when no tiles of the layer are cached */
+static const qint64 defaultTileSize = 20 * 1024;
+
+namespace Mappero {
+
+typedef QVector<TileSpec> TileSpecList;
+
+/* Shared between the prefetcher and its background job, so that the job can
+ * safely report to a prefetcher which might have been destroyed */
+struct CorridorJobState
+{
+    CorridorJobState(QObject *listener): listener(listener) {}
+
+    QMutex mutex;
+    QObject *listener;
+    TileSpecList tiles;
+};
+
+class CorridorJob: public QRunnable
+{
+public:
+    CorridorJob(const QSharedPointer<CorridorJobState> &state,
+                int generation,
+                const QVector<QPolygon> &polylines,
+                const Projection *projection,
+                const QString &layerId,
+                qreal corridorWidth, int minZoom, int maxZoom):
+        state(state),
+        generation(generation),
+        polylines(polylines),
+        projection(projection),
+        layerId(layerId),
+        corridorWidth(corridorWidth),
+        minZoom(minZoom),
+        maxZoom(maxZoom)
+    {
+    }
+
+    // reimplemented virtual method
+    void run();
+
+private:
+    qreal unitsPerMetre(const QPoint &unit) const;
+    void addTiles(const QPoint &a, const QPoint &b, int zoom,
+                  QSet<quint64> &seen, TileSpecList &tiles) const;
+
+private:
+    QSharedPointer<CorridorJobState> state;
+    int generation;
+    QVector<QPolygon> polylines;
+    const Projection *projection;
+    QString layerId;
+    qreal corridorWidth;
+    int minZoom;
+    int maxZoom;
+};
+
+class TilePrefetcherPrivate: public QObject
+{
+    Q_OBJECT
+    Q_DECLARE_PUBLIC(TilePrefetcher)
+
+    TilePrefetcherPrivate(TilePrefetcher *q);
+    ~TilePrefetcherPrivate();
+
+    void invalidate();
+    void estimateSize();
+    void setRunning(bool running);
+    QString tileFileName(const TileSpec &spec) const {
+        return layer->tileFileName(spec.zoom, spec.x, spec.y);
+    }
+
+private Q_SLOTS:
+    void onJobFinished(int generation);
+    void onTileDownloaded(const TileSpec &spec, TileContents tileContents);
+    void onTilePrefetched(const TileSpec &spec, bool cached);
+    void requestMore();
+
+private:
+    QPointer<TiledLayer> layer;
+    Path path;
+    qreal corridorWidth;
+    int minZoom;
+    int maxZoom;
+    QSharedPointer<CorridorJobState> jobState;
+    int generation;
+    bool estimating;
+    bool haveTiles;
+    bool startWhenReady;
+    TileSpecList tiles;
+    qreal estimatedSize;
+    bool running;
+    bool requestQueued;
+    int nextTile;
+    QSet<TileSpec> outstanding;
+    int done;
+    int failed;
+    TileDownload *tileDownload;
+    mutable TilePrefetcher *q_ptr;
+};
+
+} // namespace
+
+qreal CorridorJob::unitsPerMetre(const QPoint &unit) const
+{
+    /* The projection is conformal: measure how long a short north-south
+     * step is, and use it in all directions. 0.01 degrees of latitude are
+     * about 1112 metres. */
+    GeoPoint geo = projection->unitToGeo(unit);
+    Geo lat = qMin(geo.lat, Geo(84.99));
+    Point a = projection->geoToUnit(GeoPoint(lat, geo.lon));
+    Point b = projection->geoToUnit(GeoPoint(lat + 0.01, geo.lon));
+    return qAbs(b.y() - a.y()) / 1112.0;
+}
+
+void CorridorJob::addTiles(const QPoint &a, const QPoint &b, int zoom,
+                           QSet<quint64> &seen, TileSpecList &tiles) const
+{
+    qint64 tileUnits = qint64(TILE_SIZE_PIXELS) << zoom;
+    int worldSizeTiles = 1 << (MAX_ZOOM + 1 - zoom);
+
+    /* Walk the segment in steps of half a tile, collecting the tiles within
+     * the corridor around each step; the quarter tile added to the margin
+     * covers the points lying between two steps. Only tiles near the path
+     * are ever looked at, whatever the extent of the path. */
+    QPoint diff = b - a;
+    qreal length = hypot(diff.x(), diff.y());
+    int steps = qMax(1, int(ceil(length / (tileUnits / 2))));
+    qint64 margin = qint64(corridorWidth * unitsPerMetre(a)) + tileUnits / 4;
+
+    for (int s = 0; s <= steps; s++) {
+        qint64 x = a.x() + qint64(diff.x()) * s / steps;
+        qint64 y = a.y() + qint64(diff.y()) * s / steps;
+        int x0 = qMax(0, int((x - margin) / tileUnits));
+        int x1 = qMin(worldSizeTiles - 1, int((x + margin) / tileUnits));
+        int y0 = qMax(0, int((y - margin) / tileUnits));
+        int y1 = qMin(worldSizeTiles - 1, int((y + margin) / tileUnits));
+        for (int tx = x0; tx <= x1; tx++) {
+            for (int ty = y0; ty <= y1; ty++) {
+                quint64 key = (quint64(quint32(tx)) << 32) | quint32(ty);
+                if (seen.contains(key)) continue;
+                seen.insert(key);
+                tiles.append(TileSpec(tx, ty, zoom, layerId));
+            }
+        }
+    }
+}
+
+void CorridorJob::run()
+{
+    TileSpecList tiles;
+
+    /* Coarse levels first: they are few, and already useful */
+    for (int zoom = maxZoom; zoom >= minZoom; zoom--) {
+        QSet<quint64> seen;
+        Q_FOREACH(const QPolygon &polyline, polylines) {
+            if (polyline.count() == 1) {
+                addTiles(polyline[0], polyline[0], zoom, seen, tiles);
+            }
+            for (int i = 1; i < polyline.count(); i++) {
+                addTiles(polyline[i - 1], polyline[i], zoom, seen, tiles);
+            }
+        }
+    }
+
+    QMutexLocker locker(&state->mutex);
+    if (!state->listener) return;
+    state->tiles = tiles;
+    QMetaObject::invokeMethod(state->listener, "onJobFinished",
+                              Qt::QueuedConnection,
+                              Q_ARG(int, generation));
+}
+
+TilePrefetcherPrivate::TilePrefetcherPrivate(TilePrefetcher *q):
+    QObject(),
+    corridorWidth(500),
+    minZoom(3),
+    maxZoom(MAX_ZOOM - 6),
+    jobState(new CorridorJobState(this)),
+    generation(0),
+    estimating(false),
+    haveTiles(false),
+    startWhenReady(false),
+    estimatedSize(0),
+    running(false),
+    requestQueued(false),
+    nextTile(0),
+    done(0),
+    failed(0),
+    tileDownload(Controller::instance()->tileDownload()),
+    q_ptr(q)
+{
+    QObject::connect(tileDownload,
+                     SIGNAL(tileDownloaded(const TileSpec &,TileContents)),
+                     this,
+                     SLOT(onTileDownloaded(const TileSpec &,TileContents)));
+    QObject::connect(tileDownload,
+                     SIGNAL(tilePrefetched(const TileSpec &,bool)),
+                     this,
+                     SLOT(onTilePrefetched(const TileSpec &,bool)));
+}
+
+TilePrefetcherPrivate::~TilePrefetcherPrivate()
+{
+    QMutexLocker locker(&jobState->mutex);
+    jobState->listener = 0;
+}
+
+void TilePrefetcherPrivate::invalidate()
+{
+    Q_Q(TilePrefetcher);
+
+    /* Results of running jobs will be ignored */
+    generation++;
+    estimating = false;
+    haveTiles = false;
+    tiles.clear();
+    estimatedSize = 0;
+    Q_EMIT q->estimateChanged();
+}
+
+void TilePrefetcherPrivate::estimateSize()
+{
+    /* Look at a sample of the tiles: see how many of them are already
+     * cached, and how large they are */
+    int step = qMax(1, tiles.count() / 256);
+    int sampled = 0, cached = 0;
+    qint64 cachedBytes = 0;
+    for (int i = 0; i < tiles.count(); i += step) {
+        QFileInfo info(tileFileName(tiles[i]));
+        sampled++;
+        if (info.exists()) {
+            cached++;
+            cachedBytes += info.size();
+        }
+    }
+
+    qreal tileSize = cached > 0 ? qreal(cachedBytes) / cached : defaultTileSize;
+    qreal missing = sampled > 0 ? qreal(sampled - cached) / sampled : 0;
+    estimatedSize = tiles.count() * missing * tileSize;
+}
+
+void TilePrefetcherPrivate::setRunning(bool isRunning)
+{
+    Q_Q(TilePrefetcher);
+    if (isRunning == running) return;
+    running = isRunning;
+    Q_EMIT q->runningChanged();
+}
+
+void TilePrefetcherPrivate::onJobFinished(int jobGeneration)
+{
+    Q_Q(TilePrefetcher);
+
+    if (jobGeneration != generation || layer.isNull()) return;
+
+    jobState->mutex.lock();
+    tiles = jobState->tiles;
+    jobState->tiles.clear();
+    jobState->mutex.unlock();
+
+    estimating = false;
+    haveTiles = true;
+    estimateSize();
+    Q_EMIT q->estimateChanged();
+
+    if (startWhenReady) {
+        startWhenReady = false;
+        q->start();
+    }
+}
+
+void TilePrefetcherPrivate::onTileDownloaded(const TileSpec &spec,
+                                             TileContents tileContents)
+{
+    /* The tile might have been requested by a layer while we were waiting
+     * for it, in which case it's delivered decoded */
+    onTilePrefetched(spec, !tileContents.image.isNull());
+}
+
+void TilePrefetcherPrivate::onTilePrefetched(const TileSpec &spec,
+                                             bool cached)
+{
+    Q_Q(TilePrefetcher);
+
+    if (!outstanding.remove(spec)) return;
+
+    done++;
+    if (!cached) failed++;
+    Q_EMIT q->progressChanged();
+    requestMore();
+}
+
+void TilePrefetcherPrivate::requestMore()
+{
+    Q_Q(TilePrefetcher);
+
+    requestQueued = false;
+    if (!running) return;
+    if (layer.isNull()) {
+        q->cancel();
+        return;
+    }
+
+    int checks = 0;
+    int skipped = 0;
+    while (outstanding.count() < maxOutstandingTiles &&
+           nextTile < tiles.count()) {
+        const TileSpec &spec = tiles[nextTile++];
+        /* Tiles we already have don't need to go through the downloader */
+        if (QFile::exists(tileFileName(spec))) {
+            done++;
+            skipped++;
+            if (++checks >= maxChecksPerRun) {
+                requestQueued = true;
+                QTimer::singleShot(0, this, SLOT(requestMore()));
+                break;
+            }
+            continue;
+        }
+        outstanding.insert(spec);
+        tileDownload->prefetchTile(spec, prefetchPriority + nextTile);
+    }
+    if (skipped > 0) Q_EMIT q->progressChanged();
+
+    if (outstanding.isEmpty() && nextTile >= tiles.count() && !requestQueued) {
+        setRunning(false);
+        Q_EMIT q->finished();
+    }
+}
+
+TilePrefetcher::TilePrefetcher(QObject *parent):
+    QObject(parent),
+    d_ptr(new TilePrefetcherPrivate(this))
+{
+}
+
+TilePrefetcher::~TilePrefetcher()
+{
+    delete d_ptr;
+}
+
+void TilePrefetcher::setLayer(TiledLayer *layer)
+{
+    Q_D(TilePrefetcher);
+    if (layer == d->layer) return;
+    cancel();
+    d->layer = layer;
+    d->invalidate();
+    Q_EMIT layerChanged();
+}
+
+TiledLayer *TilePrefetcher::layer() const
+{
+    Q_D(const TilePrefetcher);
+    return d->layer;
+}
+
+void TilePrefetcher::setPath(const Path &path)
+{
+    Q_D(TilePrefetcher);
+    cancel();
+    d->path = path;
+    d->invalidate();
+    Q_EMIT pathChanged();
+}
+
+Path TilePrefetcher::path() const
+{
+    Q_D(const TilePrefetcher);
+    return d->path;
+}
+
+void TilePrefetcher::setCorridorWidth(qreal width)
+{
+    Q_D(TilePrefetcher);
+    if (width == d->corridorWidth) return;
+    cancel();
+    d->corridorWidth = width;
+    d->invalidate();
+    Q_EMIT corridorWidthChanged();
+}
+
+qreal TilePrefetcher::corridorWidth() const
+{
+    Q_D(const TilePrefetcher);
+    return d->corridorWidth;
+}
+
+void TilePrefetcher::setMinZoomLevel(int zoom)
+{
+    Q_D(TilePrefetcher);
+    if (zoom == d->minZoom) return;
+    cancel();
+    d->minZoom = zoom;
+    d->invalidate();
+    Q_EMIT zoomRangeChanged();
+}
+
+int TilePrefetcher::minZoomLevel() const
+{
+    Q_D(const TilePrefetcher);
+    return d->minZoom;
+}
+
+void TilePrefetcher::setMaxZoomLevel(int zoom)
+{
+    Q_D(TilePrefetcher);
+    if (zoom == d->maxZoom) return;
+    cancel();
+    d->maxZoom = zoom;
+    d->invalidate();
+    Q_EMIT zoomRangeChanged();
+}
+
+int TilePrefetcher::maxZoomLevel() const
+{
+    Q_D(const TilePrefetcher);
+    return d->maxZoom;
+}
+
+bool TilePrefetcher::isEstimating() const
+{
+    Q_D(const TilePrefetcher);
+    return d->estimating;
+}
+
+int TilePrefetcher::tileCount() const
+{
+    Q_D(const TilePrefetcher);
+    return d->tiles.count();
+}
+
+qreal TilePrefetcher::estimatedSize() const
+{
+    Q_D(const TilePrefetcher);
+    return d->estimatedSize;
+}
+
+bool TilePrefetcher::isRunning() const
+{
+    Q_D(const TilePrefetcher);
+    return d->running;
+}
+
+int TilePrefetcher::doneCount() const
+{
+    Q_D(const TilePrefetcher);
+    return d->done;
+}
+
+int TilePrefetcher::failedCount() const
+{
+    Q_D(const TilePrefetcher);
+    return d->failed;
+}
+
+qreal TilePrefetcher::progress() const
+{
+    Q_D(const TilePrefetcher);
+    if (d->tiles.isEmpty()) return d->haveTiles ? 1.0 : 0.0;
+    return qreal(d->done) / d->tiles.count();
+}
+
+void TilePrefetcher::estimate()
+{
+    Q_D(TilePrefetcher);
+
+    if (d->estimating || d->haveTiles) return;
+    if (d->layer.isNull() || d->path.isEmpty() ||
+        !d->layer->projection()) {
+        qWarning() << "TilePrefetcher: layer or path not set";
+        return;
+    }
+
+    int minZoom = qMax(d->minZoom, d->layer->minZoom());
+    int maxZoom = qMin(d->maxZoom, d->layer->maxZoom());
+    d->estimating = true;
+    Q_EMIT estimateChanged();
+
+    CorridorJob *job = new CorridorJob(d->jobState, d->generation,
+                                       d->path.toUnitPolylines(),
+                                       d->layer->projection(),
+                                       d->layer->id(),
+                                       d->corridorWidth, minZoom, maxZoom);
+    QThreadPool::globalInstance()->start(job);
+}
+
+void TilePrefetcher::start()
+{
+    Q_D(TilePrefetcher);
+
+    if (d->running) return;
+    if (!d->haveTiles) {
+        d->startWhenReady = true;
+        estimate();
+        return;
+    }
+
+    d->nextTile = 0;
+    d->done = 0;
+    d->failed = 0;
+    d->outstanding.clear();
+    d->setRunning(true);
+    Q_EMIT progressChanged();
+    d->requestMore();
+}
+
+void TilePrefetcher::cancel()
+{
+    Q_D(TilePrefetcher);
+
+    d->startWhenReady = false;
+    /* The tiles already queued will still be downloaded */
+    d->outstanding.clear();
+    d->setRunning(false);
+}
+
+#include "tile-prefetcher.moc"
@@ -0,0 +1,108 @@
+/* vi: set et sw=4 ts=4 cino=t0,(0: */
+/* -*- Mode: C; indent-tabs-mode: nil; c-basic-offset: 4; tab-width: 4 -*- */
+/*
+ * Copyright (C) 2020 Alberto Mardegan <mardy@users.sourceforge.net>
+ *
+ * This file is part of Mappero.
+ *
+ * Mappero is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Mappero is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Mappero.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef MAP_TILE_PREFETCHER_H
+#define MAP_TILE_PREFETCHER_H
+
+#include <Mappero/Path>
+#include <QObject>
+
+namespace Mappero {
+
+class TiledLayer;
+
+/* Downloads, for offline use, the tiles of a layer lying within a given
+ * distance from a path (a recorded track or a computed route) */
+class TilePrefetcherPrivate;
+class TilePrefetcher: public QObject
+{
+    Q_OBJECT
+    Q_PROPERTY(Mappero::TiledLayer *layer READ layer WRITE setLayer \
+               NOTIFY layerChanged);
+    Q_PROPERTY(Mappero::Path path READ path WRITE setPath NOTIFY pathChanged);
+    Q_PROPERTY(qreal corridorWidth READ corridorWidth \
+               WRITE setCorridorWidth NOTIFY corridorWidthChanged);
+    Q_PROPERTY(int minZoomLevel READ minZoomLevel WRITE setMinZoomLevel \
+               NOTIFY zoomRangeChanged);
+    Q_PROPERTY(int maxZoomLevel READ maxZoomLevel WRITE setMaxZoomLevel \
+               NOTIFY zoomRangeChanged);
+    Q_PROPERTY(bool estimating READ isEstimating NOTIFY estimateChanged);
+    Q_PROPERTY(int tileCount READ tileCount NOTIFY estimateChanged);
+    Q_PROPERTY(qreal estimatedSize READ estimatedSize NOTIFY estimateChanged);
+    Q_PROPERTY(bool running READ isRunning NOTIFY runningChanged);
+    Q_PROPERTY(int doneCount READ doneCount NOTIFY progressChanged);
+    Q_PROPERTY(int failedCount READ failedCount NOTIFY progressChanged);
+    Q_PROPERTY(qreal progress READ progress NOTIFY progressChanged);
+
+public:
+    TilePrefetcher(QObject *parent = 0);
+    ~TilePrefetcher();
+
+    void setLayer(TiledLayer *layer);
+    TiledLayer *layer() const;
+
+    void setPath(const Path &path);
+    Path path() const;
+
+    /* Distance from the path, in metres, on either side */
+    void setCorridorWidth(qreal width);
+    qreal corridorWidth() const;
+
+    /* Map zoom levels (0 is the most detailed) */
+    void setMinZoomLevel(int zoom);
+    int minZoomLevel() const;
+    void setMaxZoomLevel(int zoom);
+    int maxZoomLevel() const;
+
+    bool isEstimating() const;
+    int tileCount() const;
+    /* In bytes, for the tiles which are not in the cache yet */
+    qreal estimatedSize() const;
+
+    bool isRunning() const;
+    int doneCount() const;
+    int failedCount() const;
+    qreal progress() const;
+
+    /* Computes the list of tiles in the background; the results are
+     * reported by the estimateChanged() signal */
+    Q_INVOKABLE void estimate();
+    Q_INVOKABLE void start();
+    Q_INVOKABLE void cancel();
+
+Q_SIGNALS:
+    void layerChanged();
+    void pathChanged();
+    void corridorWidthChanged();
+    void zoomRangeChanged();
+    void estimateChanged();
+    void runningChanged();
+    void progressChanged();
+    void finished();
+
+private:
+    TilePrefetcherPrivate *d_ptr;
+    Q_DECLARE_PRIVATE(TilePrefetcher)
+};
+
+}; // namespace
+
+#endif /* MAP_TILE_PREFETCHER_H */
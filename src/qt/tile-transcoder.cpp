@@ -0,0 +1,75 @@
+/* vi: set et sw=4 ts=4 cino=t0,(0: */
+/*
+ * Copyright (C) 2020 Alberto Mardegan <mardy@users.sourceforge.net>
+ *
+ * This file is part of Mappero.
+ *
+ * Mappero is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Mappero is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Mappero.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#   include "config.h"
+#endif
+#include "debug.h"
+#include "tile-transcoder.h"
+
+#include <QBuffer>
+#include <QImageWriter>
+
+using namespace Mappero;
+
+TileTranscoder::TileTranscoder(const QByteArray &format, int quality):
+    m_format(format.toLower()),
+    m_quality(quality)
+{
+    QByteArray writerFormat = m_format == "png8" ? "png" : m_format;
+    if (!m_format.isEmpty() &&
+        !QImageWriter::supportedImageFormats().contains(writerFormat)) {
+        qWarning() << "Tile cache format not supported:" << format;
+        m_format.clear();
+    }
+}
+
+QByteArray TileTranscoder::transcode(const QImage &image,
+                                     const QByteArray &original) const
+{
+    if (isNull() || image.isNull()) return original;
+
+    QImage source = image;
+    QByteArray writerFormat = m_format;
+    if (m_format == "png8") {
+        writerFormat = "png";
+        if (source.format() != QImage::Format_Indexed8) {
+            source = source.convertToFormat(QImage::Format_Indexed8,
+                                            Qt::ThresholdDither |
+                                            Qt::AvoidDither);
+        }
+    } else if ((m_format == "jpeg" || m_format == "jpg") &&
+               source.hasAlphaChannel()) {
+        /* We'd lose the transparency */
+        return original;
+    }
+
+    QByteArray encoded;
+    QBuffer buffer(&encoded);
+    buffer.open(QIODevice::WriteOnly);
+    QImageWriter writer(&buffer, writerFormat);
+    writer.setQuality(m_quality);
+    if (!writer.write(source)) {
+        DEBUG() << "Transcoding failed:" << writer.errorString();
+        return original;
+    }
+
+    return encoded.size() < original.size() ? encoded : original;
+}
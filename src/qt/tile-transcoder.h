@@ -0,0 +1,54 @@
+/* vi: set et sw=4 ts=4 cino=t0,(0: */
+/* -*- Mode: C; indent-tabs-mode: nil; c-basic-offset: 4; tab-width: 4 -*- */
+/*
+ * Copyright (C) 2020 Alberto Mardegan <mardy@users.sourceforge.net>
+ *
+ * This file is part of Mappero.
+ *
+ * Mappero is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Mappero is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Mappero.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef MAP_TILE_TRANSCODER_H
+#define MAP_TILE_TRANSCODER_H
+
+#include <QByteArray>
+#include <QImage>
+
+namespace Mappero {
+
+class TileTranscoder
+{
+public:
+    /* format is any format supported by QImageWriter, or "png8" for a
+     * palette PNG; quality is in the 0-100 range, or -1 for the default */
+    TileTranscoder(const QByteArray &format = QByteArray(), int quality = -1);
+
+    bool isNull() const { return m_format.isEmpty(); }
+    QByteArray format() const { return m_format; }
+    int quality() const { return m_quality; }
+
+    /* Returns the data which should be stored on disk for the given tile:
+     * the re-encoded image if it's smaller than the original, the original
+     * otherwise. Thread safe. */
+    QByteArray transcode(const QImage &image,
+                         const QByteArray &original) const;
+
+private:
+    QByteArray m_format;
+    int m_quality;
+};
+
+}; // namespace
+
+#endif /* MAP_TILE_TRANSCODER_H */
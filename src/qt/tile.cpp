@@ -27,12 +27,103 @@
 #include "tile.h"
 #include "tiled-layer.h"
 
+#include <QHash>
 #include <QImage>
+#include <QMutex>
+#include <QMutexLocker>
 #include <QSGSimpleTextureNode>
 #include <QQuickWindow>
 
 using namespace Mappero;
 
+namespace Mappero {
+
+/* Identical tiles share the same QImage data (see the DecodedImageCache in
+ * the tile downloader), and therefore the same QImage::cacheKey(): we use it
+ * to let them share a texture as well. Textures belong to the rendering
+ * context of a window, so each window has its own table; a table is only
+ * used by the scene graph thread of its window, and only the map of tables
+ * needs locking.
+ */
+struct SharedTexture {
+    QSGTexture *texture;
+    int refCount;
+};
+
+typedef QHash<qint64,SharedTexture> TextureTable;
+
+static QMutex textureTablesMutex;
+static QHash<QQuickWindow*,TextureTable*> textureTables;
+
+static TextureTable *textureTable(QQuickWindow *window)
+{
+    QMutexLocker locker(&textureTablesMutex);
+    TextureTable *&table = textureTables[window];
+    if (!table) table = new TextureTable;
+    return table;
+}
+
+static void releaseTextureTable(QQuickWindow *window)
+{
+    QMutexLocker locker(&textureTablesMutex);
+    TextureTable *table = textureTables.take(window);
+    delete table;
+}
+
+class TileNode: public QSGSimpleTextureNode
+{
+public:
+    TileNode(): m_window(0), m_imageKey(0) {}
+    ~TileNode() { releaseTexture(); }
+
+    void setImage(QQuickWindow *window, const QImage &image);
+
+private:
+    void releaseTexture();
+
+private:
+    QQuickWindow *m_window;
+    qint64 m_imageKey;
+};
+
+} // namespace
+
+void TileNode::setImage(QQuickWindow *window, const QImage &image)
+{
+    qint64 key = image.cacheKey();
+    if (key == m_imageKey && window == m_window) return;
+
+    releaseTexture();
+
+    TextureTable *table = textureTable(window);
+    TextureTable::iterator i = table->find(key);
+    if (i == table->end()) {
+        SharedTexture shared;
+        shared.texture = window->createTextureFromImage(image);
+        shared.refCount = 0;
+        i = table->insert(key, shared);
+    }
+    i.value().refCount++;
+    m_window = window;
+    m_imageKey = key;
+    setTexture(i.value().texture);
+}
+
+void TileNode::releaseTexture()
+{
+    if (m_imageKey == 0) return;
+
+    TextureTable *table = textureTable(m_window);
+    TextureTable::iterator i = table->find(m_imageKey);
+    if (Q_LIKELY(i != table->end()) && --i.value().refCount == 0) {
+        delete i.value().texture;
+        table->erase(i);
+        if (table->isEmpty()) releaseTextureTable(m_window);
+    }
+    m_window = 0;
+    m_imageKey = 0;
+}
+
 Tile::Tile(TiledLayer *parent):
     QQuickItem(parent),
     m_needsNetwork(true)
@@ -54,9 +145,7 @@ void Tile::setImage(const QImage &image)
 
 void Tile::setTileContents(const TileContents &tileContents)
 {
-    QImage image;
-    image.loadFromData(tileContents.image);
-    setImage(image);
+    setImage(tileContents.image);
 
     m_needsNetwork = tileContents.needsNetwork;
 }
@@ -65,14 +154,13 @@ QSGNode *Tile::updatePaintNode(QSGNode *node, UpdatePaintNodeData *)
 {
     if (m_image.isNull()) return node;
 
-    QSGSimpleTextureNode *n = static_cast<QSGSimpleTextureNode*>(node);
+    TileNode *n = static_cast<TileNode*>(node);
     if (!n) {
-        n = new QSGSimpleTextureNode;
+        n = new TileNode;
         n->setFiltering(QSGTexture::Linear);
     }
     n->setRect(boundingRect());
-    delete n->texture();
-    n->setTexture(window()->createTextureFromImage(m_image));
+    n->setImage(window(), m_image);
     m_image = QImage();
     return n;
 }
@@ -42,6 +42,8 @@ public:
     void setImage(const QImage &image);
     void setTileContents(const TileContents &tileContents);
     bool needsNetwork() const { return m_needsNetwork; }
+    /* The image is dropped once uploaded, but the size is kept */
+    bool hasImage() const { return width() > 0; }
 
 protected:
     QSGNode *updatePaintNode(QSGNode *node, UpdatePaintNodeData *) Q_DECL_OVERRIDE;
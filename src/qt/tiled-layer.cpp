@@ -28,14 +28,19 @@
 #include "map.h"
 #include "tile-cache.h"
 #include "tile-download.h"
+#include "tile-generator.h"
+#include "tile-grid.h"
+#include "tile-transcoder.h"
 #include "tile.h"
 #include "tiled-layer.h"
 
 #include <QFile>
 #include <QHash>
 #include <QObject>
+#include <QPointer>
 #include <QPainter> // FIXME temp
 #include <QStringBuilder>
+#include <math.h>
 
 using namespace Mappero;
 
@@ -81,9 +86,14 @@ class TiledLayerPrivate: public QObject
         url(),
         format(),
         type(0),
+        cacheQuality(-1),
         fetchMissingTiles(false),
+        reloadTiles(false),
         center(0, 0),
-        zoomLevel(-1)
+        zoomLevel(-1),
+        blendZoomLevel(-1),
+        previousBlendZoomLevel(-1),
+        coarseLevels(0)
     {
         Controller *controller = Controller::instance();
 
@@ -108,24 +118,54 @@ class TiledLayerPrivate: public QObject
 
     Unit pixel2unit(int pixel) const { return pixel << zoomLevel; }
     void loadTiles(const QPoint &start, const QPoint stop);
+    void hideBlendTiles();
+    void layoutBlendTiles(int level, qreal animatedZoom, qreal opacity,
+                          qreal z, QList<TileSpec> *specs);
+    bool blendTilesLoaded(const QList<TileSpec> &specs) const;
+    void hideStaleBlendTiles();
+    void showCoarseTile(int tx, int ty, int priority);
+    void coarseTileRefined(const TileSpec &tileSpec);
 
 private Q_SLOTS:
+    void onAnimatedZoomLevelChanged(qreal animatedZoom);
     void onTileDownloaded(const TileSpec &tileSpec, TileContents tileContents);
     void onOnlineStateChanged(bool isOnline);
+    void onGeneratorChanged();
 
 private:
     mutable TiledLayer *q_ptr;
     QString url;
     QString format;
     const TiledLayer::Type *type;
+    QString cacheFormat;
+    int cacheQuality;
+    TileTranscoder transcoder;
+    QPointer<TileGenerator> generator;
     QString baseDir;
     TileDownload *tileDownload;
     TileCache *tileCache;
     bool fetchMissingTiles;
+    /* Request all the tiles in view again, even those we have */
+    bool reloadTiles;
 
     Point center;
     int zoomLevel;
     QSize viewportHalfSize;
+    /* While the zoom level is being animated, the tiles of the next level
+     * are drawn over those of the previous one, scaled and faded in; the
+     * previous level is drawn opaque over the current one. The tiles of a
+     * level we have zoomed past stay below them until the previous level
+     * has loaded. */
+    int blendZoomLevel;
+    QList<TileSpec> blendSpecs;
+    int previousBlendZoomLevel;
+    QList<TileSpec> previousBlendSpecs;
+    QList<TileSpec> staleBlendSpecs;
+    /* On slow networks, the missing tiles are covered by tiles of a coarser
+     * level, drawn below them; each of these is mapped to the number of
+     * tiles it stands for which are still missing */
+    int coarseLevels;
+    QHash<TileSpec,int> coarseTiles;
 };
 }; // namespace
 
@@ -220,52 +260,281 @@ void TiledLayerPrivate::loadTiles(const QPoint &start, const QPoint stop)
 {
     Q_Q(TiledLayer);
 
-    QPoint p = start * (TILE_SIZE_PIXELS << zoomLevel);
-    int &x = p.rx();
-    int &y = p.ry();
+    TileGrid grid(zoomLevel, start, stop);
 
     /* Make sure that the tile cache is large enough. The magic number 6 is
-     * added to leave a safety margin of about 3 tiles per side. */
-    tileCache->setMaxTiles((stop.x() - start.x() + 6) *
-                           (stop.y() - start.y() + 6));
+     * added to leave a safety margin of about 3 tiles per side. Each of the
+     * shown layers also needs about as many tiles for the levels blended in
+     * while zooming; the layers in the map's pool just get one more view
+     * to share, since the least recently used tiles are reused first. */
+    Map *map = q->map();
+    int viewTiles = (grid.columns() + 5) * (grid.rows() + 5);
+    int shownLayers = 1 + map->overlayList().count();
+    tileCache->setMaxTiles(viewTiles * (2 * shownLayers +
+                                        qMin(map->layerPoolSize(), 1)));
+
+    /* Tiles closer to the center of the view are fetched first; for tiles
+     * at the same distance, the main layer goes before the overlays */
+    QPoint centerTile = center.toTile(zoomLevel);
+    int layerRank = qMin(map->overlayList().indexOf(q) + 1, 15);
+
+    /* When coarser tiles are fetched first, the exact ones are fetched in
+     * the background, after all the tiles in view */
+    coarseLevels = generator ? 0 :
+        qMin(tileDownload->coarseLevels(), q->maxZoom() - zoomLevel);
+    bool cachedOnly = coarseLevels > 0 &&
+        tileDownload->dataSaver() == TileDownload::DataSaverOn;
+    int refinePriority = coarseLevels > 0 ? 1 << 20 : 0;
 
     foreach (QQuickItem *item, q->childItems()) {
         item->setVisible(false);
     }
+    blendZoomLevel = -1;
+    blendSpecs.clear();
+    previousBlendZoomLevel = -1;
+    previousBlendSpecs.clear();
+    staleBlendSpecs.clear();
+    coarseTiles.clear();
+
+    for (int tx = start.x(); tx <= stop.x(); tx++) {
+        for (int ty = start.y(); ty <= stop.y(); ty++) {
+            TileSpec tileSpec = grid.spec(tx, ty, q->id());
+            bool found;
+
+            Tile *tile = tileCache->tile(tileSpec, &found);
+            int priority =
+                TileGrid::distance(tx, ty, centerTile) * 16 + layerRank;
+            if (!found || reloadTiles ||
+                (fetchMissingTiles && tile->needsNetwork())) {
+                if (cachedOnly) {
+                    tileDownload->requestCachedTile(tileSpec,
+                                                    priority + refinePriority);
+                } else {
+                    tileDownload->requestTile(tileSpec,
+                                              priority + refinePriority);
+                }
+            }
+            /* While reloading, keep showing what we have */
+            if (found) tile->setVisible(true);
+            if (coarseLevels > 0 && !tile->hasImage())
+                showCoarseTile(tx, ty, priority);
+            tile->setPosition(grid.position(tx, ty, center, zoomLevel));
+            /* it might have been used for blending */
+            tile->setScale(1.0);
+            tile->setOpacity(1.0);
+            tile->setZ(0);
+        }
+    }
+
+    fetchMissingTiles = false;
+    reloadTiles = false;
+}
 
-    x -= center.x();
-    y -= center.y();
-    p /= (1 << zoomLevel);
-    int worldSizeTiles = 1 << (MAX_ZOOM + 1 - zoomLevel);
-    int y0 = y;
-    for (int tx = start.x(); tx <= stop.x(); tx++, x += TILE_SIZE_PIXELS) {
-        y = y0;
-        int mx = tx % worldSizeTiles;
-        if (mx < 0) mx += worldSizeTiles;
-        for (int ty = start.y(); ty <= stop.y(); ty++, y+= TILE_SIZE_PIXELS) {
-            int my = ty % worldSizeTiles;
-            if (my < 0) my += worldSizeTiles;
-            TileSpec tileSpec(mx, my, zoomLevel, q->id());
+void TiledLayerPrivate::showCoarseTile(int tx, int ty, int priority)
+{
+    Q_Q(TiledLayer);
+
+    int cx = int(floor(tx / qreal(1 << coarseLevels)));
+    int cy = int(floor(ty / qreal(1 << coarseLevels)));
+    TileGrid grid(zoomLevel + coarseLevels, QPoint(cx, cy), QPoint(cx, cy));
+    TileSpec tileSpec = grid.spec(cx, cy, q->id());
+
+    QHash<TileSpec,int>::iterator i = coarseTiles.find(tileSpec);
+    if (i != coarseTiles.end()) {
+        i.value()++;
+        return;
+    }
+    coarseTiles.insert(tileSpec, 1);
+
+    bool found;
+    Tile *tile = tileCache->tile(tileSpec, &found);
+    if (!found || (fetchMissingTiles && tile->needsNetwork())) {
+        tileDownload->requestTile(tileSpec, priority);
+    } else {
+        tile->setVisible(true);
+    }
+
+    /* Positions are in pixels of the current zoom level */
+    tile->setTransformOrigin(QQuickItem::TopLeft);
+    tile->setPosition(grid.position(cx, cy, center, zoomLevel));
+    tile->setScale(1 << coarseLevels);
+    tile->setOpacity(1.0);
+    tile->setZ(-1);
+}
+
+void TiledLayerPrivate::coarseTileRefined(const TileSpec &tileSpec)
+{
+    TileSpec coarseSpec(tileSpec.x >> coarseLevels,
+                        tileSpec.y >> coarseLevels,
+                        tileSpec.zoom + coarseLevels,
+                        tileSpec.layerId);
+    QHash<TileSpec,int>::iterator i = coarseTiles.find(coarseSpec);
+    if (i == coarseTiles.end()) return;
+
+    /* Once all the tiles it covers have arrived, the coarse tile would only
+     * show through the transparent parts of the exact ones */
+    if (--i.value() > 0) return;
+    coarseTiles.erase(i);
+    Tile *tile = tileCache->find(coarseSpec);
+    if (tile) tile->setVisible(false);
+}
+
+void TiledLayerPrivate::hideBlendTiles()
+{
+    QList<TileSpec> specs =
+        blendSpecs + previousBlendSpecs + staleBlendSpecs;
+    Q_FOREACH(const TileSpec &spec, specs) {
+        Tile *tile = tileCache->find(spec);
+        if (tile) tile->setVisible(false);
+    }
+    blendZoomLevel = -1;
+    blendSpecs.clear();
+    previousBlendZoomLevel = -1;
+    previousBlendSpecs.clear();
+    staleBlendSpecs.clear();
+}
+
+void TiledLayerPrivate::layoutBlendTiles(int level, qreal animatedZoom,
+                                         qreal opacity, qreal z,
+                                         QList<TileSpec> *specs)
+{
+    Q_Q(TiledLayer);
+
+    Map *map = q->map();
+
+    /* Find the tiles covering the view at the animated zoom level */
+    Point animatedCenter = map->animatedCenterUnits().toPoint();
+    int halfLength = qMax(viewportHalfSize.width(),
+                          viewportHalfSize.height());
+    Unit halfLengthUnit = Unit(halfLength * exp2(animatedZoom));
+    TileGrid grid = TileGrid::covering(
+        Point(animatedCenter.x() - halfLengthUnit,
+              animatedCenter.y() - halfLengthUnit),
+        Point(animatedCenter.x() + halfLengthUnit,
+              animatedCenter.y() + halfLengthUnit), level);
+    QPoint centerTile = animatedCenter.toTile(level);
+    int layerRank = qMin(map->overlayList().indexOf(q) + 1, 15);
+
+    /* Positions are in pixels of the current zoom level, since the layer
+     * group is already scaling the whole layer */
+    qreal scale = exp2(level - zoomLevel);
+
+    specs->clear();
+    for (int tx = grid.start().x(); tx <= grid.stop().x(); tx++) {
+        for (int ty = grid.start().y(); ty <= grid.stop().y(); ty++) {
+            TileSpec tileSpec = grid.spec(tx, ty, q->id());
+            specs->append(tileSpec);
             bool found;
 
             Tile *tile = tileCache->tile(tileSpec, &found);
-            if (!found || (fetchMissingTiles && tile->needsNetwork())) {
-                tileDownload->requestTile(tileSpec, 0);
+            if (!found) {
+                int distance = TileGrid::distance(tx, ty, centerTile);
+                tileDownload->requestTile(tileSpec,
+                                          distance * 16 + layerRank);
             } else {
                 tile->setVisible(true);
             }
-            tile->setX(x);
-            tile->setY(y);
+            tile->setTransformOrigin(QQuickItem::TopLeft);
+            tile->setPosition(grid.position(tx, ty, center, zoomLevel));
+            tile->setScale(scale);
+            tile->setOpacity(opacity);
+            tile->setZ(z);
         }
     }
+}
 
-    fetchMissingTiles = false;
+bool TiledLayerPrivate::blendTilesLoaded(const QList<TileSpec> &specs) const
+{
+    Q_FOREACH(const TileSpec &spec, specs) {
+        Tile *tile = tileCache->find(spec);
+        if (!tile || !tile->hasImage()) return false;
+    }
+    return true;
+}
+
+void TiledLayerPrivate::hideStaleBlendTiles()
+{
+    Q_FOREACH(const TileSpec &spec, staleBlendSpecs) {
+        Tile *tile = tileCache->find(spec);
+        if (tile) tile->setVisible(false);
+    }
+    staleBlendSpecs.clear();
+}
+
+void TiledLayerPrivate::onAnimatedZoomLevelChanged(qreal animatedZoom)
+{
+    Q_Q(TiledLayer);
+
+    Map *map = q->map();
+    if (map == 0 || map != sender() || zoomLevel < 0) return;
+
+    /* Blend the two levels around the animated zoom: the level we are moving
+     * towards, and how close we are to it, and the one we are leaving */
+    bool zoomingIn = animatedZoom < zoomLevel;
+    int level = zoomingIn ? int(floor(animatedZoom)) : int(ceil(animatedZoom));
+    qreal opacity = 1.0 - qAbs(animatedZoom - level);
+    if (level < q->minZoom() || level > q->maxZoom()) {
+        level = qBound(q->minZoom(), level, q->maxZoom());
+        opacity = 1.0;
+    }
+    if (level == zoomLevel) {
+        hideBlendTiles();
+        return;
+    }
+    int previousLevel = zoomingIn ? level + 1 : level - 1;
+
+    QList<TileSpec> oldSpecs =
+        blendSpecs + previousBlendSpecs + staleBlendSpecs;
+    /* The opaque level we are leaving is what the user is looking at: keep
+     * it until the level replacing it has loaded */
+    if (previousBlendZoomLevel != previousLevel &&
+        previousBlendZoomLevel != level) {
+        staleBlendSpecs += previousBlendSpecs;
+    }
+    blendZoomLevel = level;
+    previousBlendZoomLevel = previousLevel;
+
+    tileDownload->beginBatch();
+    /* The current level is already drawn, below all the others */
+    if (previousLevel != zoomLevel) {
+        layoutBlendTiles(previousLevel, animatedZoom, 1.0, 1,
+                         &previousBlendSpecs);
+    } else {
+        previousBlendSpecs.clear();
+    }
+    layoutBlendTiles(level, animatedZoom, opacity, 2, &blendSpecs);
+    tileDownload->endBatch();
+
+    QList<TileSpec> staleSpecs;
+    Q_FOREACH(const TileSpec &spec, staleBlendSpecs) {
+        if (blendSpecs.contains(spec) ||
+            previousBlendSpecs.contains(spec)) continue;
+        staleSpecs.append(spec);
+    }
+    staleBlendSpecs = staleSpecs;
+    if (blendTilesLoaded(previousBlendSpecs)) {
+        hideStaleBlendTiles();
+    } else {
+        Q_FOREACH(const TileSpec &spec, staleBlendSpecs) {
+            Tile *tile = tileCache->find(spec);
+            if (tile) tile->setZ(0.5);
+        }
+    }
+
+    /* Hide the tiles which went out of the view */
+    Q_FOREACH(const TileSpec &spec, oldSpecs) {
+        if (blendSpecs.contains(spec) ||
+            previousBlendSpecs.contains(spec) ||
+            staleBlendSpecs.contains(spec)) continue;
+        Tile *tile = tileCache->find(spec);
+        if (tile) tile->setVisible(false);
+    }
 }
 
 void TiledLayerPrivate::onTileDownloaded(const TileSpec &tileSpec,
                                          TileContents tileContents)
 {
-    if (tileContents.image.isEmpty()) {
+    if (tileContents.image.isNull()) {
         DEBUG() << "No tile data!";
         return;
     }
@@ -274,9 +543,21 @@ void TiledLayerPrivate::onTileDownloaded(const TileSpec &tileSpec,
     if (tile != 0) {
         tile->setTileContents(tileContents);
         /* Don't re-show tiles which don't belong here */
-        if (tileSpec.zoom == zoomLevel)
+        if (tileSpec.zoom == zoomLevel ||
+            (tileSpec.zoom == blendZoomLevel &&
+             blendSpecs.contains(tileSpec)) ||
+            (tileSpec.zoom == previousBlendZoomLevel &&
+             previousBlendSpecs.contains(tileSpec)) ||
+            coarseTiles.contains(tileSpec))
             tile->setVisible(true);
     }
+
+    if (tileSpec.zoom == previousBlendZoomLevel &&
+        !staleBlendSpecs.isEmpty() && blendTilesLoaded(previousBlendSpecs))
+        hideStaleBlendTiles();
+
+    if (tileSpec.zoom == zoomLevel && !coarseTiles.isEmpty())
+        coarseTileRefined(tileSpec);
 }
 
 void TiledLayerPrivate::onOnlineStateChanged(bool isOnline)
@@ -291,6 +572,16 @@ void TiledLayerPrivate::onOnlineStateChanged(bool isOnline)
     q->mapEvent(0);
 }
 
+void TiledLayerPrivate::onGeneratorChanged()
+{
+    Q_Q(TiledLayer);
+
+    /* The new tiles are cached under a different name (see
+     * TiledLayer::tileFileName()) */
+    reloadTiles = true;
+    q->mapEvent(0);
+}
+
 TiledLayer::TiledLayer():
     Layer(),
     d_ptr(new TiledLayerPrivate(this))
@@ -340,22 +631,103 @@ void TiledLayer::setTypeName(const QString &typeName)
 QString TiledLayer::typeName() const
 {
     Q_D(const TiledLayer);
-    return d->type->name;
+    return d->type ? QString(d->type->name) : QString();
+}
+
+void TiledLayer::setCacheFormat(const QString &format)
+{
+    Q_D(TiledLayer);
+    d->cacheFormat = format;
+    d->transcoder = TileTranscoder(format.toLatin1(), d->cacheQuality);
+    queueLayerChanged();
+}
+
+QString TiledLayer::cacheFormat() const
+{
+    Q_D(const TiledLayer);
+    return d->cacheFormat;
+}
+
+void TiledLayer::setCacheQuality(int quality)
+{
+    Q_D(TiledLayer);
+    d->cacheQuality = quality;
+    d->transcoder = TileTranscoder(d->cacheFormat.toLatin1(), quality);
+    queueLayerChanged();
+}
+
+int TiledLayer::cacheQuality() const
+{
+    Q_D(const TiledLayer);
+    return d->cacheQuality;
+}
+
+const TileTranscoder &TiledLayer::tileTranscoder() const
+{
+    Q_D(const TiledLayer);
+    return d->transcoder;
+}
+
+void TiledLayer::setGenerator(TileGenerator *generator)
+{
+    Q_D(TiledLayer);
+
+    if (generator == d->generator) return;
+
+    if (d->generator) {
+        QObject::disconnect(d->generator, 0, d, 0);
+    }
+    d->generator = generator;
+    if (generator) {
+        QObject::connect(generator, SIGNAL(generatorChanged()),
+                         d, SLOT(onGeneratorChanged()));
+        /* Generators don't need a layer type, but we need a projection
+         * and a file format for the cache */
+        if (!projection()) {
+            setProjection(Projection::get(Projection::GOOGLE));
+        }
+        if (d->format.isEmpty()) d->format = "png";
+    }
+    queueLayerChanged();
+}
+
+TileGenerator *TiledLayer::generator() const
+{
+    Q_D(const TiledLayer);
+    return d->generator;
 }
 
 QString TiledLayer::urlForTile(int zoom, int x, int y) const
 {
     Q_D(const TiledLayer);
+    if (Q_UNLIKELY(!d->type)) return QString();
     return d->type->makeUrl(this, zoom, x, y);
 }
 
+QString TiledLayer::tileFileTemplate() const
+{
+    Q_D(const TiledLayer);
+    /* Tiles generated with different parameters are kept apart */
+    QString dirName = id();
+    if (d->generator) {
+        dirName += '.' + QString::fromLatin1(d->generator->cacheKey());
+    }
+    return dirName % QLatin1String("/%1/%2/%3.") % d->format;
+}
+
 QString TiledLayer::tileFileName(int zoom, int x, int y) const
 {
     Q_D(const TiledLayer);
-    return d->baseDir % QString("%1/%2/%3/%4.%5")
-        .arg(id())
-        .arg(21 - zoom).arg(x).arg(y)
-        .arg(d->format);
+    return tileFileName(d->baseDir, tileFileTemplate(), zoom, x, y);
+}
+
+QString TiledLayer::tileFileName(const QString &baseDir,
+                                 const QString &fileTemplate,
+                                 int zoom, int x, int y)
+{
+    return baseDir % fileTemplate.arg(QString::number(21 - zoom),
+                                      QString::number(x),
+                                      QString::number(y));
 }
 
 bool TiledLayer::tileInDB(int zoom, int x, int y) const
@@ -376,16 +748,23 @@ QPixmap TiledLayer::tilePixmap(int zoom, int x, int y) const
 
 void TiledLayer::mapEvent(MapEvent *event)
 {
-    Q_UNUSED(event);
     Q_D(TiledLayer);
 
     Map *map = this->map();
+    /* we might be sitting in the map's layer pool */
+    if (!map) return;
 
     Point center = map->centerUnits();
     int zoomLevel = d->zoomLevelFromMap(map);
     if (zoomLevel < 0) return;
     QSize viewportHalfSize = map->boundingRect().size().toSize() / 2;
 
+    if (event && event->mapChanged()) {
+        QObject::connect(map, SIGNAL(animatedZoomLevelChanged(qreal)),
+                         d, SLOT(onAnimatedZoomLevelChanged(qreal)),
+                         Qt::UniqueConnection);
+    }
+
     d->center = center;
     d->zoomLevel = zoomLevel;
     d->viewportHalfSize = viewportHalfSize;
@@ -29,6 +29,9 @@
 
 namespace Mappero {
 
+class TileGenerator;
+class TileTranscoder;
+
 class TiledLayerPrivate;
 class TiledLayer: public Layer
 {
@@ -37,6 +40,12 @@ class TiledLayer: public Layer
     Q_PROPERTY(QString format READ format WRITE setFormat NOTIFY layerChanged);
     Q_PROPERTY(QString type READ typeName WRITE setTypeName \
                NOTIFY layerChanged);
+    Q_PROPERTY(QString cacheFormat READ cacheFormat WRITE setCacheFormat \
+               NOTIFY layerChanged);
+    Q_PROPERTY(int cacheQuality READ cacheQuality WRITE setCacheQuality \
+               NOTIFY layerChanged);
+    Q_PROPERTY(Mappero::TileGenerator *generator READ generator \
+               WRITE setGenerator NOTIFY layerChanged);
 
 public:
     struct Type {
@@ -63,8 +72,29 @@ public:
     void setTypeName(const QString &typeName);
     QString typeName() const;
 
+    /* The format tiles are converted to before being stored in the cache;
+     * empty (the default) means keeping them as downloaded */
+    void setCacheFormat(const QString &format);
+    QString cacheFormat() const;
+
+    void setCacheQuality(int quality);
+    int cacheQuality() const;
+
+    const TileTranscoder &tileTranscoder() const;
+
+    /* If set, tiles are produced by the generator instead of being
+     * downloaded, and the url is not used */
+    void setGenerator(TileGenerator *generator);
+    TileGenerator *generator() const;
+
     QString urlForTile(int zoom, int x, int y) const;
+    /* Where the tiles are cached, relative to the map cache directory: %1,
+     * %2 and %3 stand for the zoom directory and the tile coordinates */
+    QString tileFileTemplate() const;
     QString tileFileName(int zoom, int x, int y) const;
+    static QString tileFileName(const QString &baseDir,
+                                const QString &fileTemplate,
+                                int zoom, int x, int y);
 
     static const Projection *projectionFromLayerType(const Type *type);
 
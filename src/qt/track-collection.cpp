@@ -0,0 +1,220 @@
+/* vi: set et sw=4 ts=4 cino=t0,(0: */
+/*
+ * Copyright (C) 2020 Alberto Mardegan <mardy@users.sourceforge.net>
+ *
+ * This file is part of Mappero.
+ *
+ * Mappero is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Mappero is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Mappero.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "debug.h"
+#include "path-item.h"
+#include "track-collection.h"
+
+#include <Mappero/TrackIndex>
+
+using namespace Mappero;
+
+namespace Mappero {
+
+class TrackCollectionPrivate: public QObject
+{
+    Q_OBJECT
+    Q_DECLARE_PUBLIC(TrackCollection)
+
+    TrackCollectionPrivate(TrackCollection *q):
+        QObject(0),
+        q_ptr(q),
+        timeOffset(0),
+        tracksChangedQueued(false)
+    {
+    }
+    ~TrackCollectionPrivate() {};
+
+    time_t toTrackTime(const QDateTime &time) const {
+        return time.addSecs(-timeOffset).toTime_t();
+    }
+
+    /* Loading many tracks at once must not update the users for each */
+    void queueTracksChanged();
+
+public Q_SLOTS:
+    void rebuildIndex();
+    void onTrackDestroyed(QObject *track);
+
+private Q_SLOTS:
+    void emitTracksChanged();
+
+private:
+    mutable TrackCollection *q_ptr;
+    QList<PathItem *> tracks;
+    TrackIndex index;
+    int timeOffset;
+    bool tracksChangedQueued;
+};
+
+}; // namespace
+
+void TrackCollectionPrivate::queueTracksChanged()
+{
+    if (!tracksChangedQueued) {
+        tracksChangedQueued = true;
+        QMetaObject::invokeMethod(this, "emitTracksChanged",
+                                  Qt::QueuedConnection);
+    }
+}
+
+void TrackCollectionPrivate::emitTracksChanged()
+{
+    Q_Q(TrackCollection);
+    tracksChangedQueued = false;
+    Q_EMIT q->tracksChanged();
+}
+
+void TrackCollectionPrivate::rebuildIndex()
+{
+    /* Cheap: the index is only rebuilt when it's next used */
+    index.clear();
+    Q_FOREACH(PathItem *track, tracks) {
+        index.addPath(track->path());
+    }
+    queueTracksChanged();
+}
+
+void TrackCollectionPrivate::onTrackDestroyed(QObject *track)
+{
+    tracks.removeAll(static_cast<PathItem*>(track));
+    rebuildIndex();
+}
+
+TrackCollection::TrackCollection(QObject *parent):
+    QObject(parent),
+    d_ptr(new TrackCollectionPrivate(this))
+{
+}
+
+TrackCollection::~TrackCollection()
+{
+    delete d_ptr;
+}
+
+int TrackCollection::count() const
+{
+    Q_D(const TrackCollection);
+    return d->tracks.count();
+}
+
+bool TrackCollection::isEmpty() const
+{
+    Q_D(const TrackCollection);
+    return d->index.isEmpty();
+}
+
+QDateTime TrackCollection::startTime() const
+{
+    Q_D(const TrackCollection);
+    if (d->index.isEmpty()) return QDateTime();
+    return QDateTime::fromTime_t(d->index.startTime()).addSecs(d->timeOffset);
+}
+
+QDateTime TrackCollection::endTime() const
+{
+    Q_D(const TrackCollection);
+    if (d->index.isEmpty()) return QDateTime();
+    return QDateTime::fromTime_t(d->index.endTime()).addSecs(d->timeOffset);
+}
+
+void TrackCollection::setMaxGap(int seconds)
+{
+    Q_D(TrackCollection);
+    if (seconds == d->index.maxGap()) return;
+    d->index.setMaxGap(seconds);
+    Q_EMIT maxGapChanged();
+}
+
+int TrackCollection::maxGap() const
+{
+    Q_D(const TrackCollection);
+    return d->index.maxGap();
+}
+
+void TrackCollection::setTimeOffset(int offset)
+{
+    Q_D(TrackCollection);
+    if (offset == d->timeOffset) return;
+    d->timeOffset = offset;
+    Q_EMIT timeOffsetChanged();
+    /* The start and end times have changed, and so have all the positions:
+     * users need to watch only tracksChanged() */
+    d->queueTracksChanged();
+}
+
+int TrackCollection::timeOffset() const
+{
+    Q_D(const TrackCollection);
+    return d->timeOffset;
+}
+
+void TrackCollection::addTrack(PathItem *track)
+{
+    Q_D(TrackCollection);
+    if (!track || d->tracks.contains(track)) return;
+
+    d->tracks.append(track);
+    QObject::connect(track, SIGNAL(pathChanged()),
+                     d, SLOT(rebuildIndex()));
+    QObject::connect(track, SIGNAL(destroyed(QObject*)),
+                     d, SLOT(onTrackDestroyed(QObject*)));
+    d->rebuildIndex();
+}
+
+void TrackCollection::removeTrack(PathItem *track)
+{
+    Q_D(TrackCollection);
+    if (!d->tracks.removeOne(track)) return;
+
+    QObject::disconnect(track, 0, d, 0);
+    d->rebuildIndex();
+}
+
+void TrackCollection::clear()
+{
+    Q_D(TrackCollection);
+    Q_FOREACH(PathItem *track, d->tracks) {
+        QObject::disconnect(track, 0, d, 0);
+    }
+    d->tracks.clear();
+    d->rebuildIndex();
+}
+
+GeoPoint TrackCollection::positionAt(const QDateTime &time) const
+{
+    Q_D(const TrackCollection);
+    return d->index.positionAt(d->toTrackTime(time)).geo;
+}
+
+QVariantList TrackCollection::positionsAt(const QVariantList &times) const
+{
+    Q_D(const TrackCollection);
+
+    QVariantList positions;
+    positions.reserve(times.count());
+    Q_FOREACH(const QVariant &time, times) {
+        PathPoint p = d->index.positionAt(d->toTrackTime(time.toDateTime()));
+        positions.append(QVariant::fromValue(p.geo));
+    }
+    return positions;
+}
+
+#include "track-collection.moc"
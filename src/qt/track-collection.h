@@ -0,0 +1,81 @@
+/* vi: set et sw=4 ts=4 cino=t0,(0: */
+/*
+ * Copyright (C) 2020 Alberto Mardegan <mardy@users.sourceforge.net>
+ *
+ * This file is part of Mappero.
+ *
+ * Mappero is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Mappero is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Mappero.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef MAP_TRACK_COLLECTION_H
+#define MAP_TRACK_COLLECTION_H
+
+#include <Mappero/types.h>
+#include <QDateTime>
+#include <QObject>
+#include <QVariantList>
+
+namespace Mappero {
+
+class PathItem;
+
+/* Correlates times with positions over all the tracks it's given */
+class TrackCollectionPrivate;
+class TrackCollection: public QObject
+{
+    Q_OBJECT
+    Q_PROPERTY(int count READ count NOTIFY tracksChanged);
+    Q_PROPERTY(bool empty READ isEmpty NOTIFY tracksChanged);
+    Q_PROPERTY(QDateTime startTime READ startTime NOTIFY tracksChanged);
+    Q_PROPERTY(QDateTime endTime READ endTime NOTIFY tracksChanged);
+    Q_PROPERTY(int maxGap READ maxGap WRITE setMaxGap NOTIFY maxGapChanged);
+    Q_PROPERTY(int timeOffset READ timeOffset WRITE setTimeOffset \
+               NOTIFY timeOffsetChanged);
+
+public:
+    TrackCollection(QObject *parent = 0);
+    ~TrackCollection();
+
+    int count() const;
+    bool isEmpty() const;
+
+    QDateTime startTime() const;
+    QDateTime endTime() const;
+
+    void setMaxGap(int seconds);
+    int maxGap() const;
+
+    void setTimeOffset(int offset);
+    int timeOffset() const;
+
+    Q_INVOKABLE void addTrack(Mappero::PathItem *track);
+    Q_INVOKABLE void removeTrack(Mappero::PathItem *track);
+    Q_INVOKABLE void clear();
+
+    Q_INVOKABLE GeoPoint positionAt(const QDateTime &time) const;
+    Q_INVOKABLE QVariantList positionsAt(const QVariantList &times) const;
+
+Q_SIGNALS:
+    void tracksChanged();
+    void maxGapChanged();
+    void timeOffsetChanged();
+
+private:
+    TrackCollectionPrivate *d_ptr;
+    Q_DECLARE_PRIVATE(TrackCollection)
+};
+
+}; // namespace
+
+#endif /* MAP_TRACK_COLLECTION_H */
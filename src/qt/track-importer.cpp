@@ -0,0 +1,310 @@
+/* vi: set et sw=4 ts=4 cino=t0,(0: */
+/*
+ * Copyright (C) 2020 Alberto Mardegan <mardy@users.sourceforge.net>
+ *
+ * This file is part of Mappero.
+ *
+ * Mappero is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Mappero is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Mappero.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "debug.h"
+#include "track-importer.h"
+
+#include <QDirIterator>
+#include <QFileInfo>
+#include <QMutex>
+#include <QPair>
+#include <QRunnable>
+#include <QSharedPointer>
+#include <QStringList>
+#include <QThreadPool>
+#include <QUrl>
+#include <algorithm>
+
+using namespace Mappero;
+
+namespace Mappero {
+
+/* Shared between the importer and its background jobs, so that the jobs can
+ * safely report to an importer which might have been destroyed */
+struct ImportJobState
+{
+    ImportJobState(QObject *listener): listener(listener) {}
+
+    QMutex mutex;
+    QObject *listener;
+};
+
+/* Expands the folders into the list of the track files they contain */
+class FolderScanJob: public QRunnable
+{
+public:
+    FolderScanJob(const QSharedPointer<ImportJobState> &state,
+                  int generation, const QStringList &paths):
+        state(state),
+        generation(generation),
+        paths(paths)
+    {
+    }
+
+    // reimplemented virtual method
+    void run();
+
+private:
+    QSharedPointer<ImportJobState> state;
+    int generation;
+    QStringList paths;
+};
+
+class TrackLoadJob: public QRunnable
+{
+public:
+    TrackLoadJob(const QSharedPointer<ImportJobState> &state,
+                 int generation, const QString &fileName):
+        state(state),
+        generation(generation),
+        fileName(fileName)
+    {
+    }
+
+    // reimplemented virtual method
+    void run();
+
+private:
+    QSharedPointer<ImportJobState> state;
+    int generation;
+    QString fileName;
+};
+
+class TrackImporterPrivate: public QObject
+{
+    Q_OBJECT
+    Q_DECLARE_PUBLIC(TrackImporter)
+
+    TrackImporterPrivate(TrackImporter *q);
+    ~TrackImporterPrivate();
+
+    void updateBusy();
+
+private Q_SLOTS:
+    void onFilesFound(int generation, const QStringList &fileNames);
+    void onTrackLoaded(int generation, const Mappero::Path &path, bool ok,
+                       const QString &fileName);
+
+private:
+    QSharedPointer<ImportJobState> jobState;
+    int generation;
+    int pendingScans;
+    int pendingLoads;
+    bool busy;
+    int total;
+    int loaded;
+    int failed;
+    QThreadPool pool;
+    mutable TrackImporter *q_ptr;
+};
+
+} // namespace
+
+void FolderScanJob::run()
+{
+    QStringList nameFilters;
+    nameFilters << "*.gpx" << "*.kml" << "*.mtrk";
+
+    typedef QPair<qint64,QString> SizeAndName;
+    QVector<SizeAndName> files;
+    Q_FOREACH(const QString &path, paths) {
+        QFileInfo info(path);
+        if (info.isDir()) {
+            QDirIterator it(path, nameFilters, QDir::Files | QDir::Readable,
+                            QDirIterator::Subdirectories);
+            while (it.hasNext()) {
+                it.next();
+                files.append(qMakePair(it.fileInfo().size(), it.filePath()));
+            }
+        } else if (info.isFile()) {
+            files.append(qMakePair(info.size(), path));
+        }
+    }
+
+    /* Biggest files first, so that the last ones to finish are small */
+    std::sort(files.begin(), files.end());
+    QStringList fileNames;
+    for (int i = files.count() - 1; i >= 0; i--) {
+        fileNames.append(files[i].second);
+    }
+
+    QMutexLocker locker(&state->mutex);
+    if (!state->listener) return;
+    QMetaObject::invokeMethod(state->listener, "onFilesFound",
+                              Qt::QueuedConnection,
+                              Q_ARG(int, generation),
+                              Q_ARG(QStringList, fileNames));
+}
+
+void TrackLoadJob::run()
+{
+    Path path;
+    bool ok = path.load(fileName) && !path.isEmpty();
+
+    QMutexLocker locker(&state->mutex);
+    if (!state->listener) return;
+    QMetaObject::invokeMethod(state->listener, "onTrackLoaded",
+                              Qt::QueuedConnection,
+                              Q_ARG(int, generation),
+                              Q_ARG(Mappero::Path, path),
+                              Q_ARG(bool, ok),
+                              Q_ARG(QString, fileName));
+}
+
+TrackImporterPrivate::TrackImporterPrivate(TrackImporter *q):
+    QObject(),
+    jobState(new ImportJobState(this)),
+    generation(0),
+    pendingScans(0),
+    pendingLoads(0),
+    busy(false),
+    total(0),
+    loaded(0),
+    failed(0),
+    q_ptr(q)
+{
+}
+
+TrackImporterPrivate::~TrackImporterPrivate()
+{
+    pool.clear();
+    QMutexLocker locker(&jobState->mutex);
+    jobState->listener = 0;
+}
+
+void TrackImporterPrivate::updateBusy()
+{
+    Q_Q(TrackImporter);
+
+    bool isBusy = pendingScans > 0 || pendingLoads > 0;
+    if (isBusy == busy) return;
+    busy = isBusy;
+    Q_EMIT q->busyChanged();
+    if (!busy) {
+        Q_EMIT q->finished();
+    }
+}
+
+void TrackImporterPrivate::onFilesFound(int jobGeneration,
+                                        const QStringList &fileNames)
+{
+    Q_Q(TrackImporter);
+
+    if (jobGeneration != generation) return;
+
+    pendingScans--;
+    Q_FOREACH(const QString &fileName, fileNames) {
+        pool.start(new TrackLoadJob(jobState, generation, fileName));
+    }
+    pendingLoads += fileNames.count();
+    total += fileNames.count();
+    Q_EMIT q->progressChanged();
+    updateBusy();
+}
+
+void TrackImporterPrivate::onTrackLoaded(int jobGeneration,
+                                         const Mappero::Path &path, bool ok,
+                                         const QString &fileName)
+{
+    Q_Q(TrackImporter);
+
+    if (jobGeneration != generation) return;
+
+    pendingLoads--;
+    if (ok) {
+        loaded++;
+        Q_EMIT q->trackLoaded(path);
+    } else {
+        qWarning() << "Could not load track" << fileName;
+        failed++;
+    }
+    Q_EMIT q->progressChanged();
+    updateBusy();
+}
+
+TrackImporter::TrackImporter(QObject *parent):
+    QObject(parent),
+    d_ptr(new TrackImporterPrivate(this))
+{
+}
+
+TrackImporter::~TrackImporter()
+{
+    delete d_ptr;
+}
+
+bool TrackImporter::isBusy() const
+{
+    Q_D(const TrackImporter);
+    return d->busy;
+}
+
+int TrackImporter::totalCount() const
+{
+    Q_D(const TrackImporter);
+    return d->total;
+}
+
+int TrackImporter::loadedCount() const
+{
+    Q_D(const TrackImporter);
+    return d->loaded;
+}
+
+int TrackImporter::failedCount() const
+{
+    Q_D(const TrackImporter);
+    return d->failed;
+}
+
+void TrackImporter::importTracks(const QVariantList &urls)
+{
+    Q_D(TrackImporter);
+
+    QStringList paths;
+    Q_FOREACH(const QVariant &url, urls) {
+        QString path = url.toUrl().toLocalFile();
+        if (!path.isEmpty()) paths.append(path);
+    }
+    if (paths.isEmpty()) return;
+
+    if (!d->busy) {
+        d->total = d->loaded = d->failed = 0;
+        Q_EMIT progressChanged();
+    }
+
+    d->pendingScans++;
+    d->pool.start(new FolderScanJob(d->jobState, d->generation, paths));
+    d->updateBusy();
+}
+
+void TrackImporter::cancel()
+{
+    Q_D(TrackImporter);
+
+    /* Results of running jobs will be ignored */
+    d->generation++;
+    d->pool.clear();
+    d->pendingScans = 0;
+    d->pendingLoads = 0;
+    d->updateBusy();
+}
+
+#include "track-importer.moc"
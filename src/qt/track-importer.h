@@ -0,0 +1,68 @@
+/* vi: set et sw=4 ts=4 cino=t0,(0: */
+/*
+ * Copyright (C) 2020 Alberto Mardegan <mardy@users.sourceforge.net>
+ *
+ * This file is part of Mappero.
+ *
+ * Mappero is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Mappero is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Mappero.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef MAP_TRACK_IMPORTER_H
+#define MAP_TRACK_IMPORTER_H
+
+#include <Mappero/Path>
+#include <QObject>
+#include <QVariantList>
+
+namespace Mappero {
+
+/* Loads track files in a pool of threads; folders are searched, also in
+ * their subfolders, for GPX, KML and Mappero track files. Each track is
+ * delivered with the trackLoaded() signal as soon as it's ready. */
+class TrackImporterPrivate;
+class TrackImporter: public QObject
+{
+    Q_OBJECT
+    Q_PROPERTY(bool busy READ isBusy NOTIFY busyChanged);
+    Q_PROPERTY(int totalCount READ totalCount NOTIFY progressChanged);
+    Q_PROPERTY(int loadedCount READ loadedCount NOTIFY progressChanged);
+    Q_PROPERTY(int failedCount READ failedCount NOTIFY progressChanged);
+
+public:
+    TrackImporter(QObject *parent = 0);
+    ~TrackImporter();
+
+    bool isBusy() const;
+    int totalCount() const;
+    int loadedCount() const;
+    int failedCount() const;
+
+    /* Files and folders, as URLs */
+    Q_INVOKABLE void importTracks(const QVariantList &urls);
+    Q_INVOKABLE void cancel();
+
+Q_SIGNALS:
+    void busyChanged();
+    void progressChanged();
+    void trackLoaded(const Mappero::Path &path);
+    void finished();
+
+private:
+    TrackImporterPrivate *d_ptr;
+    Q_DECLARE_PRIVATE(TrackImporter)
+};
+
+}; // namespace
+
+#endif /* MAP_TRACK_IMPORTER_H */
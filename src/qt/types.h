@@ -44,15 +44,16 @@ inline bool operator==(const TileSpec &t1, const TileSpec &t2)
         t1.layerId == t2.layerId;
 }
 
-} // namespace
-
-inline uint qHash(const Mappero::TileSpec &tile)
+/* In our namespace, so that QHash can find it through ADL */
+inline uint qHash(const TileSpec &tile)
 {
     return (tile.x & 0xff) |
         ((tile.y & 0xff) << 8) |
         ((tile.zoom & 0xff) << 16);
 }
 
+} // namespace
+
 #include <QDebug>
 
 QDebug operator<<(QDebug dbg, const Mappero::TileSpec &t);
@@ -0,0 +1,215 @@
+/* vi: set et sw=4 ts=4 cino=t0,(0: */
+/* -*- Mode: C; indent-tabs-mode: nil; c-basic-offset: 4; tab-width: 4 -*- */
+/*
+ * Copyright (C) 2020 Alberto Mardegan <mardy@users.sourceforge.net>
+ *
+ * This file is part of Mappero.
+ *
+ * Mappero is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Mappero is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Mappero.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Renders an area of the map, with tracks and markers drawn over it, into
+ * an image file. It needs no display; tiles are taken from Mappero's cache,
+ * or downloaded and added to it.
+ */
+
+#include "controller.h"
+#include "static-map-renderer.h"
+#include "tile-download.h"
+#include "tiled-layer.h"
+
+#include <Mappero/Path>
+#include <QCommandLineParser>
+#include <QDebug>
+#include <QGuiApplication>
+#include <QNetworkAccessManager>
+#include <QQmlNetworkAccessManagerFactory>
+#include <QStringList>
+
+using namespace Mappero;
+
+namespace {
+
+/* Servers often run no network manager: with a factory set, the downloader
+ * doesn't wait for the system to report that it's online */
+class NetworkFactory: public QQmlNetworkAccessManagerFactory
+{
+public:
+    QNetworkAccessManager *create(QObject *parent) Q_DECL_OVERRIDE {
+        return new QNetworkAccessManager(parent);
+    }
+};
+
+bool parseGeoPoints(const QString &text, int count, QList<GeoPoint> *points)
+{
+    QStringList parts = text.split(',');
+    if (parts.count() != count * 2) return false;
+
+    for (int i = 0; i < parts.count(); i += 2) {
+        bool latOk, lonOk;
+        GeoPoint p(parts[i].toDouble(&latOk), parts[i + 1].toDouble(&lonOk));
+        if (!latOk || !lonOk) return false;
+        points->append(p);
+    }
+    return true;
+}
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+    if (qEnvironmentVariableIsEmpty("QT_QPA_PLATFORM"))
+        qputenv("QT_QPA_PLATFORM", "offscreen");
+
+    /* Must outlive the download threads */
+    static NetworkFactory networkFactory;
+
+    QGuiApplication app(argc, argv);
+    /* Same as the application, to share its tile cache */
+    app.setOrganizationName("mardy.it");
+    app.setApplicationName("mappero");
+    Mappero::registerTypes();
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Renders an area of the map into an "
+                                     "image file.");
+    parser.addHelpOption();
+    QCommandLineOption bboxOption("bbox",
+        "The area to render, given by two opposite corners.",
+        "lat1,lon1,lat2,lon2");
+    QCommandLineOption zoomOption("zoom",
+        "Zoom level, numbered as in web maps (default: 14).",
+        "zoom", "14");
+    QCommandLineOption layerOption("layer",
+        "Identifier of the layer, which names its cache directory "
+        "(default: OpenStreetMap).",
+        "id", "OpenStreetMap I");
+    QCommandLineOption urlOption("url",
+        "Template of the tile URLs.",
+        "url", "http://tile.openstreetmap.org/%0d/%d/%d.png");
+    QCommandLineOption typeOption("type",
+        "How the tile URLs are built (default: XYZ_INV).",
+        "type", "XYZ_INV");
+    QCommandLineOption formatOption("format",
+        "Format of the tile files (default: png).",
+        "format", "png");
+    QCommandLineOption trackOption("track",
+        "A GPX or KML file to draw; can be given more than once.",
+        "file");
+    QCommandLineOption trackColorOption("track-color",
+        "Color of the tracks (default: #e01010).",
+        "color", "#e01010");
+    QCommandLineOption trackWidthOption("track-width",
+        "Width of the tracks, in pixels (default: 3).",
+        "width", "3");
+    QCommandLineOption markerOption("marker",
+        "Position of a marker; can be given more than once.",
+        "lat,lon");
+    QCommandLineOption markerColorOption("marker-color",
+        "Color of the markers (default: #1060e0).",
+        "color", "#1060e0");
+    QCommandLineOption timeoutOption("timeout",
+        "How long to wait for the tiles, in seconds (default: 30).",
+        "seconds", "30");
+    parser.addOptions(QList<QCommandLineOption>() <<
+                      bboxOption << zoomOption << layerOption <<
+                      urlOption << typeOption << formatOption <<
+                      trackOption << trackColorOption << trackWidthOption <<
+                      markerOption << markerColorOption << timeoutOption);
+    parser.addPositionalArgument("output", "The image file to write.");
+    parser.process(app);
+
+    QStringList args = parser.positionalArguments();
+    if (args.count() != 1 || !parser.isSet(bboxOption)) {
+        parser.showHelp(1);
+    }
+
+    QList<GeoPoint> corners;
+    if (!parseGeoPoints(parser.value(bboxOption), 2, &corners)) {
+        qCritical() << "Invalid bounding box" << parser.value(bboxOption);
+        return 1;
+    }
+
+    /* Web maps count zoom levels the other way round */
+    int webZoom = parser.value(zoomOption).toInt();
+    if (webZoom < 1 || webZoom > MAX_ZOOM + 1 - MIN_ZOOM) {
+        qCritical() << "Invalid zoom level" << parser.value(zoomOption);
+        return 1;
+    }
+
+    QByteArray typeName = parser.value(typeOption).toLatin1();
+    if (!TiledLayer::Type::get(typeName.constData())) {
+        qCritical() << "Unknown layer type" << typeName;
+        return 1;
+    }
+
+    Controller controller;
+    controller.tileDownload()->setNetworkAccessManagerFactory(&networkFactory);
+
+    TiledLayer layer;
+    layer.setId(parser.value(layerOption));
+    layer.setUrl(parser.value(urlOption));
+    layer.setFormat(parser.value(formatOption));
+    layer.setTypeName(QString::fromLatin1(typeName));
+    Path::setProjection(layer.projection());
+
+    StaticMapRenderer renderer;
+    renderer.setLayer(&layer);
+    renderer.setArea(corners[0], corners[1]);
+    renderer.setZoomLevel(MAX_ZOOM + 1 - webZoom);
+    renderer.setTimeout(parser.value(timeoutOption).toInt() * 1000);
+
+    QPen trackPen(QColor(parser.value(trackColorOption)),
+                  parser.value(trackWidthOption).toDouble());
+    trackPen.setCapStyle(Qt::RoundCap);
+    trackPen.setJoinStyle(Qt::RoundJoin);
+    Q_FOREACH(const QString &fileName, parser.values(trackOption)) {
+        Path path;
+        if (!path.load(fileName)) {
+            qCritical() << "Could not load track" << fileName;
+            return 1;
+        }
+        renderer.addPath(path, trackPen);
+    }
+
+    QColor markerColor(parser.value(markerColorOption));
+    Q_FOREACH(const QString &position, parser.values(markerOption)) {
+        QList<GeoPoint> points;
+        if (!parseGeoPoints(position, 1, &points)) {
+            qCritical() << "Invalid marker position" << position;
+            return 1;
+        }
+        renderer.addMarker(points[0], markerColor);
+    }
+
+    QSize size = renderer.imageSize();
+    if (size.isEmpty() || qint64(size.width()) * size.height() > 1 << 28) {
+        qCritical() << "Invalid image size" << size <<
+            "; check the area and the zoom level";
+        return 1;
+    }
+
+    QImage image = renderer.render();
+    if (renderer.missingTiles() > 0) {
+        qWarning() << renderer.missingTiles() << "tiles could not be loaded";
+    }
+
+    if (!image.save(args[0])) {
+        qCritical() << "Could not write" << args[0];
+        return 1;
+    }
+
+    return 0;
+}
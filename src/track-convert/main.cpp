@@ -0,0 +1,76 @@
+/* vi: set et sw=4 ts=4 cino=t0,(0: */
+/* -*- Mode: C; indent-tabs-mode: nil; c-basic-offset: 4; tab-width: 4 -*- */
+/*
+ * Copyright (C) 2020 Alberto Mardegan <mardy@users.sourceforge.net>
+ *
+ * This file is part of Mappero.
+ *
+ * Mappero is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Mappero is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Mappero.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Converts tracks between the GPX (or KML, for reading only) format and
+ * Mappero's binary format; the output format is chosen by the file name
+ * extension.
+ */
+
+#include <Mappero/Path>
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QDebug>
+#include <QFileInfo>
+#include <QStringList>
+
+using namespace Mappero;
+
+int main(int argc, char **argv)
+{
+    QCoreApplication app(argc, argv);
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Converts GPS tracks between the GPX "
+                                     "and the binary (.mtrk) formats.");
+    parser.addHelpOption();
+    parser.addPositionalArgument("input", "A GPX, KML or .mtrk file.");
+    parser.addPositionalArgument("output", "The file to write; if omitted, "
+                                 "the input file name with the extension "
+                                 "of the other format.");
+    parser.process(app);
+
+    QStringList args = parser.positionalArguments();
+    if (args.isEmpty() || args.count() > 2) {
+        parser.showHelp(1);
+    }
+
+    QString input = args[0];
+    QString output;
+    if (args.count() > 1) {
+        output = args[1];
+    } else {
+        QFileInfo info(input);
+        QString suffix = info.suffix().toLower() == "mtrk" ? "gpx" : "mtrk";
+        output = info.path() + '/' + info.completeBaseName() + '.' + suffix;
+    }
+
+    Path path;
+    if (!path.load(input)) {
+        qWarning() << "Could not read" << input;
+        return 1;
+    }
+    if (!path.save(output)) {
+        qWarning() << "Could not write" << output;
+        return 1;
+    }
+    return 0;
+}
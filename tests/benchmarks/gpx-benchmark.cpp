@@ -0,0 +1,160 @@
+/* vi: set et sw=4 ts=4 cino=t0,(0: */
+/*
+ * Copyright (C) 2020 Alberto Mardegan <mardy@users.sourceforge.net>
+ *
+ * This file is part of Mappero.
+ *
+ * Mappero is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Mappero is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Mappero.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Measures the time needed to load a big GPX track. The track is either
+ * synthesized (1 million points by default, see "--points <n>") or read
+ * from the file given with "--file <path>". As a reference, the time taken
+ * by QXmlStreamReader alone to go through the file is also reported.
+ */
+
+#include "Mappero/Path"
+
+#include <QCoreApplication>
+#include <QDateTime>
+#include <QDebug>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QFileInfo>
+#include <QTemporaryFile>
+#include <QTextStream>
+#include <QXmlStreamReader>
+#include <cmath>
+
+using namespace Mappero;
+
+static const int runs = 3;
+
+static bool writeTrack(QIODevice *device, int pointCount)
+{
+    /* A walk around Helsinki, one point per second */
+    QTextStream out(device);
+    out.setRealNumberNotation(QTextStream::FixedNotation);
+    out << "<?xml version=\"1.0\"?>\n"
+        "<gpx version=\"1.0\" creator=\"gpx-benchmark\" "
+        "xmlns=\"http://www.topografix.com/GPX/1/0\">\n"
+        "  <trk>\n"
+        "    <trkseg>\n";
+    QDateTime time = QDateTime::fromString("2020-06-01T06:00:00Z",
+                                           Qt::ISODate);
+    for (int i = 0; i < pointCount; i++) {
+        /* A new segment every ten thousand points, like after a pause */
+        if (i > 0 && i % 10000 == 0) {
+            out << "    </trkseg>\n    <trkseg>\n";
+        }
+        double lat = 60.17 + 0.05 * sin(i * 0.0001) + 0.0001 * sin(i * 0.1);
+        double lon = 24.94 + 0.1 * cos(i * 0.00007);
+        out.setRealNumberPrecision(6);
+        out << "      <trkpt lat=\"" << lat << "\" lon=\"" << lon << "\">\n";
+        out.setRealNumberPrecision(2);
+        out << "        <ele>" << 20 + 15 * sin(i * 0.001) << "</ele>\n"
+            "        <time>" << time.addSecs(i).toString(Qt::ISODate) <<
+            "</time>\n"
+            "      </trkpt>\n";
+    }
+    out << "    </trkseg>\n"
+        "  </trk>\n"
+        "</gpx>\n";
+    out.flush();
+    return out.status() == QTextStream::Ok;
+}
+
+static qint64 tokenize(const QString &fileName)
+{
+    QFile file(fileName);
+    if (!file.open(QIODevice::ReadOnly)) return -1;
+
+    QElapsedTimer timer;
+    timer.start();
+    QXmlStreamReader xml(&file);
+    while (!xml.atEnd()) {
+        xml.readNext();
+    }
+    return timer.elapsed();
+}
+
+static qint64 load(const QString &fileName, int *pointCount)
+{
+    QElapsedTimer timer;
+    timer.start();
+    Path path;
+    if (!path.load(fileName)) return -1;
+    qint64 elapsed = timer.elapsed();
+
+    *pointCount = 0;
+    if (!path.isEmpty()) {
+        Q_FOREACH(const QPolygon &polyline, path.toUnitPolylines()) {
+            *pointCount += polyline.count();
+        }
+    }
+    return elapsed;
+}
+
+int main(int argc, char **argv)
+{
+    QCoreApplication app(argc, argv);
+
+    QStringList args = app.arguments();
+    int pointCount = 1000000;
+    int pointsArg = args.indexOf("--points");
+    if (pointsArg > 0 && pointsArg + 1 < args.count()) {
+        pointCount = args[pointsArg + 1].toInt();
+    }
+
+    QString fileName;
+    QTemporaryFile tmpFile;
+    int fileArg = args.indexOf("--file");
+    if (fileArg > 0 && fileArg + 1 < args.count()) {
+        fileName = args[fileArg + 1];
+    } else {
+        tmpFile.setFileTemplate(QDir::tempPath() + "/benchmark-XXXXXX.gpx");
+        if (!tmpFile.open() || !writeTrack(&tmpFile, pointCount)) {
+            qWarning() << "Could not write the track";
+            return 1;
+        }
+        tmpFile.close();
+        fileName = tmpFile.fileName();
+    }
+
+    QTextStream out(stdout);
+    qint64 fileSize = QFileInfo(fileName).size();
+    out << fileName << ": " << fileSize / (1024 * 1024) << " MiB\n";
+
+    qint64 bestTokenize = -1, bestLoad = -1;
+    int loadedPoints = 0;
+    for (int i = 0; i < runs; i++) {
+        qint64 elapsed = tokenize(fileName);
+        if (bestTokenize < 0 || elapsed < bestTokenize) bestTokenize = elapsed;
+        elapsed = load(fileName, &loadedPoints);
+        if (elapsed < 0) {
+            qWarning() << "Could not load" << fileName;
+            return 1;
+        }
+        if (bestLoad < 0 || elapsed < bestLoad) bestLoad = elapsed;
+    }
+
+    out << "  XML tokenizing:\t" << bestTokenize << " ms\n";
+    out << "  Path::load():\t" << bestLoad << " ms, " << loadedPoints <<
+        " points (" <<
+        qint64(loadedPoints) * 1000 / qMax(bestLoad, qint64(1)) <<
+        " points/s)\n";
+    return 0;
+}
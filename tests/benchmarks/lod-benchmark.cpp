@@ -0,0 +1,172 @@
+/* vi: set et sw=4 ts=4 cino=t0,(0: */
+/*
+ * Copyright (C) 2020 Alberto Mardegan <mardy@users.sourceforge.net>
+ *
+ * This file is part of Mappero.
+ *
+ * Mappero is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Mappero is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Mappero.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Compares the level of detail computed by PathData (Douglas-Peucker) with
+ * the greedy algorithm it replaced: number of vertices drawn at each zoom
+ * level, and time needed to compute it. Tracks are synthesized, or loaded
+ * from the file given with "--file <path>".
+ */
+
+#include "Mappero/Path"
+#include "Mappero/Projection"
+
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QStringList>
+#include <QTextStream>
+#include <cmath>
+
+using namespace Mappero;
+
+static const int maxZoom = 17;
+
+/* The algorithm used before, for reference */
+static void greedyOptimize(QVector<PathPoint> &points)
+{
+    int tolerance = 8;
+
+    if (points.isEmpty()) return;
+
+    QVector<PathPoint>::iterator curr = points.begin();
+    curr->zoom = SCHAR_MAX;
+    curr++;
+
+    QVector<PathPoint>::iterator prev;
+    for (; curr != points.end(); curr++) {
+        int dx, dy, dmax, zoom;
+
+        prev = curr - 1;
+        dx = curr->unit.x() - prev->unit.x();
+        dy = curr->unit.y() - prev->unit.y();
+        dmax = qMax(qAbs(dx), qAbs(dy));
+
+        for (zoom = 0; dmax > tolerance << zoom; zoom++) {}
+
+        while (zoom >= prev->zoom) {
+            QVector<PathPoint>::iterator prevBefore;
+            for (prevBefore = prev; prev->zoom <= zoom; prev--) {}
+
+            if (prev == prevBefore) break;
+
+            dx = curr->unit.x() - prev->unit.x();
+            dy = curr->unit.y() - prev->unit.y();
+            dmax = qMax(qAbs(dx), qAbs(dy));
+
+            for (; dmax > tolerance << zoom; zoom++) {}
+        }
+
+        curr->zoom = zoom;
+    }
+}
+
+static int vertexCount(const QVector<PathPoint> &points, int zoom)
+{
+    /* The first point is always drawn, the others if their zoom is higher */
+    int count = points.isEmpty() ? 0 : 1;
+    for (int i = 1; i < points.count(); i++) {
+        if (points[i].zoom > zoom) count++;
+    }
+    return count;
+}
+
+static QVector<PathPoint> makeTrack(int pointCount, double noise)
+{
+    /* A walk along a winding road, at one point per second; the GPS error
+     * makes the recorded track zigzag around it */
+    QVector<PathPoint> points;
+    points.reserve(pointCount);
+    quint32 random = 12345;
+    for (int i = 0; i < pointCount; i++) {
+        random = random * 1103515245u + 12345u;
+        double nLat = ((random >> 16) % 1000 / 1000.0 - 0.5) * noise;
+        random = random * 1103515245u + 12345u;
+        double nLon = ((random >> 16) % 1000 / 1000.0 - 0.5) * noise;
+        double lat = 60.17 + 0.02 * sin(i * 0.0003) + i * 0.0000002 + nLat;
+        double lon = 24.94 + 0.04 * cos(i * 0.0002) + nLon;
+        points.append(PathPoint(GeoPoint(lat, lon)));
+    }
+    return points;
+}
+
+static QVector<PathPoint> loadTrack(const QString &fileName)
+{
+    QVector<PathPoint> points;
+    Path path;
+    if (!path.load(fileName)) return points;
+
+    const Projection *projection = Projection::get(Projection::GOOGLE);
+    Q_FOREACH(const QPolygon &polyline, path.toUnitPolylines()) {
+        Q_FOREACH(const QPoint &unit, polyline) {
+            Point p(unit.x(), unit.y());
+            points.append(PathPoint(projection->unitToGeo(p)));
+        }
+    }
+    return points;
+}
+
+static void report(const QString &name, const QVector<PathPoint> &track)
+{
+    QTextStream out(stdout);
+    out << name << " (" << track.count() << " points):\n";
+    if (track.isEmpty()) return;
+
+    QElapsedTimer timer;
+
+    QVector<PathPoint> greedy = track;
+    timer.start();
+    greedyOptimize(greedy);
+    qint64 greedyNs = timer.nsecsElapsed();
+
+    PathData data;
+    data.points.reserve(track.count());
+    Q_FOREACH(const PathPoint &p, track) {
+        data.appendPoint(p);
+    }
+    timer.start();
+    /* This also computes distances and bounds */
+    data.completePoints();
+    qint64 simplifiedNs = timer.nsecsElapsed();
+
+    out << "  build time: greedy " << greedyNs / 1000000 << " ms, " <<
+        "Douglas-Peucker " << simplifiedNs / 1000000 << " ms\n";
+    out << "  zoom\tgreedy\tDouglas-Peucker\n";
+    for (int zoom = 0; zoom <= maxZoom; zoom++) {
+        out << "  " << zoom << "\t" << vertexCount(greedy, zoom) << "\t" <<
+            vertexCount(data.points, zoom) << "\n";
+    }
+}
+
+int main(int argc, char **argv)
+{
+    QCoreApplication app(argc, argv);
+
+    QStringList args = app.arguments();
+    int fileArg = args.indexOf("--file");
+    if (fileArg > 0 && fileArg + 1 < args.count()) {
+        report(args[fileArg + 1], loadTrack(args[fileArg + 1]));
+        return 0;
+    }
+
+    /* The noise is about 5 metres */
+    report("smooth track", makeTrack(1000000, 0.0));
+    report("noisy track", makeTrack(1000000, 0.00005));
+    return 0;
+}
@@ -0,0 +1,313 @@
+/* vi: set et sw=4 ts=4 cino=t0,(0: */
+/*
+ * Copyright (C) 2020 Alberto Mardegan <mardy@users.sourceforge.net>
+ *
+ * This file is part of Mappero.
+ *
+ * Mappero is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Mappero is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Mappero.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Drives a Map through a scripted flight (pans, flings and zoom animations)
+ * in an offscreen window, and reports frame times, tile requests and CPU
+ * time. Tiles are served by a fake in-process network; alternatively, a
+ * local tile directory can be given with "--tiles <dir>".
+ */
+
+#include "configuration.h"
+#include "controller.h"
+#include "fake_network.h"
+#include "map.h"
+#include "path-item.h"
+#include "path-layer.h"
+#include "poi-view.h"
+#include "tile-download.h"
+#include "tiled-layer.h"
+
+#include <Mappero/Path>
+#include <Mappero/Projection>
+#include <Mappero/poi-model.h>
+#include <QBuffer>
+#include <QElapsedTimer>
+#include <QGuiApplication>
+#include <QImage>
+#include <QPainter>
+#include <QQmlComponent>
+#include <QQmlEngine>
+#include <QQuickWindow>
+#include <QTemporaryDir>
+#include <QTextStream>
+#include <QThreadPool>
+#include <algorithm>
+#include <ctime>
+
+using namespace Mappero;
+
+namespace {
+
+class Flight
+{
+public:
+    Flight(QQuickWindow *window, Map *map): m_window(window), m_map(map) {}
+
+    void pan(const QPoint &pixels, int frames) {
+        scroll(pixels, frames, false);
+    }
+    void fling(const QPoint &pixels, int frames) {
+        scroll(pixels, frames, true);
+    }
+    void zoom(qreal zoomLevel, int frames);
+
+    void waitForTiles();
+
+    const QVector<qint64> &frameTimes() const { return m_frameTimes; }
+
+private:
+    void scroll(const QPoint &pixels, int frames, bool decelerate);
+    void renderFrame();
+
+private:
+    QQuickWindow *m_window;
+    Map *m_map;
+    QVector<qint64> m_frameTimes;
+};
+
+} // namespace
+
+void Flight::scroll(const QPoint &pixels, int frames, bool decelerate)
+{
+    Point start = m_map->centerUnits();
+    qreal zoom = m_map->zoomLevel();
+
+    for (int i = 1; i <= frames; i++) {
+        qreal t = qreal(i) / frames;
+        /* a fling starts fast and decelerates */
+        if (decelerate) t = 1.0 - (1.0 - t) * (1.0 - t);
+        QPoint offset = (QPointF(pixels) * t).toPoint();
+        Point units = start.translated(Point::fromPixel(offset, zoom));
+        m_map->setAnimatedCenterUnits(units);
+        renderFrame();
+    }
+
+    /* like the flickable does at the end of a pan */
+    Point end = start.translated(Point::fromPixel(pixels, zoom));
+    m_map->setCenter(m_map->projection()->unitToGeo(end));
+    renderFrame();
+}
+
+void Flight::zoom(qreal zoomLevel, int frames)
+{
+    qreal from = m_map->zoomLevel();
+    m_map->setRequestedZoomLevel(zoomLevel);
+    qreal to = m_map->requestedZoomLevel();
+
+    /* the last step reaches the requested level, which commits the zoom */
+    for (int i = 1; i <= frames; i++) {
+        m_map->setAnimatedZoomLevel(from + (to - from) * i / frames);
+        renderFrame();
+    }
+}
+
+void Flight::waitForTiles()
+{
+    QThreadPool::globalInstance()->waitForDone();
+    QCoreApplication::processEvents();
+    m_window->grabWindow();
+}
+
+void Flight::renderFrame()
+{
+    QElapsedTimer timer;
+    timer.start();
+
+    /* deliver the map events and any finished tiles, then render */
+    QCoreApplication::processEvents();
+    m_window->grabWindow();
+
+    m_frameTimes.append(timer.nsecsElapsed());
+}
+
+static QByteArray makeTile()
+{
+    QImage image(TILE_SIZE_PIXELS, TILE_SIZE_PIXELS, QImage::Format_RGB32);
+    image.fill(QColor("#f2efe9"));
+
+    QPainter painter(&image);
+    painter.setRenderHint(QPainter::Antialiasing);
+    painter.setPen(QPen(QColor("#aaa"), 3));
+    for (int i = 0; i < TILE_SIZE_PIXELS; i += 32) {
+        painter.drawLine(0, i, TILE_SIZE_PIXELS, TILE_SIZE_PIXELS - i);
+    }
+    painter.end();
+
+    QByteArray data;
+    QBuffer buffer(&data);
+    buffer.open(QIODevice::WriteOnly);
+    image.save(&buffer, "PNG");
+    return data;
+}
+
+static Path makeTrack(const GeoPoint &center, int count)
+{
+    /* a spiral around the center */
+    Path path;
+    for (int i = 0; i < count; i++) {
+        qreal angle = i * 0.01;
+        qreal radius = 0.0005 * sqrt(qreal(i));
+        path.addPoint(GeoPoint(center.lat + radius * sin(angle),
+                               center.lon + 2 * radius * cos(angle)),
+                      0, 1600000000 + i);
+    }
+    return path;
+}
+
+static qreal percentile(const QVector<qint64> &sorted, qreal p)
+{
+    if (sorted.isEmpty()) return 0;
+    int index = qMin(sorted.count() - 1, int(p * sorted.count()));
+    return sorted[index] / 1.0e6;
+}
+
+static void runFlight(const QString &name,
+                      QQuickWindow *window, Map *map,
+                      const GeoPoint &center, qreal zoomLevel,
+                      FakeTileServer *tileServer)
+{
+    map->setCenter(center);
+    map->setRequestedZoomLevel(zoomLevel);
+    map->setAnimatedZoomLevel(zoomLevel);
+
+    Flight flight(window, map);
+    flight.waitForTiles();
+    if (tileServer) tileServer->resetRequestCount();
+
+    QElapsedTimer wallTimer;
+    wallTimer.start();
+    std::clock_t cpuStart = std::clock();
+
+    flight.pan(QPoint(300, 0), 30);
+    flight.pan(QPoint(0, -200), 20);
+    flight.fling(QPoint(-1200, 600), 60);
+    flight.zoom(zoomLevel - 2, 30);
+    flight.fling(QPoint(800, 800), 60);
+    flight.zoom(zoomLevel + 1, 30);
+    flight.pan(QPoint(-400, -300), 30);
+    flight.waitForTiles();
+
+    qreal cpuMs = 1000.0 * (std::clock() - cpuStart) / CLOCKS_PER_SEC;
+    qint64 wallMs = wallTimer.elapsed();
+
+    QVector<qint64> times = flight.frameTimes();
+    std::sort(times.begin(), times.end());
+
+    QTextStream out(stdout);
+    out << name << ":\n";
+    out << "  frames:            " << times.count() << "\n";
+    out << "  frame time (ms):   p50 " << percentile(times, 0.5) <<
+        ", p90 " << percentile(times, 0.9) <<
+        ", p99 " << percentile(times, 0.99) <<
+        ", max " << percentile(times, 1.0) << "\n";
+    out << "  tiles requested:   " <<
+        (tileServer ? tileServer->requestCount() : 0) << "\n";
+    out << "  CPU time (ms):     " << cpuMs << "\n";
+    out << "  wall time (ms):    " << wallMs << "\n";
+}
+
+int main(int argc, char **argv)
+{
+    if (qEnvironmentVariableIsEmpty("QT_QPA_PLATFORM"))
+        qputenv("QT_QPA_PLATFORM", "offscreen");
+    if (qEnvironmentVariableIsEmpty("QT_QUICK_BACKEND"))
+        qputenv("QT_QUICK_BACKEND", "software");
+
+    QGuiApplication app(argc, argv);
+    app.setOrganizationName("mappero-benchmark");
+    app.setApplicationName("navigation-benchmark");
+    Mappero::registerTypes();
+
+    QString tileDir;
+    QStringList args = app.arguments();
+    int tilesArg = args.indexOf("--tiles");
+    if (tilesArg > 0 && tilesArg + 1 < args.count()) {
+        tileDir = args[tilesArg + 1];
+    }
+
+    QTemporaryDir cacheDir;
+    Controller controller;
+    Configuration *conf = controller.configuration();
+    conf->setValue("MapCacheDir", tileDir.isEmpty() ?
+                   cacheDir.path() + '/' : tileDir + '/');
+
+    QScopedPointer<FakeTileServer> tileServer;
+    if (tileDir.isEmpty()) {
+        tileServer.reset(new FakeTileServer(makeTile()));
+        controller.tileDownload()->
+            setNetworkAccessManagerFactory(tileServer.data());
+    }
+
+    QQmlEngine engine;
+    QQuickWindow window;
+    window.resize(800, 480);
+    window.show();
+
+    GeoPoint center(60.17, 24.94);
+
+    Map *map = new Map;
+    map->setParentItem(window.contentItem());
+    map->setSize(QSizeF(window.size()));
+    map->setCenter(center);
+
+    TiledLayer *layer = new TiledLayer;
+    layer->setId("benchmark");
+    layer->setName("Benchmark");
+    layer->setUrl("http://tiles.invalid/%0d/%d/%d.png");
+    layer->setFormat("png");
+    layer->setTypeName("XYZ_INV");
+    layer->setMinZoom(0);
+    layer->setMaxZoom(19);
+    map->setMainLayer(layer);
+
+    PathLayer *pathLayer = new PathLayer;
+    pathLayer->setParentItem(map);
+    PathItem *track = new PathItem;
+    track->setColor(Qt::red);
+    track->setParentItem(pathLayer);
+    track->setPath(makeTrack(center, 50000));
+
+    QQmlComponent delegate(&engine);
+    delegate.setData("import QtQuick 2.0\n"
+                     "Rectangle { width: 12; height: 12; color: \"blue\" }",
+                     QUrl());
+    PoiModel poiModel;
+    PoiView *poiView = new PoiView;
+    QQmlEngine::setContextForObject(poiView, engine.rootContext());
+    poiView->setParentItem(map);
+    poiView->setSize(map->size());
+    poiView->setDelegate(&delegate);
+    poiView->setModel(&poiModel);
+    for (int i = 0; i < 200; i++) {
+        QVariantMap poi;
+        poi.insert("geoPoint", QVariant::fromValue(
+            GeoPoint(center.lat + (i % 20 - 10) * 0.01,
+                     center.lon + (i / 20 - 5) * 0.02)));
+        poiModel.append(poi);
+    }
+
+    runFlight("cold cache", &window, map, center, 6, tileServer.data());
+    runFlight("warm cache", &window, map, center, 6, tileServer.data());
+
+    /* don't leave our settings around */
+    conf->clear();
+    return 0;
+}
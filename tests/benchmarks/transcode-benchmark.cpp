@@ -0,0 +1,170 @@
+/* vi: set et sw=4 ts=4 cino=t0,(0: */
+/*
+ * Copyright (C) 2020 Alberto Mardegan <mardy@users.sourceforge.net>
+ *
+ * This file is part of Mappero.
+ *
+ * Mappero is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Mappero is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Mappero.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Compares the on-disk size and the decoding time of map tiles stored in
+ * the cache formats supported by TileTranscoder. The tiles are either
+ * synthesized (map-like and photo-like ones) or read from a directory given
+ * with "--tiles <dir>".
+ */
+
+#include "tile-transcoder.h"
+
+#include <QBuffer>
+#include <QDirIterator>
+#include <QElapsedTimer>
+#include <QGuiApplication>
+#include <QImage>
+#include <QImageWriter>
+#include <QPainter>
+#include <QTextStream>
+#include <cmath>
+
+using namespace Mappero;
+
+static const int tileSize = 256;
+
+static QByteArray encode(const QImage &image, const char *format)
+{
+    QByteArray data;
+    QBuffer buffer(&data);
+    buffer.open(QIODevice::WriteOnly);
+    image.save(&buffer, format);
+    return data;
+}
+
+static QByteArray makeMapTile(int seed)
+{
+    /* few flat colors and some lines, like a street map */
+    QImage image(tileSize, tileSize, QImage::Format_RGB32);
+    image.fill(QColor(242, 239, 233));
+    QPainter painter(&image);
+    painter.setRenderHint(QPainter::Antialiasing);
+    painter.setPen(Qt::NoPen);
+    painter.setBrush(QColor(170, 211, 223));
+    painter.drawEllipse(QPoint(seed * 37 % tileSize, seed * 91 % tileSize),
+                        60, 40);
+    painter.setBrush(QColor(205, 235, 176));
+    painter.drawRect(seed * 13 % 200, seed * 29 % 200, 50, 70);
+    for (int i = 0; i < 12; i++) {
+        painter.setPen(QPen(i % 3 ? Qt::white : QColor(248, 178, 156),
+                            2 + i % 4));
+        int x = (seed * 17 + i * 41) % tileSize;
+        painter.drawLine(x, 0, tileSize - x, tileSize);
+    }
+    painter.end();
+    return encode(image, "PNG");
+}
+
+static QByteArray makePhotoTile(int seed)
+{
+    /* smooth gradients plus noise, like aerial imagery */
+    QImage image(tileSize, tileSize, QImage::Format_RGB32);
+    quint32 noise = seed * 2654435761u + 1;
+    for (int y = 0; y < tileSize; y++) {
+        QRgb *line = reinterpret_cast<QRgb*>(image.scanLine(y));
+        for (int x = 0; x < tileSize; x++) {
+            noise = noise * 1103515245u + 12345u;
+            int n = (noise >> 16) % 32;
+            int g = 90 + int(40 * sin((x + seed) * 0.05) *
+                             cos((y - seed) * 0.03));
+            line[x] = qRgb(qBound(0, g - 30 + n, 255),
+                           qBound(0, g + n, 255),
+                           qBound(0, g - 50 + n, 255));
+        }
+    }
+    return encode(image, "JPEG");
+}
+
+struct Result {
+    Result(): bytes(0), decodeNs(0) {}
+    qint64 bytes;
+    qint64 decodeNs;
+};
+
+static Result measure(const TileTranscoder &transcoder,
+                      const QList<QByteArray> &tiles)
+{
+    Result result;
+    QElapsedTimer timer;
+    Q_FOREACH(const QByteArray &original, tiles) {
+        QImage image = QImage::fromData(original);
+        QByteArray stored = transcoder.transcode(image, original);
+        result.bytes += stored.size();
+
+        timer.start();
+        QImage decoded = QImage::fromData(stored);
+        result.decodeNs += timer.nsecsElapsed();
+        Q_UNUSED(decoded);
+    }
+    return result;
+}
+
+static void report(const QString &name, const QList<QByteArray> &tiles)
+{
+    if (tiles.isEmpty()) return;
+
+    QList<QByteArray> formats;
+    formats << "" << "png" << "png8" << "jpeg";
+    if (QImageWriter::supportedImageFormats().contains("webp")) {
+        formats << "webp";
+    }
+
+    QTextStream out(stdout);
+    out << name << " (" << tiles.count() << " tiles):\n";
+    qint64 originalBytes = 0;
+    Q_FOREACH(const QByteArray &format, formats) {
+        Result result = measure(TileTranscoder(format, 80), tiles);
+        if (format.isEmpty()) originalBytes = result.bytes;
+        out << "  " << (format.isEmpty() ? "original" : format.constData()) <<
+            ":\t" << result.bytes / 1024 << " KiB (" <<
+            int(100 * result.bytes / qMax(originalBytes, qint64(1))) <<
+            "%), decode " <<
+            result.decodeNs / 1000 / tiles.count() << " us/tile\n";
+    }
+}
+
+int main(int argc, char **argv)
+{
+    QGuiApplication app(argc, argv);
+
+    QStringList args = app.arguments();
+    int tilesArg = args.indexOf("--tiles");
+    if (tilesArg > 0 && tilesArg + 1 < args.count()) {
+        QList<QByteArray> tiles;
+        QDirIterator it(args[tilesArg + 1], QDir::Files,
+                        QDirIterator::Subdirectories);
+        while (it.hasNext() && tiles.count() < 2000) {
+            QFile file(it.next());
+            if (file.open(QIODevice::ReadOnly)) tiles.append(file.readAll());
+        }
+        report(args[tilesArg + 1], tiles);
+        return 0;
+    }
+
+    QList<QByteArray> mapTiles, photoTiles;
+    for (int i = 0; i < 100; i++) {
+        mapTiles.append(makeMapTile(i));
+        photoTiles.append(makePhotoTile(i));
+    }
+    report("map-like tiles", mapTiles);
+    report("photo-like tiles", photoTiles);
+    return 0;
+}
@@ -23,6 +23,7 @@
 #ifndef FAKE_NETWORK_H
 #define FAKE_NETWORK_H
 
+#include <QAtomicInt>
 #include <QJsonDocument>
 #include <QJsonObject>
 #include <QNetworkAccessManager>
@@ -114,4 +115,29 @@ Q_SIGNALS:
     void requestCreated(FakeReply *reply);
 };
 
+/* Answers every request with the same payload; used to serve map tiles
+ * without touching the network. The factory can be used from any thread. */
+class FakeTileServer: public QObject, public QQmlNetworkAccessManagerFactory
+{
+    Q_OBJECT
+public:
+    FakeTileServer(const QByteArray &tileData): m_tileData(tileData) {}
+    QNetworkAccessManager *create(QObject *parent) override {
+        FakeNam *nam = new FakeNam(parent);
+        QObject::connect(nam, &FakeNam::requestCreated,
+                         nam, [this](FakeReply *reply) {
+            m_requestCount.ref();
+            reply->setData(m_tileData);
+        }, Qt::DirectConnection);
+        return nam;
+    }
+
+    int requestCount() const { return m_requestCount.load(); }
+    void resetRequestCount() { m_requestCount.store(0); }
+
+private:
+    QByteArray m_tileData;
+    QAtomicInt m_requestCount;
+};
+
 #endif // FAKE_NETWORK_H
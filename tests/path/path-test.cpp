@@ -21,7 +21,11 @@
 #include "path-test.h"
 
 #include "Mappero/Path"
+#include "Mappero/TrackIndex"
+#include <QBuffer>
+#include <QDateTime>
 #include <QDebug>
+#include <QFile>
 
 #define UTF8(s) QString::fromUtf8(s)
 
@@ -51,6 +55,55 @@ void PathTest::loadGpx()
     QCOMPARE(route.source(), QStringLiteral("google drive"));
 }
 
+void PathTest::gpxValues()
+{
+    QByteArray gpx(
+        "<?xml version=\"1.0\"?>\n"
+        "<gpx version=\"1.0\"><trk><trkseg>\n"
+        "<trkpt lat=\"60.161102\" lon=\"24.879995\">"
+        "<ele>-32.00</ele><time>2011-08-25T18:27:09Z</time></trkpt>\n"
+        "<trkpt lat=\" -0.5 \" lon=\"+179.99999999999999999\">"
+        "<ele> 1204.7 </ele><time>2011-08-25T20:27:09.750+02:00</time>"
+        "</trkpt>\n"
+        "<trkpt lat=\"1e-3\" lon=\"-024.1\">"
+        "<ele><!-- comment -->12</ele><time>1969-12-31T23:00:00-0100</time>"
+        "<extensions><hr>120</hr></extensions></trkpt>\n"
+        "<trkpt lat=\"60\" lon=\"24\"><ele/>"
+        "<time>2011-08-25T18:33:02</time></trkpt>\n"
+        "</trkseg></trk></gpx>\n");
+    QBuffer buffer(&gpx);
+    buffer.open(QIODevice::ReadOnly);
+
+    Path path;
+    QVERIFY(path.load(&buffer));
+    QCOMPARE(path.d->points.count(), 4);
+
+    const PathPoint &p0 = path.d->points[0];
+    QCOMPARE(p0.geo.lat, Geo(QString("60.161102").toDouble()));
+    QCOMPARE(p0.geo.lon, Geo(QString("24.879995").toDouble()));
+    QCOMPARE(int(p0.altitude), -32);
+    QCOMPARE(p0.time, time_t(1314296829));
+
+    const PathPoint &p1 = path.d->points[1];
+    QCOMPARE(p1.geo.lat, Geo(-0.5));
+    QCOMPARE(p1.geo.lon,
+             Geo(QString("179.99999999999999999").toDouble()));
+    QCOMPARE(int(p1.altitude), 1204);
+    QCOMPARE(p1.time, time_t(1314296829));
+
+    const PathPoint &p2 = path.d->points[2];
+    QCOMPARE(p2.geo.lat, Geo(0.001));
+    QCOMPARE(p2.geo.lon, Geo(-24.1));
+    QCOMPARE(int(p2.altitude), 12);
+    QCOMPARE(p2.time, time_t(0));
+
+    /* Without a time zone, it's local time */
+    const PathPoint &p3 = path.d->points[3];
+    QCOMPARE(int(p3.altitude), 0);
+    QCOMPARE(p3.time, time_t(QDateTime::fromString("2011-08-25T18:33:02",
+                                                   Qt::ISODate).toTime_t()));
+}
+
 void PathTest::loadKml()
 {
     Path route;
@@ -77,6 +130,47 @@ void PathTest::loadKml()
     QCOMPARE(route.d->segments.count(), 1);
 }
 
+void PathTest::kmlCoordinates()
+{
+    QByteArray kml(
+        "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+        "<kml xmlns=\"http://www.opengis.net/kml/2.2\"><Document>\n"
+        "<Placemark><name>Start</name>"
+        "<Point><coordinates>24.1,60.1,0</coordinates></Point></Placemark>\n"
+        "<Placemark><name>Missing</name>"
+        "<Point><coordinates>25,61</coordinates></Point></Placemark>\n"
+        "<Placemark><name>Back</name>"
+        "<Point><coordinates>24.1,60.1</coordinates></Point></Placemark>\n"
+        "<Placemark><LineString><coordinates>\n"
+        "\t24.1,60.1,12.5\n"
+        "  24.2,60.2  24.3,60.3,7,\r\n"
+        "24.4\n"
+        "24.1,60.1,3   </coordinates></LineString></Placemark>\n"
+        "</Document></kml>\n");
+    QBuffer buffer(&kml);
+    buffer.open(QIODevice::ReadOnly);
+
+    Path path;
+    QVERIFY(path.load(&buffer));
+
+    /* The incomplete tuple is skipped */
+    const QVector<PathPoint> &points = path.d->points;
+    QCOMPARE(points.count(), 4);
+    QCOMPARE(points[0].geo, GeoPoint(Geo(60.1), Geo(24.1)));
+    QCOMPARE(int(points[0].altitude), 12);
+    QCOMPARE(points[1].geo, GeoPoint(Geo(60.2), Geo(24.2)));
+    QCOMPARE(int(points[1].altitude), 0);
+    QCOMPARE(points[2].geo, GeoPoint(Geo(60.3), Geo(24.3)));
+    QCOMPARE(int(points[2].altitude), 7);
+    QCOMPARE(points[3].geo, GeoPoint(Geo(60.1), Geo(24.1)));
+
+    /* Waypoints are matched in order; the one not on the path is dropped */
+    QCOMPARE(path.wayPointCount(), 2);
+    QCOMPARE(path.wayPointText(0), UTF8("Start"));
+    QCOMPARE(path.wayPointAt(0).geo, points[0].geo);
+    QCOMPARE(path.wayPointText(1), UTF8("Back"));
+}
+
 void PathTest::saveGpx()
 {
     Path path;
@@ -87,6 +181,58 @@ void PathTest::saveGpx()
     path.save("/tmp/Lauttasaari.gpx");
 }
 
+void PathTest::binaryTrack()
+{
+    QStringList files;
+    files << ":/Lauttasaari.gpx" << ":/Route.gpx";
+    Q_FOREACH(const QString &file, files) {
+        Path path;
+        path.load(file);
+        QVERIFY(path.save("/tmp/path-test.mtrk"));
+
+        Path copy;
+        QVERIFY(copy.load("/tmp/path-test.mtrk"));
+        QCOMPARE(copy.d->points.count(), path.d->points.count());
+        QCOMPARE(copy.d->segments.count(), path.d->segments.count());
+        for (int i = 0; i < path.d->segments.count(); i++) {
+            QCOMPARE(copy.d->segments[i].startIndex,
+                     path.d->segments[i].startIndex);
+        }
+        for (int i = 0; i < path.d->points.count(); i++) {
+            const PathPoint &p = path.d->points[i];
+            const PathPoint &c = copy.d->points[i];
+            QVERIFY(qAbs(c.geo.lat - p.geo.lat) < 1e-5);
+            QVERIFY(qAbs(c.geo.lon - p.geo.lon) < 1e-5);
+            QCOMPARE(c.time, p.time);
+            QCOMPARE(c.altitude, p.altitude);
+            QCOMPARE(c.zoom, p.zoom);
+            QCOMPARE(c.distance, p.distance);
+        }
+        QCOMPARE(copy.wayPointCount(), path.wayPointCount());
+        for (int i = 0; i < path.wayPointCount(); i++) {
+            QCOMPARE(copy.wayPointData(i), path.wayPointData(i));
+        }
+        QCOMPARE(copy.length(), path.length());
+        QCOMPARE(copy.boundingRect(), path.boundingRect());
+        QCOMPARE(copy.source(), path.source());
+
+        /* New points are optimized as if the path was built here */
+        path.addPoint(GeoPoint(60.2, 24.9), 10);
+        copy.addPoint(GeoPoint(60.2, 24.9), 10);
+        QCOMPARE(copy.lastPoint().zoom, path.lastPoint().zoom);
+    }
+
+    /* A point count which doesn't match the data must not be trusted */
+    QFile file("/tmp/path-test.mtrk");
+    QVERIFY(file.open(QIODevice::ReadWrite));
+    QVERIFY(file.seek(12));
+    QVERIFY(file.write("\xff\xff\xff\x7f", 4) == 4);
+    file.close();
+    Path broken;
+    QVERIFY(!broken.load("/tmp/path-test.mtrk"));
+    QVERIFY(broken.isEmpty());
+}
+
 void PathTest::positionAt()
 {
     Path path;
@@ -105,4 +251,253 @@ void PathTest::positionAt()
     QCOMPARE(p.geo, GeoPoint(60.164066, 24.865551));
 }
 
+void PathTest::positionsAt()
+{
+    Path path;
+
+    path.load(":/Lauttasaari.gpx");
+    time_t first = path.firstPoint().time;
+    time_t last = path.lastPoint().time;
+    QVERIFY(last > first);
+
+    QVector<time_t> times;
+    times << first - 10 << first;
+    for (time_t t = first + 1; t < last; t += 7) {
+        times << t;
+    }
+    times << last << last + 10;
+    /* Unsorted times must work, too */
+    times << first + 3 << first + 1;
+
+    QVector<PathPoint> positions = path.positionsAt(times);
+    QCOMPARE(positions.count(), times.count());
+    for (int i = 0; i < times.count(); i++) {
+        QCOMPARE(positions[i], path.positionAt(times[i]));
+    }
+    QCOMPARE(positions.first(), PathPoint());
+    QCOMPARE(positions[1], path.firstPoint());
+
+    QVERIFY(Path().positionsAt(times).count() == times.count());
+}
+
+void PathTest::bulkBuild()
+{
+    Path loaded;
+    loaded.load(":/Lauttasaari.gpx");
+    QVERIFY(loaded.length() > 0);
+
+    /* Segments are simplified separately: rebuild the same ones */
+    const QVector<PathPoint> &points = loaded.d->points;
+    const QList<PathSegment> &segments = loaded.d->segments;
+    Path single;
+    Path bulk;
+    for (int s = 0; s < segments.count(); s++) {
+        int end = s + 1 < segments.count() ?
+            segments[s + 1].startIndex : points.count();
+        if (s > 0) {
+            single.appendBreak();
+            bulk.appendBreak();
+        }
+
+        QVariantList pointList;
+        for (int i = segments[s].startIndex; i < end; i++) {
+            QVariantMap point;
+            point.insert("lat", points[i].geo.lat);
+            point.insert("lon", points[i].geo.lon);
+            point.insert("altitude", points[i].altitude);
+            pointList.append(point);
+            single.addPoint(point);
+        }
+        QCOMPARE(bulk.addPoints(pointList), pointList.count());
+    }
+
+    QCOMPARE(bulk.d->points.count(), single.d->points.count());
+    QCOMPARE(bulk.d->points.count(), points.count());
+    for (int i = 0; i < bulk.d->points.count(); i++) {
+        const PathPoint &p = bulk.d->points[i];
+        QCOMPARE(p.geo, single.d->points[i].geo);
+        QCOMPARE(p.zoom, single.d->points[i].zoom);
+        QCOMPARE(p.zoom, points[i].zoom);
+        QCOMPARE(p.distance, single.d->points[i].distance);
+    }
+    QCOMPARE(bulk.length(), single.length());
+    QCOMPARE(bulk.boundingRect(), single.boundingRect());
+    QCOMPARE(bulk.boundingRect(), loaded.boundingRect());
+}
+
+void PathTest::segmentBreaks()
+{
+    Path path;
+    path.addPoint(GeoPoint(60.0, 24.0), 0, 0, -1);
+    path.addPoint(GeoPoint(60.01, 24.0), 0, 0, -1);
+    Geo segmentLength = path.length();
+    QVERIFY(segmentLength > 0);
+
+    /* The jump to the next segment is not part of the track */
+    path.appendBreak();
+    path.addPoint(GeoPoint(61.0, 25.0), 0, 0, -1);
+    path.addPoint(GeoPoint(61.01, 25.0), 0, 0, -1);
+    QCOMPARE(path.d->points[2].distance, 0.0f);
+    QVERIFY(path.length() < 2.1 * segmentLength);
+}
+
+static double distanceToSegment(const QPointF &p,
+                                const QPointF &a, const QPointF &b)
+{
+    QPointF ab = b - a;
+    double ab2 = QPointF::dotProduct(ab, ab);
+    double t = ab2 > 0 ?
+        qBound(0.0, QPointF::dotProduct(p - a, ab) / ab2, 1.0) : 0.0;
+    QPointF d = p - (a + t * ab);
+    return sqrt(QPointF::dotProduct(d, d));
+}
+
+void PathTest::levelOfDetail()
+{
+    /* A straight line needs only its ends */
+    Path line;
+    for (int i = 0; i < 100; i++) {
+        line.addPoint(GeoPoint(60.0, 24.0 + i * 0.001), 0);
+    }
+    QCOMPARE(line.toPainterPath(0).elementCount(), 2);
+
+    /* A GPS logger standing still; this must not take quadratic time */
+    QVariantList still;
+    for (int i = 0; i < 5000; i++) {
+        QVariantMap point;
+        point.insert("lat", 60.0);
+        point.insert("lon", 24.0);
+        still.append(point);
+    }
+    Path stillPath;
+    QCOMPARE(stillPath.addPoints(still), still.count());
+    QCOMPARE(stillPath.toPainterPath(0).elementCount(), 2);
+    for (int i = 1; i < still.count() - 1; i++) {
+        QCOMPARE(int(stillPath.d->points[i].zoom), 0);
+    }
+
+    Path path;
+    path.load(":/Lauttasaari.gpx");
+    const QVector<PathPoint> &points = path.d->points;
+    int previousCount = points.count() + 1;
+    for (int zoom = 0; zoom < 16; zoom++) {
+        int count = path.toPainterPath(zoom).elementCount();
+        QVERIFY(count <= previousCount);
+        previousCount = count;
+
+        /* Hidden points are within 2 pixels of the drawn line */
+        int a = 0;
+        for (int b = 1; b < points.count(); b++) {
+            if (points[b].zoom <= zoom) continue;
+            for (int i = a + 1; i < b; i++) {
+                double error = distanceToSegment(points[i].unit,
+                                                 points[a].unit,
+                                                 points[b].unit);
+                QVERIFY(error <= 2 << zoom);
+            }
+            a = b;
+        }
+    }
+    QVERIFY(previousCount < 10);
+}
+
+void PathTest::visibleChunks()
+{
+    /* A zigzag, so that no point is dropped at zoom 0 */
+    Path path;
+    for (int i = 0; i < 1000; i++) {
+        path.addPoint(GeoPoint(60.0 + (i % 2) * 0.01, 24.0 + i * 0.001), 0);
+    }
+    QVERIFY(path.d->chunks.count() > 1);
+
+    int total = path.toPainterPath(0).elementCount();
+    QCOMPARE(total, 1000);
+
+    const QVector<PathPoint> &points = path.d->points;
+    QRect all = QRect(points.first().unit,
+                      points.last().unit).normalized();
+    all.adjust(-1000, -1000, 1000, 1000);
+    QCOMPARE(path.toPainterPath(0, all).elementCount(), total);
+
+    QRect far = all.translated(all.width() * 2, 0);
+    QCOMPARE(path.toPainterPath(0, far).elementCount(), 0);
+
+    /* Only the chunks around the area are drawn */
+    QRect middle = QRect(points[500].unit,
+                         points[510].unit).normalized();
+    int count = path.toPainterPath(0, middle).elementCount();
+    QVERIFY(count > 10);
+    QVERIFY(count < total);
+}
+
+void PathTest::unitPolylines()
+{
+    Path path;
+
+    path.load(":/Lauttasaari.gpx");
+    QVector<QPolygon> polylines = path.toUnitPolylines();
+    QCOMPARE(polylines.count(), path.d->segments.count());
+
+    int points = 0;
+    Q_FOREACH(const QPolygon &polyline, polylines) {
+        points += polyline.count();
+    }
+    QCOMPARE(points, path.d->points.count());
+    QCOMPARE(polylines.first().first(), QPoint(path.firstPoint().unit));
+    QCOMPARE(polylines.last().last(), QPoint(path.lastPoint().unit));
+
+    QVERIFY(Path().toUnitPolylines().isEmpty());
+}
+
+static Path makeTrack(time_t start, time_t end, double lat)
+{
+    /* Eastwards along the given latitude, one point every ten seconds */
+    Path path;
+    for (time_t t = start; t <= end; t += 10) {
+        path.addPoint(GeoPoint(lat, 24.0 + (t - start) * 0.0001), 0, t);
+    }
+    return path;
+}
+
+void PathTest::trackIndex()
+{
+    TrackIndex index;
+    QVERIFY(index.isEmpty());
+    QCOMPARE(index.positionAt(1000), PathPoint());
+
+    Path first = makeTrack(1000, 2000, 60.0);
+    Path second = makeTrack(2100, 3000, 61.0);
+    Path overlapping = makeTrack(2500, 2600, 62.0);
+    QVERIFY(!index.addPath(Path()));
+    QVERIFY(index.addPath(second));
+    QVERIFY(index.addPath(first));
+    QVERIFY(index.addPath(overlapping));
+    QCOMPARE(index.pathCount(), 3);
+    QCOMPARE(index.startTime(), time_t(1000));
+    QCOMPARE(index.endTime(), time_t(3000));
+
+    QCOMPARE(index.positionAt(999), PathPoint());
+    QCOMPARE(index.positionAt(1000), first.positionAt(1000));
+    QCOMPARE(index.positionAt(1555), first.positionAt(1555));
+    QCOMPARE(index.positionAt(2000), first.positionAt(2000));
+    QCOMPARE(index.positionAt(2499), second.positionAt(2499));
+    /* The track started last wins */
+    QCOMPARE(index.positionAt(2500), overlapping.positionAt(2500));
+    QCOMPARE(index.positionAt(2600), overlapping.positionAt(2600));
+    QCOMPARE(index.positionAt(2601), second.positionAt(2601));
+    QCOMPARE(index.positionAt(3000), second.positionAt(3000));
+    QCOMPARE(index.positionAt(3001), PathPoint());
+
+    /* The gap is 100 seconds: halfway, we are halfway between the tracks */
+    index.setMaxGap(100);
+    PathPoint p = index.positionAt(2050);
+    QCOMPARE(p.geo.lat, Geo(60.5));
+    index.setMaxGap(99);
+    QCOMPARE(index.positionAt(2050), PathPoint());
+
+    index.clear();
+    QVERIFY(index.isEmpty());
+    QCOMPARE(index.pathCount(), 0);
+}
+
 QTEST_MAIN(PathTest)
@@ -35,11 +35,21 @@ private Q_SLOTS:
     void cleanupTestCase();
 
     void loadGpx();
+    void gpxValues();
     void loadKml();
+    void kmlCoordinates();
 
     void saveGpx();
+    void binaryTrack();
 
     void positionAt();
+    void positionsAt();
+    void bulkBuild();
+    void segmentBreaks();
+    void levelOfDetail();
+    void visibleChunks();
+    void unitPolylines();
+    void trackIndex();
 };
 
 }; // namespace